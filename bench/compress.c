@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Large-blob compression benchmarks. Payloads of typical sizes are
+ * compressed and decompressed in a loop for a fixed amount of time.
+ * The payload resembles base64-encoded key material, which is what
+ * large blobs mostly hold. Results are printed as one JSON object per
+ * line.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fido.h"
+
+static const size_t sizes[] = { 1024, 4096, 16384, 65536 };
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench_compress [-d seconds]\n");
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		err(1, "clock_gettime");
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+static void
+payload(fido_blob_t *b, size_t len)
+{
+	static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	    "abcdefghijklmnopqrstuvwxyz0123456789+/";
+	uint32_t x = 0x2545f491;
+
+	if ((b->ptr = malloc(len)) == NULL)
+		err(1, "malloc");
+	b->len = len;
+
+	for (size_t i = 0; i < len; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		/* a line break every 70 characters, as in PEM */
+		b->ptr[i] = (i % 71 == 70) ? '\n' :
+		    (unsigned char)alphabet[x % (sizeof(alphabet) - 1)];
+	}
+}
+
+static void
+report(const char *op, size_t len, unsigned long long ops, double elapsed,
+    size_t out_len)
+{
+	printf("{\"name\":\"%s_%zuk\",\"ops\":%llu,\"seconds\":%.3f,"
+	    "\"ops_per_sec\":%.1f,\"mb_per_sec\":%.1f,\"out_len\":%zu}\n", op,
+	    len / 1024, ops, elapsed, (double)ops / elapsed,
+	    (double)ops * (double)len / elapsed / 1e6, out_len);
+	fflush(stdout);
+}
+
+static void
+bench(size_t len, double seconds)
+{
+	fido_blob_t		 in, z, out;
+	unsigned long long	 ops;
+	double			 t0;
+	double			 t;
+
+	memset(&z, 0, sizeof(z));
+	memset(&out, 0, sizeof(out));
+	payload(&in, len);
+
+	ops = 0;
+	t0 = now();
+	do {
+		for (int i = 0; i < 16; i++) {
+			fido_blob_reset(&z);
+			if (fido_compress(&z, &in) != FIDO_OK)
+				errx(1, "fido_compress");
+			ops++;
+		}
+	} while ((t = now()) - t0 < seconds);
+	report("compress", len, ops, t - t0, z.len);
+
+	ops = 0;
+	t0 = now();
+	do {
+		for (int i = 0; i < 16; i++) {
+			fido_blob_reset(&out);
+			if (fido_uncompress(&out, &z, in.len) != FIDO_OK)
+				errx(1, "fido_uncompress");
+			ops++;
+		}
+	} while ((t = now()) - t0 < seconds);
+	report("uncompress", len, ops, t - t0, out.len);
+
+	if (out.len != in.len || memcmp(out.ptr, in.ptr, in.len) != 0)
+		errx(1, "round trip mismatch");
+
+	fido_blob_reset(&in);
+	fido_blob_reset(&z);
+	fido_blob_reset(&out);
+}
+
+int
+main(int argc, char **argv)
+{
+	double	 seconds = 1;
+	char	*ep;
+	int	 ch;
+
+	while ((ch = getopt(argc, argv, "d:")) != -1) {
+		switch (ch) {
+		case 'd':
+			seconds = strtod(optarg, &ep);
+			if (*ep != '\0' || seconds <= 0)
+				errx(1, "invalid duration: %s", optarg);
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc != optind)
+		usage();
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+		bench(sizes[i], seconds);
+
+	exit(0);
+}
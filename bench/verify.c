@@ -0,0 +1,701 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * Verification throughput benchmarks. Each case is verified in a loop
+ * for a fixed amount of time, first on a single thread and then on -j
+ * threads sharing the same objects. Results are printed as one JSON
+ * object per line. Allocations are counted on glibc, where malloc() and
+ * friends are interposed; elsewhere allocs_per_op is reported as -1.
+ *
+ * The ES256 assertion and packed attestation use the vectors in
+ * regress/vectors.h; the remaining cases are signed with keys generated at
+ * startup.
+ */
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fido.h>
+#include <fido/es256.h>
+#include <fido/rs256.h>
+#include <fido/eddsa.h>
+
+#include "vectors.h"
+
+#if !defined(LIBRESSL_VERSION_NUMBER) && OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define HAVE_ED25519
+#endif
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCS
+#endif
+
+#ifdef COUNT_ALLOCS
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+
+static __thread unsigned long long nalloc;
+
+void *
+malloc(size_t size)
+{
+	nalloc++;
+	return (__libc_malloc(size));
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	nalloc++;
+	return (__libc_calloc(nmemb, size));
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	nalloc++;
+	return (__libc_realloc(ptr, size));
+}
+#endif /* COUNT_ALLOCS */
+
+#define RP_ID		"localhost"
+#define RP_NAME		"sweet home localhost"
+#define MAXBENCH	7
+
+static const unsigned char assert_es256_pk[64] = {
+	REGRESS_ASSERT_ES256_PK,
+};
+
+static const unsigned char assert_cdh[32] = {
+	REGRESS_ASSERT_CDH,
+};
+
+static const unsigned char assert_authdata[39] = {
+	REGRESS_ASSERT_AUTHDATA,
+};
+
+static const unsigned char assert_sig[72] = {
+	REGRESS_ASSERT_SIG,
+};
+
+static const unsigned char cred_cdh[32] = {
+	REGRESS_CRED_CDH,
+};
+
+static const unsigned char cred_authdata[198] = {
+	REGRESS_CRED_AUTHDATA,
+};
+
+static const unsigned char cred_x509[742] = {
+	REGRESS_CRED_X509,
+};
+
+static const unsigned char cred_sig[70] = {
+	REGRESS_CRED_SIG,
+};
+
+struct bench {
+	const char	*name;
+	int		(*verify)(const struct bench *);
+	fido_assert_t	*assert;
+	fido_cred_t	*cred;
+	int		 cose_alg;
+	void		*pk;
+	es256_pk_prepared_t *prep;
+};
+
+struct worker {
+	pthread_t		 thread;
+	const struct bench	*b;
+	double			 seconds;
+	double			 elapsed;
+	unsigned long long	 ops;
+	unsigned long long	 allocs;
+	int			 failed;
+};
+
+static unsigned char rp_id_hash[SHA256_DIGEST_LENGTH];
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: bench_verify [-d seconds] [-j threads] "
+	    "[-n name]\n");
+	exit(1);
+}
+
+static int
+verify_assert(const struct bench *b)
+{
+	return (fido_assert_verify(b->assert, 0, b->cose_alg, b->pk));
+}
+
+static int
+verify_assert_prepared(const struct bench *b)
+{
+	return (fido_assert_verify_prepared(b->assert, 0, b->prep));
+}
+
+static int
+verify_cred(const struct bench *b)
+{
+	return (fido_cred_verify(b->cred));
+}
+
+static int
+verify_cred_self(const struct bench *b)
+{
+	return (fido_cred_verify_self(b->cred));
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		err(1, "clock_gettime");
+
+	return ((double)ts.tv_sec + (double)ts.tv_nsec / 1e9);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker	*w = arg;
+	double		 t0;
+	double		 t;
+
+#ifdef COUNT_ALLOCS
+	w->allocs = nalloc;
+#endif
+	t0 = now();
+	do {
+		for (int i = 0; i < 16; i++) {
+			if (w->b->verify(w->b) != FIDO_OK) {
+				w->failed = 1;
+				return (NULL);
+			}
+			w->ops++;
+		}
+	} while ((t = now()) - t0 < w->seconds);
+#ifdef COUNT_ALLOCS
+	w->allocs = nalloc - w->allocs;
+#endif
+	w->elapsed = t - t0;
+
+	return (NULL);
+}
+
+static void
+run(const struct bench *b, int nthreads, double seconds)
+{
+	struct worker		*w;
+	unsigned long long	 ops = 0;
+	unsigned long long	 allocs = 0;
+	double			 elapsed = 0;
+
+	if ((w = calloc((size_t)nthreads, sizeof(*w))) == NULL)
+		err(1, "calloc");
+
+	for (int i = 0; i < nthreads; i++) {
+		w[i].b = b;
+		w[i].seconds = seconds;
+		if ((errno = pthread_create(&w[i].thread, NULL, worker_main,
+		    &w[i])) != 0)
+			err(1, "pthread_create");
+	}
+
+	for (int i = 0; i < nthreads; i++) {
+		if ((errno = pthread_join(w[i].thread, NULL)) != 0)
+			err(1, "pthread_join");
+		if (w[i].failed)
+			errx(1, "%s: verification failed", b->name);
+		ops += w[i].ops;
+		allocs += w[i].allocs;
+		if (w[i].elapsed > elapsed)
+			elapsed = w[i].elapsed;
+	}
+
+	printf("{\"name\":\"%s\",\"threads\":%d,\"ops\":%llu,"
+	    "\"seconds\":%.3f,\"ops_per_sec\":%.1f,", b->name, nthreads, ops,
+	    elapsed, (double)ops / elapsed);
+#ifdef COUNT_ALLOCS
+	printf("\"allocs_per_op\":%.2f}\n", (double)allocs / (double)ops);
+#else
+	(void)allocs;
+	printf("\"allocs_per_op\":-1}\n");
+#endif
+	fflush(stdout);
+
+	free(w);
+}
+
+static EVP_PKEY *
+keygen(int type)
+{
+	EVP_PKEY_CTX	*ctx;
+	EVP_PKEY	*pkey = NULL;
+
+	if ((ctx = EVP_PKEY_CTX_new_id(type, NULL)) == NULL ||
+	    EVP_PKEY_keygen_init(ctx) != 1)
+		errx(1, "EVP_PKEY_keygen_init");
+	if (type == EVP_PKEY_RSA &&
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) != 1)
+		errx(1, "EVP_PKEY_CTX_set_rsa_keygen_bits");
+	if (type == EVP_PKEY_EC && EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx,
+	    NID_X9_62_prime256v1) != 1)
+		errx(1, "EVP_PKEY_CTX_set_ec_paramgen_curve_nid");
+	if (EVP_PKEY_keygen(ctx, &pkey) != 1)
+		errx(1, "EVP_PKEY_keygen");
+
+	EVP_PKEY_CTX_free(ctx);
+
+	return (pkey);
+}
+
+static size_t
+sign(EVP_PKEY *pkey, const EVP_MD *md, const unsigned char *ptr, size_t len,
+    unsigned char *sig, size_t siglen)
+{
+	EVP_MD_CTX *ctx;
+
+	if ((ctx = EVP_MD_CTX_new()) == NULL ||
+	    EVP_DigestSignInit(ctx, NULL, md, NULL, pkey) != 1 ||
+	    EVP_DigestSign(ctx, sig, &siglen, ptr, len) != 1)
+		errx(1, "EVP_DigestSign");
+
+	EVP_MD_CTX_free(ctx);
+
+	return (siglen);
+}
+
+/* sign authdata || cdh */
+static size_t
+sign_authdata(EVP_PKEY *pkey, const EVP_MD *md, const unsigned char *authdata,
+    size_t authdata_len, const unsigned char *cdh, size_t cdh_len,
+    unsigned char *sig, size_t siglen)
+{
+	unsigned char buf[256];
+
+	if (authdata_len > sizeof(buf) - cdh_len)
+		errx(1, "%s: authdata_len=%zu", __func__, authdata_len);
+
+	memcpy(buf, authdata, authdata_len);
+	memcpy(buf + authdata_len, cdh, cdh_len);
+
+	return (sign(pkey, md, buf, authdata_len + cdh_len, sig, siglen));
+}
+
+static void
+ec_point(EVP_PKEY *pkey, unsigned char point[65])
+{
+	const EC_KEY	*ec;
+	const EC_POINT	*q;
+
+	if ((ec = EVP_PKEY_get0_EC_KEY(pkey)) == NULL ||
+	    (q = EC_KEY_get0_public_key(ec)) == NULL ||
+	    EC_POINT_point2oct(EC_KEY_get0_group(ec), q,
+	    POINT_CONVERSION_UNCOMPRESSED, point, 65, NULL) != 65)
+		errx(1, "EC_POINT_point2oct");
+}
+
+static size_t
+x509_self_signed(EVP_PKEY *pkey, unsigned char **der)
+{
+	X509		*cert;
+	X509_NAME	*name;
+	int		 len;
+
+	*der = NULL;
+
+	if ((cert = X509_new()) == NULL || X509_set_version(cert, 2) != 1 ||
+	    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1) != 1 ||
+	    X509_gmtime_adj(X509_get_notBefore(cert), 0) == NULL ||
+	    X509_gmtime_adj(X509_get_notAfter(cert), 86400) == NULL ||
+	    (name = X509_get_subject_name(cert)) == NULL ||
+	    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	    (const unsigned char *)"bench_verify", -1, -1, 0) != 1 ||
+	    X509_set_issuer_name(cert, name) != 1 ||
+	    X509_set_pubkey(cert, pkey) != 1 ||
+	    X509_sign(cert, pkey, EVP_sha256()) == 0 ||
+	    (len = i2d_X509(cert, der)) <= 0)
+		errx(1, "%s: x509", __func__);
+
+	X509_free(cert);
+
+	return ((size_t)len);
+}
+
+/* rpIdHash | flags (up) | signCount */
+static size_t
+build_assert_authdata(unsigned char *ptr)
+{
+	memcpy(ptr, rp_id_hash, sizeof(rp_id_hash));
+	memcpy(ptr + 32, "\x01\x00\x00\x00\x2a", 5);
+
+	return (37);
+}
+
+/* rpIdHash | flags (up, at) | signCount | aaguid | id | es256 cose key */
+static size_t
+build_cred_authdata(unsigned char *ptr, const unsigned char *id, size_t id_len,
+    const unsigned char point[65])
+{
+	unsigned char *p = ptr;
+
+	memcpy(p, rp_id_hash, sizeof(rp_id_hash));
+	p += sizeof(rp_id_hash);
+	memcpy(p, "\x41\x00\x00\x00\x2a", 5);
+	p += 5;
+	memset(p, 0, 16);
+	p += 16;
+	*p++ = (unsigned char)(id_len >> 8);
+	*p++ = (unsigned char)id_len;
+	memcpy(p, id, id_len);
+	p += id_len;
+	memcpy(p, "\xa5\x01\x02\x03\x26\x20\x01\x21\x58\x20", 10);
+	p += 10;
+	memcpy(p, point + 1, 32);
+	p += 32;
+	memcpy(p, "\x22\x58\x20", 3);
+	p += 3;
+	memcpy(p, point + 33, 32);
+	p += 32;
+
+	return ((size_t)(p - ptr));
+}
+
+static fido_assert_t *
+new_assert(const unsigned char *authdata, size_t authdata_len, int raw,
+    const unsigned char *sig, size_t sig_len)
+{
+	fido_assert_t	*a;
+	int		 r;
+
+	if ((a = fido_assert_new()) == NULL)
+		errx(1, "fido_assert_new");
+
+	if (fido_assert_set_clientdata_hash(a, assert_cdh,
+	    sizeof(assert_cdh)) != FIDO_OK ||
+	    fido_assert_set_rp(a, RP_ID) != FIDO_OK ||
+	    fido_assert_set_count(a, 1) != FIDO_OK ||
+	    fido_assert_set_up(a, FIDO_OPT_FALSE) != FIDO_OK ||
+	    fido_assert_set_uv(a, FIDO_OPT_FALSE) != FIDO_OK ||
+	    fido_assert_set_sig(a, 0, sig, sig_len) != FIDO_OK)
+		errx(1, "%s: fido_assert_set", __func__);
+
+	if (raw)
+		r = fido_assert_set_authdata_raw(a, 0, authdata, authdata_len);
+	else
+		r = fido_assert_set_authdata(a, 0, authdata, authdata_len);
+	if (r != FIDO_OK)
+		errx(1, "%s: fido_assert_set_authdata: %s", __func__,
+		    fido_strerr(r));
+
+	return (a);
+}
+
+static fido_cred_t *
+new_cred(const char *fmt, const unsigned char *cdh, size_t cdh_len,
+    const unsigned char *authdata, size_t authdata_len, int raw,
+    const unsigned char *x5c, size_t x5c_len, const unsigned char *sig,
+    size_t sig_len)
+{
+	fido_cred_t	*c;
+	int		 r;
+
+	if ((c = fido_cred_new()) == NULL)
+		errx(1, "fido_cred_new");
+
+	if (fido_cred_set_type(c, COSE_ES256) != FIDO_OK ||
+	    fido_cred_set_clientdata_hash(c, cdh, cdh_len) != FIDO_OK ||
+	    fido_cred_set_rp(c, RP_ID, RP_NAME) != FIDO_OK ||
+	    fido_cred_set_rk(c, FIDO_OPT_FALSE) != FIDO_OK ||
+	    fido_cred_set_uv(c, FIDO_OPT_FALSE) != FIDO_OK ||
+	    fido_cred_set_sig(c, sig, sig_len) != FIDO_OK ||
+	    fido_cred_set_fmt(c, fmt) != FIDO_OK ||
+	    (x5c != NULL && fido_cred_set_x509(c, x5c, x5c_len) != FIDO_OK))
+		errx(1, "%s: fido_cred_set", __func__);
+
+	if (raw)
+		r = fido_cred_set_authdata_raw(c, authdata, authdata_len);
+	else
+		r = fido_cred_set_authdata(c, authdata, authdata_len);
+	if (r != FIDO_OK)
+		errx(1, "%s: fido_cred_set_authdata: %s", __func__,
+		    fido_strerr(r));
+
+	return (c);
+}
+
+static void
+setup_assert_es256(struct bench *b)
+{
+	es256_pk_t *pk;
+
+	if ((pk = es256_pk_new()) == NULL ||
+	    es256_pk_from_ptr(pk, assert_es256_pk,
+	    sizeof(assert_es256_pk)) != FIDO_OK)
+		errx(1, "es256_pk_from_ptr");
+
+	b->name = "assert_es256";
+	b->verify = verify_assert;
+	b->assert = new_assert(assert_authdata, sizeof(assert_authdata), 0,
+	    assert_sig, sizeof(assert_sig));
+	b->cose_alg = COSE_ES256;
+	b->pk = pk;
+}
+
+static void
+setup_assert_es256_prepared(struct bench *b)
+{
+	setup_assert_es256(b);
+
+	if ((b->prep = es256_pk_prepare(b->pk)) == NULL)
+		errx(1, "es256_pk_prepare");
+
+	b->name = "assert_es256_prepared";
+	b->verify = verify_assert_prepared;
+}
+
+static void
+setup_assert_rs256(struct bench *b)
+{
+	EVP_PKEY	*pkey;
+	rs256_pk_t	*pk;
+	unsigned char	 authdata[37];
+	unsigned char	 sig[256];
+	size_t		 authdata_len;
+	size_t		 sig_len;
+
+	pkey = keygen(EVP_PKEY_RSA);
+	authdata_len = build_assert_authdata(authdata);
+	sig_len = sign_authdata(pkey, EVP_sha256(), authdata, authdata_len,
+	    assert_cdh, sizeof(assert_cdh), sig, sizeof(sig));
+
+	if ((pk = rs256_pk_new()) == NULL ||
+	    rs256_pk_from_RSA(pk, EVP_PKEY_get0_RSA(pkey)) != FIDO_OK)
+		errx(1, "rs256_pk_from_RSA");
+
+	b->name = "assert_rs256";
+	b->verify = verify_assert;
+	b->assert = new_assert(authdata, authdata_len, 1, sig, sig_len);
+	b->cose_alg = COSE_RS256;
+	b->pk = pk;
+
+	EVP_PKEY_free(pkey);
+}
+
+#ifdef HAVE_ED25519
+static void
+setup_assert_eddsa(struct bench *b)
+{
+	EVP_PKEY	*pkey;
+	eddsa_pk_t	*pk;
+	unsigned char	 authdata[37];
+	unsigned char	 sig[64];
+	size_t		 authdata_len;
+	size_t		 sig_len;
+
+	pkey = keygen(EVP_PKEY_ED25519);
+	authdata_len = build_assert_authdata(authdata);
+	sig_len = sign_authdata(pkey, NULL, authdata, authdata_len,
+	    assert_cdh, sizeof(assert_cdh), sig, sizeof(sig));
+
+	if ((pk = eddsa_pk_new()) == NULL ||
+	    eddsa_pk_from_EVP_PKEY(pk, pkey) != FIDO_OK)
+		errx(1, "eddsa_pk_from_EVP_PKEY");
+
+	b->name = "assert_eddsa";
+	b->verify = verify_assert;
+	b->assert = new_assert(authdata, authdata_len, 1, sig, sig_len);
+	b->cose_alg = COSE_EDDSA;
+	b->pk = pk;
+
+	EVP_PKEY_free(pkey);
+}
+#endif /* HAVE_ED25519 */
+
+static void
+setup_cred_packed(struct bench *b)
+{
+	b->name = "cred_packed";
+	b->verify = verify_cred;
+	b->cred = new_cred("packed", cred_cdh, sizeof(cred_cdh),
+	    cred_authdata, sizeof(cred_authdata), 0, cred_x509,
+	    sizeof(cred_x509), cred_sig, sizeof(cred_sig));
+}
+
+static void
+setup_cred_u2f(struct bench *b)
+{
+	EVP_PKEY	*attkey;
+	EVP_PKEY	*credkey;
+	unsigned char	*x5c;
+	unsigned char	 id[16];
+	unsigned char	 point[65];
+	unsigned char	 authdata[160];
+	unsigned char	 msg[1 + 32 + 32 + sizeof(id) + 65];
+	unsigned char	 sig[80];
+	size_t		 x5c_len;
+	size_t		 authdata_len;
+	size_t		 sig_len;
+
+	attkey = keygen(EVP_PKEY_EC);
+	credkey = keygen(EVP_PKEY_EC);
+	x5c_len = x509_self_signed(attkey, &x5c);
+	ec_point(credkey, point);
+	memset(id, 0x2a, sizeof(id));
+	authdata_len = build_cred_authdata(authdata, id, sizeof(id), point);
+
+	/* 0x00 | rpIdHash | cdh | id | point */
+	msg[0] = 0x00;
+	memcpy(msg + 1, rp_id_hash, 32);
+	memcpy(msg + 33, cred_cdh, 32);
+	memcpy(msg + 65, id, sizeof(id));
+	memcpy(msg + 65 + sizeof(id), point, sizeof(point));
+	sig_len = sign(attkey, EVP_sha256(), msg, sizeof(msg), sig,
+	    sizeof(sig));
+
+	b->name = "cred_u2f";
+	b->verify = verify_cred;
+	b->cred = new_cred("fido-u2f", cred_cdh, sizeof(cred_cdh), authdata,
+	    authdata_len, 1, x5c, x5c_len, sig, sig_len);
+
+	OPENSSL_free(x5c);
+	EVP_PKEY_free(attkey);
+	EVP_PKEY_free(credkey);
+}
+
+static void
+setup_cred_self(struct bench *b)
+{
+	EVP_PKEY	*credkey;
+	unsigned char	 id[16];
+	unsigned char	 point[65];
+	unsigned char	 authdata[160];
+	unsigned char	 sig[80];
+	size_t		 authdata_len;
+	size_t		 sig_len;
+
+	credkey = keygen(EVP_PKEY_EC);
+	ec_point(credkey, point);
+	memset(id, 0x2a, sizeof(id));
+	authdata_len = build_cred_authdata(authdata, id, sizeof(id), point);
+	sig_len = sign_authdata(credkey, EVP_sha256(), authdata, authdata_len,
+	    cred_cdh, sizeof(cred_cdh), sig, sizeof(sig));
+
+	b->name = "cred_self";
+	b->verify = verify_cred_self;
+	b->cred = new_cred("packed", cred_cdh, sizeof(cred_cdh), authdata,
+	    authdata_len, 1, NULL, 0, sig, sig_len);
+
+	EVP_PKEY_free(credkey);
+}
+
+static void
+free_bench(struct bench *b)
+{
+	switch (b->cose_alg) {
+	case COSE_ES256:
+		es256_pk_free((es256_pk_t **)&b->pk);
+		break;
+	case COSE_RS256:
+		rs256_pk_free((rs256_pk_t **)&b->pk);
+		break;
+	case COSE_EDDSA:
+		eddsa_pk_free((eddsa_pk_t **)&b->pk);
+		break;
+	}
+
+	es256_pk_prepared_free(&b->prep);
+	fido_assert_free(&b->assert);
+	fido_cred_free(&b->cred);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench	 b[MAXBENCH];
+	const char	*name = NULL;
+	double		 seconds = 1;
+	long		 nthreads;
+	size_t		 n = 0;
+	char		*ep;
+	int		 ch;
+
+	if ((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+
+	while ((ch = getopt(argc, argv, "d:j:n:")) != -1) {
+		switch (ch) {
+		case 'd':
+			seconds = strtod(optarg, &ep);
+			if (*ep != '\0' || seconds <= 0)
+				errx(1, "invalid duration: %s", optarg);
+			break;
+		case 'j':
+			nthreads = strtol(optarg, &ep, 10);
+			if (*ep != '\0' || nthreads < 1 || nthreads > 1024)
+				errx(1, "invalid thread count: %s", optarg);
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (argc != optind)
+		usage();
+
+	fido_init(0);
+
+	if (SHA256((const unsigned char *)RP_ID, strlen(RP_ID),
+	    rp_id_hash) != rp_id_hash)
+		errx(1, "SHA256");
+
+	memset(b, 0, sizeof(b));
+	setup_assert_es256(&b[n++]);
+	setup_assert_es256_prepared(&b[n++]);
+	setup_assert_rs256(&b[n++]);
+#ifdef HAVE_ED25519
+	setup_assert_eddsa(&b[n++]);
+#endif
+	setup_cred_packed(&b[n++]);
+	setup_cred_u2f(&b[n++]);
+	setup_cred_self(&b[n++]);
+
+	for (size_t i = 0; i < n; i++) {
+		if (name != NULL && strcmp(name, b[i].name) != 0)
+			continue;
+		run(&b[i], 1, seconds);
+		if (nthreads > 1)
+			run(&b[i], (int)nthreads, seconds);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		free_bench(&b[i]);
+
+	exit(0);
+}
@@ -167,6 +167,14 @@ WRAP(EVP_MD_CTX *,
 	1
 )
 
+WRAP(int,
+	EVP_PKEY_verify_init,
+	(EVP_PKEY_CTX *ctx),
+	0,
+	(ctx),
+	1
+)
+
 WRAP(int,
 	EVP_DigestVerifyInit,
 	(EVP_MD_CTX *ctx, EVP_PKEY_CTX **pctx, const EVP_MD *type, ENGINE *e,
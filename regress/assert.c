@@ -9,46 +9,28 @@
 #include <fido/es256.h>
 #include <fido/rs256.h>
 #include <fido/eddsa.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "vectors.h"
+
 #define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
 
 static const unsigned char es256_pk[64] = {
-	0x34, 0xeb, 0x99, 0x77, 0x02, 0x9c, 0x36, 0x38,
-	0xbb, 0xc2, 0xae, 0xa0, 0xa0, 0x18, 0xc6, 0x64,
-	0xfc, 0xe8, 0x49, 0x92, 0xd7, 0x74, 0x9e, 0x0c,
-	0x46, 0x8c, 0x9d, 0xa6, 0xdf, 0x46, 0xf7, 0x84,
-	0x60, 0x1e, 0x0f, 0x8b, 0x23, 0x85, 0x4a, 0x9a,
-	0xec, 0xc1, 0x08, 0x9f, 0x30, 0xd0, 0x0d, 0xd7,
-	0x76, 0x7b, 0x55, 0x48, 0x91, 0x7c, 0x4f, 0x0f,
-	0x64, 0x1a, 0x1d, 0xf8, 0xbe, 0x14, 0x90, 0x8a,
+	REGRESS_ASSERT_ES256_PK,
 };
 
 static const unsigned char cdh[32] = {
-	0xec, 0x8d, 0x8f, 0x78, 0x42, 0x4a, 0x2b, 0xb7,
-	0x82, 0x34, 0xaa, 0xca, 0x07, 0xa1, 0xf6, 0x56,
-	0x42, 0x1c, 0xb6, 0xf6, 0xb3, 0x00, 0x86, 0x52,
-	0x35, 0x2d, 0xa2, 0x62, 0x4a, 0xbe, 0x89, 0x76,
+	REGRESS_ASSERT_CDH,
 };
 
 static const unsigned char authdata[39] = {
-	0x58, 0x25, 0x49, 0x96, 0x0d, 0xe5, 0x88, 0x0e,
-	0x8c, 0x68, 0x74, 0x34, 0x17, 0x0f, 0x64, 0x76,
-	0x60, 0x5b, 0x8f, 0xe4, 0xae, 0xb9, 0xa2, 0x86,
-	0x32, 0xc7, 0x99, 0x5c, 0xf3, 0xba, 0x83, 0x1d,
-	0x97, 0x63, 0x00, 0x00, 0x00, 0x00, 0x03,
+	REGRESS_ASSERT_AUTHDATA,
 };
 
 static const unsigned char sig[72] = {
-	0x30, 0x46, 0x02, 0x21, 0x00, 0xf6, 0xd1, 0xa3,
-	0xd5, 0x24, 0x2b, 0xde, 0xee, 0xa0, 0x90, 0x89,
-	0xcd, 0xf8, 0x9e, 0xbd, 0x6b, 0x4d, 0x55, 0x79,
-	0xe4, 0xc1, 0x42, 0x27, 0xb7, 0x9b, 0x9b, 0xa4,
-	0x0a, 0xe2, 0x47, 0x64, 0x0e, 0x02, 0x21, 0x00,
-	0xe5, 0xc9, 0xc2, 0x83, 0x47, 0x31, 0xc7, 0x26,
-	0xe5, 0x25, 0xb2, 0xb4, 0x39, 0xa7, 0xfc, 0x3d,
-	0x70, 0xbe, 0xe9, 0x81, 0x0d, 0x4a, 0x62, 0xa9,
-	0xab, 0x4a, 0x91, 0xc0, 0x7d, 0x2d, 0x23, 0x1e,
+	REGRESS_ASSERT_SIG,
 };
 
 static void *
@@ -88,6 +70,170 @@ dummy_write(void *handle, const unsigned char *buf, size_t len)
 	/* NOTREACHED */
 }
 
+/*
+ * A CBOR-level authenticator holding fake.total resident credentials
+ * for "localhost", driven through the transport functions. Each
+ * statement carries the authdata and signature above, and a one-byte
+ * user id holding its position.
+ */
+static struct {
+	unsigned char	nonce[8];
+	unsigned char	reply[256];
+	size_t		reply_len;
+	uint8_t		total;
+	uint8_t		next;
+	size_t		nassert;
+	size_t		nnext;
+} fake;
+
+/* versions: FIDO_2_0 */
+static const unsigned char fake_info[] = {
+	0x00, 0xa1, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30,
+};
+
+static unsigned char *
+fake_put(unsigned char *p, const unsigned char *ptr, size_t len)
+{
+	assert((size_t)(p - fake.reply) + len <= sizeof(fake.reply));
+	memcpy(p, ptr, len);
+
+	return (p + len);
+}
+
+static void
+fake_stmt(void)
+{
+	/* {"id": h'xx', "type": "public-key"} */
+	unsigned char	 cred[] = {
+		0xa2, 0x62, 0x69, 0x64, 0x41, 0x00, 0x64, 0x74,
+		0x79, 0x70, 0x65, 0x6a, 0x70, 0x75, 0x62, 0x6c,
+		0x69, 0x63, 0x2d, 0x6b, 0x65, 0x79,
+	};
+	/* {"id": h'xx'} */
+	unsigned char	 user[] = { 0xa1, 0x62, 0x69, 0x64, 0x41, 0x00 };
+	unsigned char	 hdr[3];
+	unsigned char	*p = fake.reply;
+	bool		 first = fake.next == 0;
+
+	cred[5] = user[5] = fake.next++;
+
+	hdr[0] = 0x00;
+	hdr[1] = first ? 0xa5 : 0xa4;
+	hdr[2] = 0x01;
+	p = fake_put(p, hdr, 3);
+	p = fake_put(p, cred, sizeof(cred));
+	hdr[0] = 0x02;
+	p = fake_put(p, hdr, 1);
+	p = fake_put(p, authdata, sizeof(authdata));
+	hdr[0] = 0x03;
+	hdr[1] = 0x58;
+	hdr[2] = sizeof(sig);
+	p = fake_put(p, hdr, 3);
+	p = fake_put(p, sig, sizeof(sig));
+	hdr[0] = 0x04;
+	p = fake_put(p, hdr, 1);
+	p = fake_put(p, user, sizeof(user));
+	if (first && fake.total < 24) {
+		hdr[0] = 0x05;
+		hdr[1] = fake.total;
+		p = fake_put(p, hdr, 2);
+	} else if (first) {
+		hdr[0] = 0x05;
+		hdr[1] = 0x18;
+		hdr[2] = fake.total;
+		p = fake_put(p, hdr, 3);
+	}
+
+	fake.reply_len = (size_t)(p - fake.reply);
+}
+
+static int
+fake_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	(void)d;
+
+	if (cmd == CTAP_CMD_INIT) {
+		assert(len == sizeof(fake.nonce));
+		memcpy(fake.nonce, buf, len);
+		memset(fake.reply, 0, 17);
+		memcpy(fake.reply, fake.nonce, sizeof(fake.nonce));
+		fake.reply[16] = FIDO_CAP_CBOR;
+		fake.reply_len = 17;
+		return ((int)len);
+	}
+
+	assert(cmd == CTAP_CMD_CBOR && len > 0);
+
+	switch (buf[0]) {
+	case CTAP_CBOR_GETINFO:
+		memcpy(fake.reply, fake_info, sizeof(fake_info));
+		fake.reply_len = sizeof(fake_info);
+		break;
+	case CTAP_CBOR_ASSERT:
+		fake.nassert++;
+		fake.next = 0;
+		fake_stmt();
+		break;
+	case CTAP_CBOR_NEXT_ASSERT:
+		fake.nnext++;
+		assert(fake.next < fake.total);
+		fake_stmt();
+		break;
+	default:
+		abort();
+	}
+
+	return ((int)len);
+}
+
+static int
+fake_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)ms;
+
+	assert(fake.reply_len <= len);
+	memcpy(buf, fake.reply, fake.reply_len);
+
+	return ((int)fake.reply_len);
+}
+
+static fido_dev_t *
+open_fake_dev(uint8_t total)
+{
+	fido_dev_io_t		io_f;
+	fido_dev_transport_t	t;
+	fido_dev_t		*d;
+
+	memset(&fake, 0, sizeof(fake));
+	fake.total = total;
+
+	memset(&io_f, 0, sizeof(io_f));
+	io_f.open = dummy_open;
+	io_f.close = dummy_close;
+	io_f.read = dummy_read;
+	io_f.write = dummy_write;
+	t.rx = fake_rx;
+	t.tx = fake_tx;
+
+	assert((d = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(d, &io_f) == FIDO_OK);
+	assert(fido_dev_set_transport_functions(d, &t) == FIDO_OK);
+	assert(fido_dev_open(d, "fake") == FIDO_OK);
+
+	return (d);
+}
+
+static void
+close_fake_dev(fido_dev_t *d)
+{
+	assert(fido_dev_close(d) == FIDO_OK);
+	fido_dev_free(&d);
+	assert(d == NULL);
+}
+
 static fido_assert_t *
 alloc_assert(void)
 {
@@ -277,6 +423,7 @@ valid_assert(void)
 	es256_pk_t *es256;
 	rs256_pk_t *rs256;
 	eddsa_pk_t *eddsa;
+	es256_pk_prepared_t *prep;
 
 	a = alloc_assert();
 	es256 = alloc_es256_pk();
@@ -294,12 +441,87 @@ valid_assert(void)
 	assert(fido_assert_verify(a, 0, COSE_ES256, es256) == FIDO_OK);
 	assert(fido_assert_verify(a, 0, COSE_RS256, rs256) == FIDO_ERR_INVALID_SIG);
 	assert(fido_assert_verify(a, 0, COSE_EDDSA, eddsa) == FIDO_ERR_INVALID_SIG);
-	free_assert(a);
+	assert((prep = es256_pk_prepare(es256)) != NULL);
+	assert(fido_assert_verify_prepared(a, 0, prep) == FIDO_OK);
+	assert(fido_assert_verify_prepared(a, 0, prep) == FIDO_OK);
+	assert(fido_assert_verify_prepared(a, 1,
+	    prep) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_prepared(a, 0,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	/* the prepared key is independent of the key it was made from */
+	assert(es256_pk_from_ptr(es256, sig, 64) == FIDO_OK);
+	assert(es256_pk_prepare(es256) == NULL);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    es256) == FIDO_ERR_INVALID_SIG);
+	assert(fido_assert_verify_prepared(a, 0, prep) == FIDO_OK);
 	free_es256_pk(es256);
+	assert(fido_assert_verify_prepared(a, 0, prep) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig) - 1) == FIDO_OK);
+	assert(fido_assert_verify_prepared(a, 0,
+	    prep) == FIDO_ERR_INVALID_SIG);
+	es256_pk_prepared_free(&prep);
+	assert(prep == NULL);
+	es256_pk_prepared_free(&prep);
+	es256_pk_prepared_free(NULL);
+	free_assert(a);
 	free_rs256_pk(rs256);
 	free_eddsa_pk(eddsa);
 }
 
+static void
+verify_batch(void)
+{
+	const fido_assert_t *av[3];
+	const void *pkv[3];
+	size_t idx[3];
+	int status[3];
+	fido_assert_t *a;
+	es256_pk_t *es256;
+	eddsa_pk_t *eddsa;
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	eddsa = alloc_eddsa_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	av[0] = av[1] = av[2] = a;
+	pkv[0] = pkv[1] = pkv[2] = es256;
+	idx[0] = idx[1] = idx[2] = 0;
+	assert(fido_assert_verify_batch(NULL, idx, 3, COSE_ES256, pkv,
+	    status) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_batch(av, idx, 0, COSE_ES256, pkv,
+	    status) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_batch(av, idx, 3, COSE_ES256, pkv,
+	    status) == FIDO_OK);
+	assert(status[0] == FIDO_OK);
+	assert(status[1] == FIDO_OK);
+	assert(status[2] == FIDO_OK);
+	pkv[1] = NULL;
+	idx[2] = 1;
+	assert(fido_assert_verify_batch(av, idx, 3, COSE_ES256, pkv,
+	    status) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(status[0] == FIDO_OK);
+	assert(status[1] == FIDO_ERR_INVALID_ARGUMENT);
+	assert(status[2] == FIDO_ERR_INVALID_ARGUMENT);
+	pkv[0] = pkv[1] = pkv[2] = eddsa;
+	idx[2] = 0;
+	assert(fido_assert_verify_batch(av, idx, 3, COSE_EDDSA, pkv,
+	    status) == FIDO_ERR_INVALID_SIG);
+	assert(status[0] == FIDO_ERR_INVALID_SIG);
+	assert(status[1] == FIDO_ERR_INVALID_SIG);
+	assert(status[2] == FIDO_ERR_INVALID_SIG);
+	free_assert(a);
+	free_es256_pk(es256);
+	free_eddsa_pk(eddsa);
+}
+
 static void
 no_cdh(void)
 {
@@ -344,6 +566,158 @@ no_rp(void)
 	free_es256_pk(pk);
 }
 
+static void
+rp_id_hash(void)
+{
+	fido_assert_t *a;
+	es256_pk_t *pk;
+	unsigned char junk[32];
+
+	memset(junk, 0, sizeof(junk));
+	a = alloc_assert();
+	pk = alloc_es256_pk();
+	assert(es256_pk_from_ptr(pk, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_set_rp_id_hash(a, NULL,
+	    sizeof(junk)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp_id_hash(a, junk,
+	    sizeof(junk) - 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    pk) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp_id_hash(a, junk, sizeof(junk)) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    pk) == FIDO_ERR_INVALID_PARAM);
+	/* the authdata starts with sha256("localhost") */
+	assert(fido_assert_set_rp_id_hash(a, authdata + 2, 32) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, pk) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "example.com") == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    pk) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, pk) == FIDO_OK);
+	/* a hash that does not match the relying party id is rejected */
+	assert(fido_assert_set_rp_id_hash(a, junk,
+	    sizeof(junk)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp_id_hash(a, NULL,
+	    sizeof(junk)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(strcmp(fido_assert_rp_id(a), "localhost") == 0);
+	assert(fido_assert_verify(a, 0, COSE_ES256, pk) == FIDO_OK);
+	assert(fido_assert_set_rp_id_hash(a, authdata + 2, 32) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, pk) == FIDO_OK);
+	/* the relying party id replaces an earlier hash */
+	assert(fido_assert_set_rp(a, "example.com") == FIDO_OK);
+	assert(fido_assert_set_rp_id_hash(a, authdata + 2,
+	    32) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    pk) == FIDO_ERR_INVALID_PARAM);
+	free_assert(a);
+	free_es256_pk(pk);
+}
+
+static fido_assert_t *
+fake_assert(void)
+{
+	fido_assert_t *a;
+
+	a = alloc_assert();
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+
+	return (a);
+}
+
+static void
+check_stmt(const fido_assert_t *a, size_t idx, const es256_pk_t *pk)
+{
+	assert(fido_assert_user_id_len(a, idx) == 1);
+	assert(fido_assert_user_id_ptr(a, idx)[0] == idx);
+	assert(fido_assert_id_len(a, idx) == 1);
+	assert(fido_assert_id_ptr(a, idx)[0] == idx);
+	assert(fido_assert_verify(a, idx, COSE_ES256, pk) == FIDO_OK);
+}
+
+static void
+get_assert(void)
+{
+	fido_dev_t *d;
+	fido_assert_t *a;
+	es256_pk_t *pk;
+
+	pk = alloc_es256_pk();
+	assert(es256_pk_from_ptr(pk, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+
+	/* all statements are fetched up front */
+	d = open_fake_dev(40);
+	a = fake_assert();
+	assert(fido_dev_get_assert(d, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 40);
+	assert(fido_assert_pending(a) == 0);
+	assert(fake.nassert == 1 && fake.nnext == 39);
+	for (size_t i = 0; i < 40; i++)
+		check_stmt(a, i, pk);
+	assert(fido_dev_get_assert_next(d, a) == FIDO_ERR_NOT_ALLOWED);
+	free_assert(a);
+	close_fake_dev(d);
+
+	/* one statement per call */
+	d = open_fake_dev(40);
+	a = fake_assert();
+	assert(fido_dev_get_assert_next(d, a) == FIDO_ERR_NOT_ALLOWED);
+	assert(fido_dev_get_assert_begin(d, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_pending(a) == 39);
+	assert(fake.nassert == 1 && fake.nnext == 0);
+	check_stmt(a, 0, pk);
+	for (size_t i = 1; i < 40; i++) {
+		assert(fido_dev_get_assert_next(d, a) == FIDO_OK);
+		assert(fido_assert_count(a) == i + 1);
+		assert(fido_assert_pending(a) == 39 - i);
+		assert(fake.nnext == i);
+		check_stmt(a, i, pk);
+	}
+	for (size_t i = 0; i < 40; i++)
+		check_stmt(a, i, pk);
+	assert(fido_dev_get_assert_next(d, a) == FIDO_ERR_NOT_ALLOWED);
+	assert(fake.nnext == 39);
+	free_assert(a);
+	close_fake_dev(d);
+
+	/* a lone credential leaves nothing pending */
+	d = open_fake_dev(1);
+	a = fake_assert();
+	assert(fido_dev_get_assert_begin(d, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_pending(a) == 0);
+	check_stmt(a, 0, pk);
+	assert(fido_dev_get_assert_next(d, a) == FIDO_ERR_NOT_ALLOWED);
+	assert(fake.nnext == 0);
+	free_assert(a);
+	close_fake_dev(d);
+
+	/* resizing the statement array drops the pending statements */
+	d = open_fake_dev(40);
+	a = fake_assert();
+	assert(fido_dev_get_assert_begin(d, a, NULL) == FIDO_OK);
+	assert(fido_assert_pending(a) == 39);
+	assert(fido_assert_set_count(a, 2) == FIDO_OK);
+	assert(fido_assert_count(a) == 2);
+	assert(fido_assert_pending(a) == 0);
+	assert(fido_dev_get_assert_next(d, a) == FIDO_ERR_NOT_ALLOWED);
+	assert(fake.nnext == 0);
+	free_assert(a);
+	close_fake_dev(d);
+
+	free_es256_pk(pk);
+}
+
 static void
 no_authdata(void)
 {
@@ -538,8 +912,11 @@ main(void)
 
 	empty_assert_tests();
 	valid_assert();
+	verify_batch();
+	get_assert();
 	no_cdh();
 	no_rp();
+	rp_id_hash();
 	no_authdata();
 	no_sig();
 	junk_cdh();
@@ -7,43 +7,22 @@
 #include <assert.h>
 #include <cbor.h>
 #include <fido.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "vectors.h"
+
 #define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
 
 static const unsigned char cdh[32] = {
-	0xf9, 0x64, 0x57, 0xe7, 0x2d, 0x97, 0xf6, 0xbb,
-	0xdd, 0xd7, 0xfb, 0x06, 0x37, 0x62, 0xea, 0x26,
-	0x20, 0x44, 0x8e, 0x69, 0x7c, 0x03, 0xf2, 0x31,
-	0x2f, 0x99, 0xdc, 0xaf, 0x3e, 0x8a, 0x91, 0x6b,
+	REGRESS_CRED_CDH,
 };
 
 static const unsigned char authdata[198] = {
-	0x58, 0xc4, 0x49, 0x96, 0x0d, 0xe5, 0x88, 0x0e,
-	0x8c, 0x68, 0x74, 0x34, 0x17, 0x0f, 0x64, 0x76,
-	0x60, 0x5b, 0x8f, 0xe4, 0xae, 0xb9, 0xa2, 0x86,
-	0x32, 0xc7, 0x99, 0x5c, 0xf3, 0xba, 0x83, 0x1d,
-	0x97, 0x63, 0x41, 0x00, 0x00, 0x00, 0x00, 0xf8,
-	0xa0, 0x11, 0xf3, 0x8c, 0x0a, 0x4d, 0x15, 0x80,
-	0x06, 0x17, 0x11, 0x1f, 0x9e, 0xdc, 0x7d, 0x00,
-	0x40, 0x53, 0xfb, 0xdf, 0xaa, 0xce, 0x63, 0xde,
-	0xc5, 0xfe, 0x47, 0xe6, 0x52, 0xeb, 0xf3, 0x5d,
-	0x53, 0xa8, 0xbf, 0x9d, 0xd6, 0x09, 0x6b, 0x5e,
-	0x7f, 0xe0, 0x0d, 0x51, 0x30, 0x85, 0x6a, 0xda,
-	0x68, 0x70, 0x85, 0xb0, 0xdb, 0x08, 0x0b, 0x83,
-	0x2c, 0xef, 0x44, 0xe2, 0x36, 0x88, 0xee, 0x76,
-	0x90, 0x6e, 0x7b, 0x50, 0x3e, 0x9a, 0xa0, 0xd6,
-	0x3c, 0x34, 0xe3, 0x83, 0xe7, 0xd1, 0xbd, 0x9f,
-	0x25, 0xa5, 0x01, 0x02, 0x03, 0x26, 0x20, 0x01,
-	0x21, 0x58, 0x20, 0x17, 0x5b, 0x27, 0xa6, 0x56,
-	0xb2, 0x26, 0x0c, 0x26, 0x0c, 0x55, 0x42, 0x78,
-	0x17, 0x5d, 0x4c, 0xf8, 0xa2, 0xfd, 0x1b, 0xb9,
-	0x54, 0xdf, 0xd5, 0xeb, 0xbf, 0x22, 0x64, 0xf5,
-	0x21, 0x9a, 0xc6, 0x22, 0x58, 0x20, 0x87, 0x5f,
-	0x90, 0xe6, 0xfd, 0x71, 0x27, 0x9f, 0xeb, 0xe3,
-	0x03, 0x44, 0xbc, 0x8d, 0x49, 0xc6, 0x1c, 0x31,
-	0x3b, 0x72, 0xae, 0xd4, 0x53, 0xb1, 0xfe, 0x5d,
-	0xe1, 0x30, 0xfc, 0x2b, 0x1e, 0xd2,
+	REGRESS_CRED_AUTHDATA,
 };
 
 static const unsigned char authdata_dupkeys[200] = {
@@ -103,111 +82,11 @@ static const unsigned char authdata_unsorted_keys[198] = {
 };
 
 static const unsigned char x509[742] = {
-	0x30, 0x82, 0x02, 0xe2, 0x30, 0x81, 0xcb, 0x02,
-	0x01, 0x01, 0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86,
-	0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b, 0x05,
-	0x00, 0x30, 0x1d, 0x31, 0x1b, 0x30, 0x19, 0x06,
-	0x03, 0x55, 0x04, 0x03, 0x13, 0x12, 0x59, 0x75,
-	0x62, 0x69, 0x63, 0x6f, 0x20, 0x55, 0x32, 0x46,
-	0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x43, 0x41,
-	0x30, 0x1e, 0x17, 0x0d, 0x31, 0x34, 0x30, 0x35,
-	0x31, 0x35, 0x31, 0x32, 0x35, 0x38, 0x35, 0x34,
-	0x5a, 0x17, 0x0d, 0x31, 0x34, 0x30, 0x36, 0x31,
-	0x34, 0x31, 0x32, 0x35, 0x38, 0x35, 0x34, 0x5a,
-	0x30, 0x1d, 0x31, 0x1b, 0x30, 0x19, 0x06, 0x03,
-	0x55, 0x04, 0x03, 0x13, 0x12, 0x59, 0x75, 0x62,
-	0x69, 0x63, 0x6f, 0x20, 0x55, 0x32, 0x46, 0x20,
-	0x54, 0x65, 0x73, 0x74, 0x20, 0x45, 0x45, 0x30,
-	0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48,
-	0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a, 0x86,
-	0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42,
-	0x00, 0x04, 0xdb, 0x0a, 0xdb, 0xf5, 0x21, 0xc7,
-	0x5c, 0xce, 0x63, 0xdc, 0xa6, 0xe1, 0xe8, 0x25,
-	0x06, 0x0d, 0x94, 0xe6, 0x27, 0x54, 0x19, 0x4f,
-	0x9d, 0x24, 0xaf, 0x26, 0x1a, 0xbe, 0xad, 0x99,
-	0x44, 0x1f, 0x95, 0xa3, 0x71, 0x91, 0x0a, 0x3a,
-	0x20, 0xe7, 0x3e, 0x91, 0x5e, 0x13, 0xe8, 0xbe,
-	0x38, 0x05, 0x7a, 0xd5, 0x7a, 0xa3, 0x7e, 0x76,
-	0x90, 0x8f, 0xaf, 0xe2, 0x8a, 0x94, 0xb6, 0x30,
-	0xeb, 0x9d, 0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86,
-	0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b, 0x05,
-	0x00, 0x03, 0x82, 0x02, 0x01, 0x00, 0x95, 0x40,
-	0x6b, 0x50, 0x61, 0x7d, 0xad, 0x84, 0xa3, 0xb4,
-	0xeb, 0x88, 0x0f, 0xe3, 0x30, 0x0f, 0x2d, 0xa2,
-	0x0a, 0x00, 0xd9, 0x25, 0x04, 0xee, 0x72, 0xfa,
-	0x67, 0xdf, 0x58, 0x51, 0x0f, 0x0b, 0x47, 0x02,
-	0x9c, 0x3e, 0x41, 0x29, 0x4a, 0x93, 0xac, 0x29,
-	0x85, 0x89, 0x2d, 0xa4, 0x7a, 0x81, 0x32, 0x28,
-	0x57, 0x71, 0x01, 0xef, 0xa8, 0x42, 0x88, 0x16,
-	0x96, 0x37, 0x91, 0xd5, 0xdf, 0xe0, 0x8f, 0xc9,
-	0x3c, 0x8d, 0xb0, 0xcd, 0x89, 0x70, 0x82, 0xec,
-	0x79, 0xd3, 0xc6, 0x78, 0x73, 0x29, 0x32, 0xe5,
-	0xab, 0x6c, 0xbd, 0x56, 0x9f, 0xd5, 0x45, 0x91,
-	0xce, 0xc1, 0xdd, 0x8d, 0x64, 0xdc, 0xe9, 0x9c,
-	0x1f, 0x5e, 0x3c, 0xd2, 0xaf, 0x51, 0xa5, 0x82,
-	0x18, 0xaf, 0xe0, 0x37, 0xe7, 0x32, 0x9e, 0x76,
-	0x05, 0x77, 0x02, 0x7b, 0xe6, 0x24, 0xa0, 0x31,
-	0x56, 0x1b, 0xfd, 0x19, 0xc5, 0x71, 0xd3, 0xf0,
-	0x9e, 0xc0, 0x73, 0x05, 0x4e, 0xbc, 0x85, 0xb8,
-	0x53, 0x9e, 0xef, 0xc5, 0xbc, 0x9c, 0x56, 0xa3,
-	0xba, 0xd9, 0x27, 0x6a, 0xbb, 0xa9, 0x7a, 0x40,
-	0xd7, 0x47, 0x8b, 0x55, 0x72, 0x6b, 0xe3, 0xfe,
-	0x28, 0x49, 0x71, 0x24, 0xf4, 0x8f, 0xf4, 0x20,
-	0x81, 0xea, 0x38, 0xff, 0x7c, 0x0a, 0x4f, 0xdf,
-	0x02, 0x82, 0x39, 0x81, 0x82, 0x3b, 0xca, 0x09,
-	0xdd, 0xca, 0xaa, 0x0f, 0x27, 0xf5, 0xa4, 0x83,
-	0x55, 0x6c, 0x9a, 0x39, 0x9b, 0x15, 0x3a, 0x16,
-	0x63, 0xdc, 0x5b, 0xf9, 0xac, 0x5b, 0xbc, 0xf7,
-	0x9f, 0xbe, 0x0f, 0x8a, 0xa2, 0x3c, 0x31, 0x13,
-	0xa3, 0x32, 0x48, 0xca, 0x58, 0x87, 0xf8, 0x7b,
-	0xa0, 0xa1, 0x0a, 0x6a, 0x60, 0x96, 0x93, 0x5f,
-	0x5d, 0x26, 0x9e, 0x63, 0x1d, 0x09, 0xae, 0x9a,
-	0x41, 0xe5, 0xbd, 0x08, 0x47, 0xfe, 0xe5, 0x09,
-	0x9b, 0x20, 0xfd, 0x12, 0xe2, 0xe6, 0x40, 0x7f,
-	0xba, 0x4a, 0x61, 0x33, 0x66, 0x0d, 0x0e, 0x73,
-	0xdb, 0xb0, 0xd5, 0xa2, 0x9a, 0x9a, 0x17, 0x0d,
-	0x34, 0x30, 0x85, 0x6a, 0x42, 0x46, 0x9e, 0xff,
-	0x34, 0x8f, 0x5f, 0x87, 0x6c, 0x35, 0xe7, 0xa8,
-	0x4d, 0x35, 0xeb, 0xc1, 0x41, 0xaa, 0x8a, 0xd2,
-	0xda, 0x19, 0xaa, 0x79, 0xa2, 0x5f, 0x35, 0x2c,
-	0xa0, 0xfd, 0x25, 0xd3, 0xf7, 0x9d, 0x25, 0x18,
-	0x2d, 0xfa, 0xb4, 0xbc, 0xbb, 0x07, 0x34, 0x3c,
-	0x8d, 0x81, 0xbd, 0xf4, 0xe9, 0x37, 0xdb, 0x39,
-	0xe9, 0xd1, 0x45, 0x5b, 0x20, 0x41, 0x2f, 0x2d,
-	0x27, 0x22, 0xdc, 0x92, 0x74, 0x8a, 0x92, 0xd5,
-	0x83, 0xfd, 0x09, 0xfb, 0x13, 0x9b, 0xe3, 0x39,
-	0x7a, 0x6b, 0x5c, 0xfa, 0xe6, 0x76, 0x9e, 0xe0,
-	0xe4, 0xe3, 0xef, 0xad, 0xbc, 0xfd, 0x42, 0x45,
-	0x9a, 0xd4, 0x94, 0xd1, 0x7e, 0x8d, 0xa7, 0xd8,
-	0x05, 0xd5, 0xd3, 0x62, 0xcf, 0x15, 0xcf, 0x94,
-	0x7d, 0x1f, 0x5b, 0x58, 0x20, 0x44, 0x20, 0x90,
-	0x71, 0xbe, 0x66, 0xe9, 0x9a, 0xab, 0x74, 0x32,
-	0x70, 0x53, 0x1d, 0x69, 0xed, 0x87, 0x66, 0xf4,
-	0x09, 0x4f, 0xca, 0x25, 0x30, 0xc2, 0x63, 0x79,
-	0x00, 0x3c, 0xb1, 0x9b, 0x39, 0x3f, 0x00, 0xe0,
-	0xa8, 0x88, 0xef, 0x7a, 0x51, 0x5b, 0xe7, 0xbd,
-	0x49, 0x64, 0xda, 0x41, 0x7b, 0x24, 0xc3, 0x71,
-	0x22, 0xfd, 0xd1, 0xd1, 0x20, 0xb3, 0x3f, 0x97,
-	0xd3, 0x97, 0xb2, 0xaa, 0x18, 0x1c, 0x9e, 0x03,
-	0x77, 0x7b, 0x5b, 0x7e, 0xf9, 0xa3, 0xa0, 0xd6,
-	0x20, 0x81, 0x2c, 0x38, 0x8f, 0x9d, 0x25, 0xde,
-	0xe9, 0xc8, 0xf5, 0xdd, 0x6a, 0x47, 0x9c, 0x65,
-	0x04, 0x5a, 0x56, 0xe6, 0xc2, 0xeb, 0xf2, 0x02,
-	0x97, 0xe1, 0xb9, 0xd8, 0xe1, 0x24, 0x76, 0x9f,
-	0x23, 0x62, 0x39, 0x03, 0x4b, 0xc8, 0xf7, 0x34,
-	0x07, 0x49, 0xd6, 0xe7, 0x4d, 0x9a,
+	REGRESS_CRED_X509,
 };
 
 const unsigned char sig[70] = {
-	0x30, 0x44, 0x02, 0x20, 0x54, 0x92, 0x28, 0x3b,
-	0x83, 0x33, 0x47, 0x56, 0x68, 0x79, 0xb2, 0x0c,
-	0x84, 0x80, 0xcc, 0x67, 0x27, 0x8b, 0xfa, 0x48,
-	0x43, 0x0d, 0x3c, 0xb4, 0x02, 0x36, 0x87, 0x97,
-	0x3e, 0xdf, 0x2f, 0x65, 0x02, 0x20, 0x1b, 0x56,
-	0x17, 0x06, 0xe2, 0x26, 0x0f, 0x6a, 0xe9, 0xa9,
-	0x70, 0x99, 0x62, 0xeb, 0x3a, 0x04, 0x1a, 0xc4,
-	0xa7, 0x03, 0x28, 0x56, 0x7c, 0xed, 0x47, 0x08,
-	0x68, 0x73, 0x6a, 0xb6, 0x89, 0x0d,
+	REGRESS_CRED_SIG,
 };
 
 const unsigned char pubkey[64] = {
@@ -282,6 +161,242 @@ dummy_write(void *handle, const unsigned char *buf, size_t len)
 	/* NOTREACHED */
 }
 
+/*
+ * A CBOR-level authenticator with maxCredentialCountInList=2 and
+ * maxCredentialIdLength=16, driven through the transport functions.
+ * Silent getAssertion requests find fake.known; makeCredential fails
+ * with CTAP2_ERR_CREDENTIAL_EXCLUDED if its exclude list names
+ * fake.known, and is denied otherwise.
+ */
+static struct {
+	unsigned char		 nonce[8];
+	unsigned char		 reply[256];
+	size_t			 reply_len;
+	const unsigned char	*info;
+	size_t			 info_len;
+	size_t			 chunk[8];	/* allow list sizes */
+	size_t			 nchunk;
+	size_t			 nmakecred;
+	size_t			 excl_len;	/* last exclude list size */
+	size_t			 ntoken;
+	uint8_t			 perm;		/* last token permissions */
+	bool			 pin_auth;	/* last makeCredential */
+	const unsigned char	*known;
+} fake;
+
+static const unsigned char fake_info[] = {
+	0x00, 0xa3, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x07, 0x02, 0x08,
+	0x10,
+};
+
+/* FIDO_2_1 with clientPin=true, pinUvAuthToken=true and PIN protocol 1 */
+static const unsigned char fake_info_21[] = {
+	0x00, 0xa5, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x31, 0x04, 0xa2, 0x69,
+	0x63, 0x6c, 0x69, 0x65, 0x6e, 0x74, 0x50, 0x69,
+	0x6e, 0xf5, 0x6e, 0x70, 0x69, 0x6e, 0x55, 0x76,
+	0x41, 0x75, 0x74, 0x68, 0x54, 0x6f, 0x6b, 0x65,
+	0x6e, 0xf5, 0x06, 0x81, 0x01, 0x07, 0x02, 0x08,
+	0x10,
+};
+
+static void
+fake_reply(const unsigned char *ptr, size_t len)
+{
+	assert(len <= sizeof(fake.reply));
+	memcpy(fake.reply, ptr, len);
+	fake.reply_len = len;
+}
+
+static const cbor_item_t *
+fake_get(const cbor_item_t *req, uint8_t key)
+{
+	const struct cbor_pair *p = cbor_map_handle(req);
+
+	for (size_t i = 0; i < cbor_map_size(req); i++)
+		if (cbor_get_uint8(p[i].key) == key)
+			return (p[i].value);
+
+	return (NULL);
+}
+
+static size_t
+fake_list(const cbor_item_t *req, uint8_t key, const cbor_item_t **list)
+{
+	if ((*list = fake_get(req, key)) == NULL)
+		return (0);
+
+	return (cbor_array_size(*list));
+}
+
+static bool
+fake_known(const cbor_item_t *list, size_t n)
+{
+	const struct cbor_pair	*cred;
+	const cbor_item_t	*cred_id;
+
+	for (size_t i = 0; i < n; i++) {
+		cred = cbor_map_handle(cbor_array_handle(list)[i]);
+		cred_id = cred[0].value; /* "id" sorts before "type" */
+		assert(cbor_bytestring_length(cred_id) <= 16);
+		if (fake.known != NULL && cbor_bytestring_length(cred_id) ==
+		    16 && memcmp(cbor_bytestring_handle(cred_id), fake.known,
+		    16) == 0)
+			return (true);
+	}
+
+	return (false);
+}
+
+static void
+fake_client_pin(const cbor_item_t *req)
+{
+	unsigned char	 reply[96];
+	size_t		 len = 0;
+
+	switch (cbor_get_uint8(fake_get(req, 2))) {
+	case 2: /* getKeyAgreement: {1: ECDH-ES+HKDF-256 key} */
+		memcpy(reply, "\x00\xa1\x01\xa5\x01\x02\x03\x38\x18\x20"
+		    "\x01\x21\x58\x20", 14);
+		memcpy(&reply[14], pubkey, 32);
+		memcpy(&reply[46], "\x22\x58\x20", 3);
+		memcpy(&reply[49], &pubkey[32], 32);
+		len = 81;
+		break;
+	case 9: /* getPinUvAuthTokenUsingPinWithPermissions */
+		fake.perm = cbor_get_uint8(fake_get(req, 9));
+		fake.ntoken++;
+		memcpy(reply, "\x00\xa1\x02\x58\x20", 5);
+		memset(&reply[5], 0, 32);
+		len = 37;
+		break;
+	default:
+		abort();
+	}
+
+	fake_reply(reply, len);
+}
+
+static void
+fake_assert(const cbor_item_t *req)
+{
+	const unsigned char	 none = 0x2e; /* CTAP2_ERR_NO_CREDENTIALS */
+	unsigned char		 found[] = {
+		0x00, 0xa1, 0x01, 0xa2, 0x62, 0x69, 0x64, 0x50,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+		0x64, 0x74, 0x79, 0x70, 0x65, 0x6a, 0x70, 0x75,
+		0x62, 0x6c, 0x69, 0x63, 0x2d, 0x6b, 0x65, 0x79,
+	};
+	const cbor_item_t	*list = NULL;
+	size_t			 n;
+
+	assert((n = fake_list(req, 3, &list)) != 0 && n <= 2);
+	assert(fake.nchunk < nitems(fake.chunk));
+	fake.chunk[fake.nchunk++] = n;
+
+	if (fake_known(list, n)) {
+		memcpy(&found[8], fake.known, 16);
+		fake_reply(found, sizeof(found));
+		return;
+	}
+
+	fake_reply(&none, sizeof(none));
+}
+
+static int
+fake_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	const unsigned char	 denied = 0x27; /* CTAP2_ERR_OPERATION_DENIED */
+	const unsigned char	 excl = 0x19; /* CTAP2_ERR_CREDENTIAL_EXCLUDED */
+	const cbor_item_t	*list;
+	struct cbor_load_result	 res;
+	cbor_item_t		*req;
+
+	(void)d;
+
+	if (cmd == CTAP_CMD_INIT) {
+		assert(len == sizeof(fake.nonce));
+		memcpy(fake.nonce, buf, len);
+		memset(fake.reply, 0, 17);
+		memcpy(fake.reply, fake.nonce, sizeof(fake.nonce));
+		fake.reply[16] = FIDO_CAP_CBOR;
+		fake.reply_len = 17;
+		return ((int)len);
+	}
+
+	assert(cmd == CTAP_CMD_CBOR && len > 0);
+
+	switch (buf[0]) {
+	case CTAP_CBOR_GETINFO:
+		fake_reply(fake.info, fake.info_len);
+		break;
+	case CTAP_CBOR_CLIENT_PIN:
+		assert((req = cbor_load(buf + 1, len - 1, &res)) != NULL);
+		fake_client_pin(req);
+		cbor_decref(&req);
+		break;
+	case CTAP_CBOR_ASSERT:
+		assert((req = cbor_load(buf + 1, len - 1, &res)) != NULL);
+		fake_assert(req);
+		cbor_decref(&req);
+		break;
+	case CTAP_CBOR_MAKECRED:
+		assert((req = cbor_load(buf + 1, len - 1, &res)) != NULL);
+		fake.excl_len = fake_list(req, 5, &list);
+		fake.pin_auth = fake_get(req, 8) != NULL;
+		fake.nmakecred++;
+		if (fake_known(list, fake.excl_len))
+			fake_reply(&excl, sizeof(excl));
+		else
+			fake_reply(&denied, sizeof(denied));
+		cbor_decref(&req);
+		break;
+	default:
+		abort();
+	}
+
+	return ((int)len);
+}
+
+static int
+fake_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)ms;
+
+	assert(fake.reply_len <= len);
+	memcpy(buf, fake.reply, fake.reply_len);
+
+	return ((int)fake.reply_len);
+}
+
+static fido_dev_t *
+open_fake_dev(const unsigned char *info, size_t info_len)
+{
+	fido_dev_io_t		io_f;
+	fido_dev_transport_t	t;
+	fido_dev_t		*d;
+
+	memset(&io_f, 0, sizeof(io_f));
+	io_f.open = dummy_open;
+	io_f.close = dummy_close;
+	io_f.read = dummy_read;
+	io_f.write = dummy_write;
+	t.rx = fake_rx;
+	t.tx = fake_tx;
+	fake.info = info;
+	fake.info_len = info_len;
+
+	assert((d = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(d, &io_f) == FIDO_OK);
+	assert(fido_dev_set_transport_functions(d, &t) == FIDO_OK);
+	assert(fido_dev_open(d, "fake") == FIDO_OK);
+
+	return (d);
+}
+
 static fido_cred_t *
 alloc_cred(void)
 {
@@ -654,6 +769,46 @@ junk_rp_id(void)
 	free_cred(c);
 }
 
+static void
+rp_id_hash(void)
+{
+	fido_cred_t *c;
+	unsigned char junk[32];
+
+	memset(junk, 0, sizeof(junk));
+	c = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509(c, x509, sizeof(x509)) == FIDO_OK);
+	assert(fido_cred_set_sig(c, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_ERR_INVALID_ARGUMENT);
+	/* the authdata starts with sha256("localhost") */
+	assert(fido_cred_set_rp_id_hash(c, authdata + 2, 32) == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_OK);
+	/* the relying party id replaces an earlier hash */
+	assert(fido_cred_set_rp(c, "potato", rp_name) == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_cred_set_rp_id_hash(c, authdata + 2,
+	    32) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_verify(c) == FIDO_ERR_INVALID_PARAM);
+	/* a hash that does not match the relying party id is rejected */
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_rp_id_hash(c, junk,
+	    sizeof(junk)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(strcmp(fido_cred_rp_id(c), rp_id) == 0);
+	assert(fido_cred_verify(c) == FIDO_OK);
+	assert(fido_cred_set_rp_id_hash(c, authdata + 2, 32) == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_OK);
+	/* clearing the relying party id clears its hash */
+	assert(fido_cred_set_rp(c, NULL, NULL) == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_ERR_INVALID_ARGUMENT);
+	free_cred(c);
+}
+
 static void
 junk_rp_name(void)
 {
@@ -911,6 +1066,113 @@ raw_authdata(void)
 	free_cred(c);
 }
 
+static fido_cred_t *
+excl_cred(unsigned char ids[][16], size_t n)
+{
+	const unsigned char long_id[32] = { 0 };
+	fido_cred_t *c;
+
+	c = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	for (size_t i = 0; i < n; i++) {
+		memset(ids[i], (int)i + 1, 16);
+		assert(fido_cred_exclude(c, ids[i], 16) == FIDO_OK);
+	}
+	/* longer than maxCredentialIdLength; never sent */
+	assert(fido_cred_exclude(c, long_id, sizeof(long_id)) == FIDO_OK);
+
+	return (c);
+}
+
+static void
+excl_chunks(void)
+{
+	unsigned char ids[5][16];
+	fido_cred_t *c;
+	fido_dev_t *d;
+
+	d = open_fake_dev(fake_info, sizeof(fake_info));
+	c = excl_cred(ids, nitems(ids));
+
+	/* no match: three lookups, then makeCredential without the list */
+	memset(&fake.chunk, 0, sizeof(fake.chunk));
+	fake.nchunk = fake.nmakecred = 0;
+	fake.excl_len = SIZE_MAX;
+	fake.known = NULL;
+	assert(fido_dev_make_cred(d, c, NULL) == FIDO_ERR_OPERATION_DENIED);
+	assert(fake.nchunk == 3);
+	assert(fake.chunk[0] == 2 && fake.chunk[1] == 2 && fake.chunk[2] == 1);
+	assert(fake.nmakecred == 1);
+	assert(fake.excl_len == 0);
+
+	/*
+	 * match in the second chunk: makeCredential is sent with the match
+	 * alone, and the authenticator reports the exclusion
+	 */
+	fake.nchunk = fake.nmakecred = 0;
+	fake.known = ids[3];
+	assert(fido_dev_make_cred(d, c, NULL) ==
+	    FIDO_ERR_CREDENTIAL_EXCLUDED);
+	assert(fake.nchunk == 2);
+	assert(fake.nmakecred == 1);
+	assert(fake.excl_len == 1);
+	assert(fake.pin_auth == false);
+
+	/*
+	 * uv=true without a token cannot be probed authoritatively on a
+	 * device without permissions; nothing is sent.
+	 */
+	fake.nchunk = fake.nmakecred = 0;
+	assert(fido_cred_set_uv(c, FIDO_OPT_TRUE) == FIDO_OK);
+	assert(fido_dev_make_cred(d, c, NULL) == FIDO_ERR_UNSUPPORTED_OPTION);
+	assert(fake.nchunk == 0);
+	assert(fake.nmakecred == 0);
+
+	free_cred(c);
+	assert(fido_dev_close(d) == FIDO_OK);
+	free_dev(d);
+}
+
+static void
+excl_token(void)
+{
+	unsigned char ids[5][16];
+	fido_cred_t *c;
+	fido_dev_t *d;
+
+	d = open_fake_dev(fake_info_21, sizeof(fake_info_21));
+	c = excl_cred(ids, nitems(ids));
+
+	/* the lookup and makeCredential share one token */
+	fake.nchunk = fake.nmakecred = fake.ntoken = 0;
+	fake.perm = 0;
+	fake.known = ids[3];
+	assert(fido_dev_make_cred(d, c, "1234") ==
+	    FIDO_ERR_CREDENTIAL_EXCLUDED);
+	assert(fake.ntoken == 1);
+	assert(fake.perm == 0x03); /* mc | ga */
+	assert(fake.nchunk == 2);
+	assert(fake.nmakecred == 1);
+	assert(fake.excl_len == 1);
+	assert(fake.pin_auth == true);
+
+	/* no match: makeCredential still reuses the token */
+	fake.nchunk = fake.nmakecred = fake.ntoken = 0;
+	fake.known = NULL;
+	assert(fido_dev_make_cred(d, c, "1234") == FIDO_ERR_OPERATION_DENIED);
+	assert(fake.ntoken == 1);
+	assert(fake.nchunk == 3);
+	assert(fake.nmakecred == 1);
+	assert(fake.excl_len == 0);
+	assert(fake.pin_auth == true);
+
+	free_cred(c);
+	assert(fido_dev_close(d) == FIDO_OK);
+	free_dev(d);
+}
+
 int
 main(void)
 {
@@ -927,6 +1189,7 @@ main(void)
 	no_fmt();
 	junk_cdh();
 	junk_rp_id();
+	rp_id_hash();
 	junk_rp_name();
 	junk_authdata();
 	junk_x509();
@@ -938,6 +1201,8 @@ main(void)
 	unsorted_keys();
 	wrong_credprot();
 	raw_authdata();
+	excl_chunks();
+	excl_token();
 
 	exit(0);
 }
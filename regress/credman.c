@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <cbor.h>
+#include <fido.h>
+#include <fido/credman.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_credman.h"
+
+#define PIN		"1234"
+
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+
+/* versions: FIDO_2_0; pinProtocols: 1 */
+static const unsigned char fake_info[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 0x46, 0x49, 0x44,
+	0x4f, 0x5f, 0x32, 0x5f, 0x30, 0x06, 0x81, 0x01,
+};
+
+/* the credentials themselves live in rks; see fake_credman.h */
+static struct {
+	unsigned char		 reply[1024];
+	size_t			 reply_len;
+	size_t			 nreq[7];	/* by subcommand */
+	size_t			 fail_at;	/* nth deletion fails */
+	int			 fail_status;	/* -1: no reply */
+} fake;
+
+static void
+fake_status(uint8_t status)
+{
+	fake.reply[0] = status;
+	fake.reply_len = 1;
+}
+
+/*
+ * Reply with a successful status and the map 'item', which is consumed.
+ * A NULL 'item' from fake_enum() means there are no credentials.
+ */
+static void
+fake_reply(cbor_item_t *item)
+{
+	unsigned char	*ptr = NULL;
+	size_t		 len, alloc;
+
+	if (item == NULL) {
+		fake_status(0x2e); /* CTAP2_ERR_NO_CREDENTIALS */
+		return;
+	}
+
+	assert((len = cbor_serialize_alloc(item, &ptr, &alloc)) != 0);
+	assert(len < sizeof(fake.reply));
+	fake.reply[0] = 0x00;
+	memcpy(&fake.reply[1], ptr, len);
+	fake.reply_len = len + 1;
+	free(ptr);
+	cbor_decref(&item);
+}
+
+static void
+fake_delete(const cbor_item_t *param)
+{
+	const cbor_item_t	*id;
+
+	if (fake.fail_at != 0 && fake.nreq[6] == fake.fail_at) {
+		if (fake.fail_status < 0)
+			fake.reply_len = 0;
+		else
+			fake_status((uint8_t)fake.fail_status);
+		return;
+	}
+
+	id = cbor_map_handle(map_get(param, 2))[0].value;
+
+	for (size_t i = 0; i < rks.ncred; i++)
+		if (cbor_bytestring_length(id) == sizeof(rks.cred[i].id) &&
+		    memcmp(cbor_bytestring_handle(id), rks.cred[i].id,
+		    sizeof(rks.cred[i].id)) == 0) {
+			rks.cred[i] = rks.cred[--rks.ncred];
+			fake_status(0x00);
+			return;
+		}
+
+	fake_status(0x2e); /* CTAP2_ERR_NO_CREDENTIALS */
+}
+
+static void
+fake_credman(const cbor_item_t *req)
+{
+	uint8_t		 subcmd = cbor_get_uint8(map_get(req, 1));
+	cbor_item_t	*m;
+
+	assert(subcmd < nitems(fake.nreq));
+	fake.nreq[subcmd]++;
+
+	switch (subcmd) {
+	case 1: /* getCredsMetadata */
+		assert((m = cbor_new_definite_map(2)) != NULL);
+		map_add(m, cbor_build_uint8(1), cbor_build_uint8((uint8_t)
+		    rks.ncred));
+		map_add(m, cbor_build_uint8(2), cbor_build_uint8((uint8_t)
+		    (FAKE_MAXCRED - rks.ncred)));
+		fake_reply(m);
+		break;
+	case 6:
+		fake_delete(map_get(req, 2));
+		break;
+	default:
+		fake_reply(fake_enum(subcmd, map_get(req, 2)));
+		break;
+	}
+}
+
+int
+fake_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	struct cbor_load_result	 res;
+	cbor_item_t		*req;
+
+	(void)d;
+
+	if (cmd == CTAP_CMD_INIT) {
+		fake.reply_len = fake_init(fake.reply, buf, len);
+		return ((int)len);
+	}
+
+	assert(cmd == CTAP_CMD_CBOR && len > 0);
+
+	if (buf[0] == CTAP_CBOR_GETINFO) {
+		memcpy(fake.reply, fake_info, sizeof(fake_info));
+		fake.reply_len = sizeof(fake_info);
+		return ((int)len);
+	}
+
+	assert((req = cbor_load(buf + 1, len - 1, &res)) != NULL);
+
+	switch (buf[0]) {
+	case CTAP_CBOR_CLIENT_PIN:
+		fake_reply(fake_client_pin(req));
+		break;
+	case CTAP_CBOR_CRED_MGMT_PRE:
+		fake_credman(req);
+		break;
+	default:
+		abort();
+	}
+
+	cbor_decref(&req);
+
+	return ((int)len);
+}
+
+int
+fake_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)ms;
+
+	assert(fake.reply_len <= len);
+	memcpy(buf, fake.reply, fake.reply_len);
+
+	return ((int)fake.reply_len);
+}
+
+static void
+fake_setup(void)
+{
+	memset(&fake, 0, sizeof(fake));
+	memset(&rks, 0, sizeof(rks));
+	fake_add("a.example", 1);
+	fake_add("a.example", 2);
+	fake_add("b.example", 3);
+}
+
+static void
+fake_clear_counters(void)
+{
+	rks.ntoken = 0;
+	memset(&fake.nreq, 0, sizeof(fake.nreq));
+}
+
+static void
+fake_fail_delete(size_t n, int status)
+{
+	fake.fail_at = n;
+	fake.fail_status = status;
+}
+
+static size_t
+count_rk(fido_dev_t *d, const char *rp_id, uint8_t id)
+{
+	fido_credman_rk_t	*rk;
+	const fido_cred_t	*cred;
+	size_t			 n = 0;
+
+	assert((rk = fido_credman_rk_new()) != NULL);
+	assert(fido_credman_get_dev_rk(d, rp_id, rk, PIN) == FIDO_OK);
+	for (size_t i = 0; i < fido_credman_rk_count(rk); i++) {
+		assert((cred = fido_credman_rk(rk, i)) != NULL);
+		assert(fido_cred_id_len(cred) == 16);
+		if (fido_cred_id_ptr(cred)[0] == id)
+			n++;
+	}
+	fido_credman_rk_free(&rk);
+
+	return (n);
+}
+
+static size_t
+count_rp(fido_dev_t *d)
+{
+	fido_credman_rp_t	*rp;
+	size_t			 n;
+
+	assert((rp = fido_credman_rp_new()) != NULL);
+	assert(fido_credman_get_dev_rp(d, rp, PIN) == FIDO_OK);
+	n = fido_credman_rp_count(rp);
+	fido_credman_rp_free(&rp);
+
+	return (n);
+}
+
+static void
+uncached(void)
+{
+	fido_dev_t *d;
+
+	fake_setup();
+	d = open_fake_dev();
+
+	/* each walk reaches the authenticator under a single token */
+	for (int i = 0; i < 2; i++) {
+		fake_clear_counters();
+		assert(count_rk(d, "a.example", 2) == 1);
+		assert(rks.ntoken == 1);
+		assert(fake.nreq[1] == 0);
+		assert(fake.nreq[4] == 1 && fake.nreq[5] == 1);
+	}
+
+	close_fake_dev(d);
+}
+
+static void
+cached(void)
+{
+	fido_dev_t *d;
+
+	fake_setup();
+	d = open_fake_dev();
+	assert(fido_credman_set_dev_cache(d, true) == FIDO_OK);
+
+	/* miss: metadata and the walk share one token */
+	fake_clear_counters();
+	assert(count_rp(d) == 2);
+	assert(rks.ntoken == 1);
+	assert(fake.nreq[1] == 1);
+	assert(fake.nreq[2] == 1 && fake.nreq[3] == 1);
+
+	fake_clear_counters();
+	assert(count_rk(d, "a.example", 1) == 1);
+	assert(rks.ntoken == 1);
+	assert(fake.nreq[1] == 1);
+	assert(fake.nreq[4] == 1 && fake.nreq[5] == 1);
+
+	/* hit: replayed after a metadata check */
+	fake_clear_counters();
+	assert(count_rk(d, "a.example", 1) == 1);
+	assert(count_rk(d, "a.example", 2) == 1);
+	assert(count_rp(d) == 2);
+	assert(rks.ntoken == 3);
+	assert(fake.nreq[1] == 3);
+	assert(fake.nreq[2] == 0 && fake.nreq[4] == 0);
+
+	/* a credential created elsewhere changes the metadata */
+	fake_add("a.example", 4);
+	fake_clear_counters();
+	assert(count_rk(d, "a.example", 4) == 1);
+	assert(fake.nreq[4] == 1 && fake.nreq[5] == 2);
+
+	/* a deletion through the handle empties the cache */
+	memset(rks.cred[0].id, 1, sizeof(rks.cred[0].id));
+	assert(fido_credman_del_dev_rk(d, rks.cred[0].id,
+	    sizeof(rks.cred[0].id), PIN) == FIDO_OK);
+	fake_clear_counters();
+	assert(count_rk(d, "a.example", 1) == 0);
+	assert(fake.nreq[4] == 1);
+
+	/* disabling the cache walks again */
+	assert(fido_credman_set_dev_cache(d, false) == FIDO_OK);
+	fake_clear_counters();
+	assert(count_rk(d, "a.example", 4) == 1);
+	assert(fake.nreq[1] == 0 && fake.nreq[4] == 1);
+
+	close_fake_dev(d);
+}
+
+/* every credential, grouped by relying party, under one token */
+static void
+get_all(void)
+{
+	fido_credman_rk_t	*rk;
+	const fido_cred_t	*cred;
+	fido_dev_t		*d;
+	const char		*rp_id;
+	size_t			 ngroup;
+	uint8_t			 id;
+
+	fake_setup();
+	fake_add("c.example", 4);
+	fake_add("c.example", 5);
+	fake_add("c.example", 6);
+	d = open_fake_dev();
+	assert((rk = fido_credman_rk_new()) != NULL);
+
+	for (int i = 0; i < 2; i++) {
+		ngroup = 0;
+		fake_clear_counters();
+		assert(fido_credman_get_dev_all(d, rk, PIN) == FIDO_OK);
+		assert(fido_credman_rk_count(rk) == rks.ncred);
+		assert(rks.ntoken == 1);
+		assert(fake.nreq[2] == 1 && fake.nreq[3] == 2);
+		assert(fake.nreq[4] == 3 && fake.nreq[5] == 3);
+		for (size_t j = 0; j < fido_credman_rk_count(rk); j++) {
+			assert((cred = fido_credman_rk(rk, j)) != NULL);
+			assert(fido_cred_id_len(cred) == 16);
+			id = fido_cred_id_ptr(cred)[0];
+			assert(id >= 1 && id <= rks.ncred);
+			rp_id = rks.cred[id - 1].rp_id;
+			assert(strcmp(fido_cred_rp_id(cred), rp_id) == 0);
+			if (j == 0 || strcmp(fido_cred_rp_id(fido_credman_rk(rk,
+			    j - 1)), rp_id) != 0)
+				ngroup++;
+		}
+		assert(ngroup == 3);
+	}
+
+	/* no credentials, as reported by fido_credman_get_dev_rp() */
+	rks.ncred = 0;
+	fake_clear_counters();
+	assert(fido_credman_get_dev_all(d, rk, PIN) ==
+	    FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_credman_rk_count(rk) == 0);
+	assert(rks.ntoken == 1 && fake.nreq[4] == 0);
+
+	fido_credman_rk_free(&rk);
+	assert(rk == NULL);
+	close_fake_dev(d);
+}
+
+static void
+del_batch(fido_dev_t *d, const uint8_t *id, size_t n, bool stop_on_error,
+    int r, const int *expected)
+{
+	unsigned char		 buf[FAKE_MAXCRED][16];
+	const unsigned char	*cred_id[FAKE_MAXCRED];
+	size_t			 cred_id_len[FAKE_MAXCRED];
+	int			 status[FAKE_MAXCRED];
+
+	assert(n <= FAKE_MAXCRED);
+	for (size_t i = 0; i < n; i++) {
+		memset(buf[i], id[i], sizeof(buf[i]));
+		cred_id[i] = id[i] != 0 ? buf[i] : NULL;
+		cred_id_len[i] = sizeof(buf[i]);
+		status[i] = 0x7f;
+	}
+
+	fake_clear_counters();
+	assert(fido_credman_del_dev_rk_batch(d, cred_id, cred_id_len, n,
+	    status, stop_on_error, PIN) == r);
+	assert(rks.ntoken == 1);
+	for (size_t i = 0; i < n; i++)
+		assert(status[i] == expected[i]);
+}
+
+static void
+batch_delete(void)
+{
+	const uint8_t	 id[] = { 1, 9, 0, 3 };
+	const int	 all[] = { FIDO_OK, FIDO_ERR_NO_CREDENTIALS,
+			    FIDO_ERR_INVALID_ARGUMENT, FIDO_OK };
+	const int	 stop[] = { FIDO_OK, FIDO_ERR_NO_CREDENTIALS,
+			    FIDO_ERR_NO_CREDENTIALS, FIDO_ERR_NO_CREDENTIALS };
+	const uint8_t	 id2[] = { 1, 2, 3 };
+	const int	 expired[] = { FIDO_OK, FIDO_ERR_PIN_TOKEN_EXPIRED,
+			    FIDO_ERR_PIN_TOKEN_EXPIRED };
+	const int	 invalid[] = { FIDO_OK, FIDO_ERR_PIN_AUTH_INVALID,
+			    FIDO_ERR_PIN_AUTH_INVALID };
+	const int	 rx[] = { FIDO_OK, FIDO_ERR_RX, FIDO_ERR_RX };
+	fido_dev_t	*d;
+
+	/* per-id status; the batch goes on past a missing credential */
+	fake_setup();
+	d = open_fake_dev();
+	del_batch(d, id, nitems(id), false, FIDO_ERR_NO_CREDENTIALS, all);
+	assert(fake.nreq[6] == 3);
+	assert(rks.ncred == 1);
+	assert(count_rk(d, "a.example", 2) == 1);
+	close_fake_dev(d);
+
+	/* stop_on_error: nothing is attempted after the first failure */
+	fake_setup();
+	d = open_fake_dev();
+	del_batch(d, id, nitems(id), true, FIDO_ERR_NO_CREDENTIALS, stop);
+	assert(fake.nreq[6] == 2);
+	assert(count_rk(d, "b.example", 3) == 1);
+	close_fake_dev(d);
+
+	/* token and transport errors stop the batch regardless */
+	fake_setup();
+	fake_fail_delete(2, FIDO_ERR_PIN_TOKEN_EXPIRED);
+	d = open_fake_dev();
+	del_batch(d, id2, nitems(id2), false, FIDO_ERR_PIN_TOKEN_EXPIRED,
+	    expired);
+	assert(fake.nreq[6] == 2);
+	assert(rks.ncred == 2);
+	close_fake_dev(d);
+
+	fake_setup();
+	fake_fail_delete(2, FIDO_ERR_PIN_AUTH_INVALID);
+	d = open_fake_dev();
+	del_batch(d, id2, nitems(id2), false, FIDO_ERR_PIN_AUTH_INVALID,
+	    invalid);
+	assert(fake.nreq[6] == 2);
+	assert(rks.ncred == 2);
+	close_fake_dev(d);
+
+	fake_setup();
+	fake_fail_delete(2, -1);
+	d = open_fake_dev();
+	del_batch(d, id2, nitems(id2), false, FIDO_ERR_RX, rx);
+	assert(fake.nreq[6] == 2);
+	assert(rks.ncred == 2);
+	close_fake_dev(d);
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	uncached();
+	cached();
+	get_all();
+	batch_delete();
+
+	exit(0);
+}
@@ -251,6 +251,124 @@ has_pin(void)
 	wiredata_clear(&wiredata);
 }
 
+/*
+ * A transport that answers CTAPHID_INIT and authenticatorGetInfo, the
+ * latter with the versions in 'touch_versions', and records the last
+ * CBOR command sent.
+ */
+static const char *const	*touch_versions;
+static size_t			 touch_nversions;
+static uint8_t			 touch_nonce[8];
+static unsigned char		 touch_reply[256];
+static size_t			 touch_reply_len;
+static unsigned char		 touch_cmd[1024];
+static size_t			 touch_cmd_len;
+
+static int
+touch_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	size_t n, i = 0;
+
+	(void)d;
+
+	if (cmd == CTAP_CMD_INIT) {
+		assert(len == sizeof(touch_nonce));
+		memcpy(touch_nonce, buf, len);
+		memset(touch_reply, 0, 17);
+		memcpy(touch_reply, touch_nonce, sizeof(touch_nonce));
+		touch_reply[16] = FIDO_CAP_CBOR;
+		touch_reply_len = 17;
+		return ((int)len);
+	}
+
+	assert(cmd == CTAP_CMD_CBOR && len > 0 && len <= sizeof(touch_cmd));
+
+	if (buf[0] == CTAP_CBOR_GETINFO) {
+		/* { 1: [ versions ] } */
+		touch_reply[i++] = 0x00;
+		touch_reply[i++] = 0xa1;
+		touch_reply[i++] = 0x01;
+		touch_reply[i++] = (unsigned char)(0x80 | touch_nversions);
+		for (size_t j = 0; j < touch_nversions; j++) {
+			n = strlen(touch_versions[j]);
+			assert(n < 24 && i + 1 + n <= sizeof(touch_reply));
+			touch_reply[i++] = (unsigned char)(0x60 | n);
+			memcpy(&touch_reply[i], touch_versions[j], n);
+			i += n;
+		}
+		touch_reply_len = i;
+		return ((int)len);
+	}
+
+	memcpy(touch_cmd, buf, len);
+	touch_cmd_len = len;
+
+	return ((int)len);
+}
+
+static int
+touch_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)ms;
+
+	assert(touch_reply_len <= len);
+	memcpy(buf, touch_reply, touch_reply_len);
+
+	return ((int)touch_reply_len);
+}
+
+static void
+touch_begin(const char *const *versions, size_t nversions, uint8_t want)
+{
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+	fido_dev_transport_t	 t;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+	t.rx = touch_rx;
+	t.tx = touch_tx;
+
+	touch_versions = versions;
+	touch_nversions = nversions;
+	touch_cmd_len = 0;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_set_transport_functions(dev, &t) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_touch_begin(dev) == FIDO_OK);
+	assert(touch_cmd_len > 0 && touch_cmd[0] == want);
+	if (want == CTAP_CBOR_SELECTION)
+		assert(touch_cmd_len == 1);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+/* authenticatorSelection is only sent to FIDO_2_1 authenticators */
+static void
+get_touch(void)
+{
+	const char *const v21[] = { "FIDO_2_1" };
+	const char *const v20[] = { "FIDO_2_0" };
+	const char *const v21pre[] = { "FIDO_2_1_PRE" };
+	const char *const v20_21pre[] = { "U2F_V2", "FIDO_2_0",
+	    "FIDO_2_1_PRE" };
+	const char *const v20_21[] = { "FIDO_2_0", "FIDO_2_1" };
+
+	touch_begin(v21, 1, CTAP_CBOR_SELECTION);
+	touch_begin(v20_21, 2, CTAP_CBOR_SELECTION);
+	touch_begin(v20, 1, CTAP_CBOR_MAKECRED);
+	touch_begin(v21pre, 1, CTAP_CBOR_MAKECRED);
+	touch_begin(v20_21pre, 3, CTAP_CBOR_MAKECRED);
+}
+
 int
 main(void)
 {
@@ -261,6 +379,7 @@ main(void)
 	double_open();
 	is_fido2();
 	has_pin();
+	get_touch();
 
 	exit(0);
 }
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <openssl/sha.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_credman.h"
+
+#define FAKE_DEV_HANDLE	((void *)0xdeadbeef)
+
+/* a P-256 key agreement key: the generator */
+static const unsigned char p256_x[32] = {
+	0x6b, 0x17, 0xd1, 0xf2, 0xe1, 0x2c, 0x42, 0x47,
+	0xf8, 0xbc, 0xe6, 0xe5, 0x63, 0xa4, 0x40, 0xf2,
+	0x77, 0x03, 0x7d, 0x81, 0x2d, 0xeb, 0x33, 0xa0,
+	0xf4, 0xa1, 0x39, 0x45, 0xd8, 0x98, 0xc2, 0x96,
+};
+
+static const unsigned char p256_y[32] = {
+	0x4f, 0xe3, 0x42, 0xe2, 0xfe, 0x1a, 0x7f, 0x9b,
+	0x8e, 0xe7, 0xeb, 0x4a, 0x7c, 0x0f, 0x9e, 0x16,
+	0x2b, 0xce, 0x33, 0x57, 0x6b, 0x31, 0x5e, 0xce,
+	0xcb, 0xb6, 0x40, 0x68, 0x37, 0xbf, 0x51, 0xf5,
+};
+
+struct fake_rks rks;
+
+static void *
+dummy_open(const char *path)
+{
+	(void)path;
+
+	return (FAKE_DEV_HANDLE);
+}
+
+static void
+dummy_close(void *handle)
+{
+	assert(handle == FAKE_DEV_HANDLE);
+}
+
+static int
+dummy_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	(void)handle;
+	(void)buf;
+	(void)len;
+	(void)ms;
+
+	abort();
+	/* NOTREACHED */
+}
+
+static int
+dummy_write(void *handle, const unsigned char *buf, size_t len)
+{
+	(void)handle;
+	(void)buf;
+	(void)len;
+
+	abort();
+	/* NOTREACHED */
+}
+
+void
+map_add(cbor_item_t *map, cbor_item_t *key, cbor_item_t *val)
+{
+	assert(key != NULL && val != NULL);
+	assert(cbor_map_add(map, (struct cbor_pair) { key, val }));
+	cbor_decref(&key);
+	cbor_decref(&val);
+}
+
+const cbor_item_t *
+map_get(const cbor_item_t *map, uint8_t key)
+{
+	const struct cbor_pair *p = cbor_map_handle(map);
+
+	for (size_t i = 0; i < cbor_map_size(map); i++)
+		if (cbor_isa_uint(p[i].key) && cbor_get_uint8(p[i].key) == key)
+			return (p[i].value);
+
+	return (NULL);
+}
+
+/* a P-256 COSE key; 'alg' is -(alg + 1) */
+static cbor_item_t *
+cose_key(uint8_t alg)
+{
+	cbor_item_t *m;
+
+	assert((m = cbor_new_definite_map(5)) != NULL);
+	map_add(m, cbor_build_uint8(1), cbor_build_uint8(2));
+	map_add(m, cbor_build_uint8(3), cbor_build_negint8(alg));
+	map_add(m, cbor_build_negint8(0), cbor_build_uint8(1));
+	map_add(m, cbor_build_negint8(1), cbor_build_bytestring(p256_x,
+	    sizeof(p256_x)));
+	map_add(m, cbor_build_negint8(2), cbor_build_bytestring(p256_y,
+	    sizeof(p256_y)));
+
+	return (m);
+}
+
+static cbor_item_t *
+cred_id_map(const unsigned char *id, size_t len)
+{
+	cbor_item_t *m;
+
+	assert((m = cbor_new_definite_map(2)) != NULL);
+	map_add(m, cbor_build_string("id"), cbor_build_bytestring(id, len));
+	map_add(m, cbor_build_string("type"), cbor_build_string("public-key"));
+
+	return (m);
+}
+
+/* reply to CTAPHID_INIT in 'reply', advertising CBOR */
+size_t
+fake_init(unsigned char *reply, const unsigned char *nonce, size_t len)
+{
+	assert(len == 8);
+	memset(reply, 0, 17);
+	memcpy(reply, nonce, len);
+	reply[16] = FIDO_CAP_CBOR;
+
+	return (17);
+}
+
+cbor_item_t *
+fake_client_pin(const cbor_item_t *req)
+{
+	const unsigned char	 token[32] = { 0 };
+	cbor_item_t		*m;
+
+	assert((m = cbor_new_definite_map(1)) != NULL);
+
+	switch (cbor_get_uint8(map_get(req, 2))) {
+	case 2: /* getKeyAgreement */
+		map_add(m, cbor_build_uint8(1), cose_key(24));	/* ECDH-ES+HKDF-256 */
+		break;
+	case 5: /* getPinToken */
+		map_add(m, cbor_build_uint8(2), cbor_build_bytestring(token,
+		    sizeof(token)));
+		rks.ntoken++;
+		break;
+	default:
+		abort();
+	}
+
+	return (m);
+}
+
+static void
+rp_hash(const char *rp_id, unsigned char *dgst)
+{
+	assert(SHA256((const unsigned char *)rp_id, strlen(rp_id), dgst) ==
+	    dgst);
+}
+
+static cbor_item_t *
+fake_rp(bool first)
+{
+	unsigned char	 dgst[32];
+	const char	*rp_id = rks.rp[rks.next++];
+	cbor_item_t	*m, *rp;
+
+	rp_hash(rp_id, dgst);
+	assert((rp = cbor_new_definite_map(1)) != NULL);
+	map_add(rp, cbor_build_string("id"), cbor_build_string(rp_id));
+	assert((m = cbor_new_definite_map(first ? 3 : 2)) != NULL);
+	map_add(m, cbor_build_uint8(3), rp);
+	map_add(m, cbor_build_uint8(4), cbor_build_bytestring(dgst,
+	    sizeof(dgst)));
+	if (first)
+		map_add(m, cbor_build_uint8(5), cbor_build_uint8((uint8_t)
+		    rks.nrp));
+
+	return (m);
+}
+
+static cbor_item_t *
+fake_rk(bool first)
+{
+	const struct fake_cred	*cred = &rks.cred[rks.match[rks.next++]];
+	unsigned char		 key[32];
+	cbor_item_t		*m, *user;
+
+	memset(key, cred->id[0], sizeof(key));
+	assert((user = cbor_new_definite_map(1)) != NULL);
+	map_add(user, cbor_build_string("id"), cbor_build_bytestring(cred->id,
+	    1));
+	assert((m = cbor_new_definite_map(first ? 5 : 4)) != NULL);
+	map_add(m, cbor_build_uint8(6), user);
+	map_add(m, cbor_build_uint8(7), cred_id_map(cred->id,
+	    sizeof(cred->id)));
+	map_add(m, cbor_build_uint8(8), cose_key(6));	/* ES256 */
+	if (first)
+		map_add(m, cbor_build_uint8(9), cbor_build_uint8((uint8_t)
+		    rks.nmatch));
+	map_add(m, cbor_build_uint8(11), cbor_build_bytestring(key,
+	    sizeof(key)));
+
+	return (m);
+}
+
+static cbor_item_t *
+fake_rp_begin(void)
+{
+	size_t j;
+
+	rks.nrp = rks.next = 0;
+	for (size_t i = 0; i < rks.ncred; i++) {
+		for (j = 0; j < rks.nrp; j++)
+			if (strcmp(rks.rp[j], rks.cred[i].rp_id) == 0)
+				break;
+		if (j == rks.nrp)
+			rks.rp[rks.nrp++] = rks.cred[i].rp_id;
+	}
+
+	return (rks.nrp == 0 ? NULL : fake_rp(true));
+}
+
+static cbor_item_t *
+fake_rk_begin(const cbor_item_t *param)
+{
+	const cbor_item_t	*want = map_get(param, 1);
+	unsigned char		 dgst[32];
+
+	rks.nmatch = rks.next = 0;
+	for (size_t i = 0; i < rks.ncred; i++) {
+		rp_hash(rks.cred[i].rp_id, dgst);
+		if (memcmp(cbor_bytestring_handle(want), dgst,
+		    sizeof(dgst)) == 0)
+			rks.match[rks.nmatch++] = i;
+	}
+
+	return (rks.nmatch == 0 ? NULL : fake_rk(true));
+}
+
+/*
+ * The reply to an enumeration subcommand of credential management, or
+ * NULL if there are no credentials to enumerate.
+ */
+cbor_item_t *
+fake_enum(uint8_t subcmd, const cbor_item_t *param)
+{
+	switch (subcmd) {
+	case 2: /* enumerateRPsBegin */
+		return (fake_rp_begin());
+	case 3: /* enumerateRPsGetNextRP */
+		assert(rks.next < rks.nrp);
+		return (fake_rp(false));
+	case 4: /* enumerateCredentialsBegin */
+		return (fake_rk_begin(param));
+	case 5: /* enumerateCredentialsGetNextCredential */
+		assert(rks.next < rks.nmatch);
+		return (fake_rk(false));
+	default:
+		abort();
+	}
+	/* NOTREACHED */
+}
+
+void
+fake_add(const char *rp_id, uint8_t id)
+{
+	assert(rks.ncred < FAKE_MAXCRED);
+	rks.cred[rks.ncred].rp_id = rp_id;
+	memset(rks.cred[rks.ncred].id, id, sizeof(rks.cred[0].id));
+	rks.ncred++;
+}
+
+fido_dev_t *
+open_fake_dev(void)
+{
+	fido_dev_io_t		io_f;
+	fido_dev_transport_t	t;
+	fido_dev_t		*d;
+
+	memset(&io_f, 0, sizeof(io_f));
+	io_f.open = dummy_open;
+	io_f.close = dummy_close;
+	io_f.read = dummy_read;
+	io_f.write = dummy_write;
+	t.rx = fake_rx;
+	t.tx = fake_tx;
+
+	assert((d = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(d, &io_f) == FIDO_OK);
+	assert(fido_dev_set_transport_functions(d, &t) == FIDO_OK);
+	assert(fido_dev_open(d, "fake") == FIDO_OK);
+
+	return (d);
+}
+
+void
+close_fake_dev(fido_dev_t *d)
+{
+	assert(fido_dev_close(d) == FIDO_OK);
+	fido_dev_free(&d);
+	assert(d == NULL);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * A CBOR-level authenticator holding resident credentials, shared by
+ * regress_credman and regress_largeblob. Each test defines fake_tx()
+ * and fake_rx(), which forward PIN and credential management requests
+ * here. PIN tokens are issued without checking the PIN, and auth
+ * parameters are not verified.
+ */
+
+#ifndef _REGRESS_FAKE_CREDMAN_H
+#define _REGRESS_FAKE_CREDMAN_H
+
+#include <cbor.h>
+#include <fido.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FAKE_MAXCRED	25
+
+/*
+ * A resident credential. The first byte of its id is also its user id,
+ * and fills its 32-byte large-blob key.
+ */
+struct fake_cred {
+	const char	*rp_id;
+	unsigned char	 id[16];
+};
+
+struct fake_rks {
+	struct fake_cred	 cred[FAKE_MAXCRED];
+	size_t			 ncred;
+	const char		*rp[FAKE_MAXCRED];	/* enumeration state */
+	size_t			 nrp;
+	size_t			 match[FAKE_MAXCRED];
+	size_t			 nmatch;
+	size_t			 next;
+	size_t			 ntoken;	/* PIN tokens issued */
+};
+
+extern struct fake_rks rks;
+
+int fake_tx(fido_dev_t *, uint8_t, const unsigned char *, size_t);
+int fake_rx(fido_dev_t *, uint8_t, unsigned char *, size_t, int);
+
+void map_add(cbor_item_t *, cbor_item_t *, cbor_item_t *);
+const cbor_item_t *map_get(const cbor_item_t *, uint8_t);
+
+size_t fake_init(unsigned char *, const unsigned char *, size_t);
+cbor_item_t *fake_client_pin(const cbor_item_t *);
+cbor_item_t *fake_enum(uint8_t, const cbor_item_t *);
+void fake_add(const char *, uint8_t);
+
+fido_dev_t *open_fake_dev(void);
+void close_fake_dev(fido_dev_t *);
+
+#endif /* !_REGRESS_FAKE_CREDMAN_H */
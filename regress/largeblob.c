@@ -0,0 +1,834 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <assert.h>
+#include <cbor.h>
+#include <fido.h>
+#include <openssl/sha.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fake_credman.h"
+
+#define MAXARRAY	16384
+#define DIGEST_LEN	16
+
+#define PIN		"1234"
+
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+
+/*
+ * A CBOR-level authenticator exposing a large-blob array, driven through
+ * the transport functions. Writes are committed once the last fragment
+ * and a matching digest have been received. Resident credentials, kept
+ * in rks, can be enumerated for their large-blob keys.
+ */
+static struct {
+	uint16_t	 maxmsgsiz;
+	unsigned char	 reply[MAXARRAY];
+	size_t		 reply_len;
+	unsigned char	 arr[MAXARRAY];	/* committed array */
+	size_t		 arr_len;
+	unsigned char	 pending[MAXARRAY]; /* array being written */
+	size_t		 pending_len;
+	size_t		 nget;		/* reads */
+	size_t		 nget0;		/* reads from offset 0 */
+	size_t		 nset;		/* fragments written */
+	size_t		 nwrite;	/* arrays committed */
+	size_t		 maxget;	/* largest fragment requested */
+	size_t		 maxset;	/* largest fragment written */
+	size_t		 maxreply;	/* largest reply */
+	bool		 fail_get;	/* reads fail */
+	size_t		 fail_set;	/* nth fragment written fails */
+} fake;
+
+static void
+fake_status(uint8_t status)
+{
+	fake.reply[0] = status;
+	fake.reply_len = 1;
+}
+
+/*
+ * Reply with a successful status and the map 'item', which is consumed.
+ * A NULL 'item' from fake_enum() means there are no credentials.
+ */
+static void
+fake_reply(cbor_item_t *item)
+{
+	unsigned char	*ptr = NULL;
+	size_t		 len, alloc;
+
+	if (item == NULL) {
+		fake_status(0x2e); /* CTAP2_ERR_NO_CREDENTIALS */
+		return;
+	}
+
+	assert((len = cbor_serialize_alloc(item, &ptr, &alloc)) != 0);
+	assert(len < sizeof(fake.reply));
+	fake.reply[0] = 0x00;
+	memcpy(&fake.reply[1], ptr, len);
+	fake.reply_len = len + 1;
+	free(ptr);
+	cbor_decref(&item);
+}
+
+static void
+array_push(cbor_item_t *array, cbor_item_t *item)
+{
+	assert(item != NULL);
+	assert(cbor_array_push(array, item));
+	cbor_decref(&item);
+}
+
+/* versions: FIDO_2_1; maxMsgSize; pinProtocols: 1 */
+static void
+fake_info(void)
+{
+	cbor_item_t *m, *v, *p;
+
+	assert((m = cbor_new_definite_map(3)) != NULL);
+	assert((v = cbor_new_definite_array(1)) != NULL);
+	assert((p = cbor_new_definite_array(1)) != NULL);
+	array_push(v, cbor_build_string("FIDO_2_1"));
+	array_push(p, cbor_build_uint8(1));
+	map_add(m, cbor_build_uint8(1), v);
+	map_add(m, cbor_build_uint8(5), cbor_build_uint16(fake.maxmsgsiz));
+	map_add(m, cbor_build_uint8(6), p);
+	fake_reply(m);
+}
+
+static void
+fake_get(size_t count, size_t offset)
+{
+	cbor_item_t	*m;
+	size_t		 len;
+
+	fake.nget++;
+	if (offset == 0)
+		fake.nget0++;
+	if (count > fake.maxget)
+		fake.maxget = count;
+
+	if (fake.fail_get) {
+		fake_status(0x33); /* CTAP2_ERR_PIN_AUTH_INVALID */
+		return;
+	}
+	if (offset > fake.arr_len) {
+		fake_status(0x02); /* CTAP1_ERR_INVALID_PARAMETER */
+		return;
+	}
+
+	len = fake.arr_len - offset < count ? fake.arr_len - offset : count;
+	assert((m = cbor_new_definite_map(1)) != NULL);
+	map_add(m, cbor_build_uint8(1), cbor_build_bytestring(fake.arr +
+	    offset, len));
+	fake_reply(m);
+}
+
+static void
+fake_set(const cbor_item_t *frag, size_t offset, const cbor_item_t *length)
+{
+	unsigned char	dgst[SHA256_DIGEST_LENGTH];
+	size_t		len = cbor_bytestring_length(frag);
+
+	fake.nset++;
+	if (len > fake.maxset)
+		fake.maxset = len;
+
+	if (fake.nset == fake.fail_set) {
+		fake_status(0x33); /* CTAP2_ERR_PIN_AUTH_INVALID */
+		return;
+	}
+
+	if (offset == 0) {
+		assert(length != NULL);
+		fake.pending_len = cbor_get_int(length);
+		assert(fake.pending_len <= sizeof(fake.pending));
+	}
+	assert(offset + len <= fake.pending_len);
+	memcpy(fake.pending + offset, cbor_bytestring_handle(frag), len);
+
+	if (offset + len == fake.pending_len) {
+		assert(fake.pending_len > DIGEST_LEN);
+		SHA256(fake.pending, fake.pending_len - DIGEST_LEN, dgst);
+		assert(memcmp(dgst, fake.pending + fake.pending_len -
+		    DIGEST_LEN, DIGEST_LEN) == 0);
+		memcpy(fake.arr, fake.pending, fake.pending_len);
+		fake.arr_len = fake.pending_len;
+		fake.nwrite++;
+	}
+
+	fake_status(0x00);
+}
+
+static void
+fake_largeblob(const cbor_item_t *req)
+{
+	const cbor_item_t	*get, *set, *offset;
+
+	get = map_get(req, 1);
+	set = map_get(req, 2);
+	assert((offset = map_get(req, 3)) != NULL);
+	assert((get == NULL) != (set == NULL));
+
+	if (get != NULL)
+		fake_get(cbor_get_int(get), cbor_get_int(offset));
+	else
+		fake_set(set, cbor_get_int(offset), map_get(req, 4));
+}
+
+int
+fake_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	struct cbor_load_result	 res;
+	cbor_item_t		*req;
+
+	(void)d;
+
+	if (cmd == CTAP_CMD_INIT) {
+		fake.reply_len = fake_init(fake.reply, buf, len);
+		return ((int)len);
+	}
+
+	assert(cmd == CTAP_CMD_CBOR && len > 0);
+
+	if (buf[0] == CTAP_CBOR_GETINFO) {
+		fake_info();
+		return ((int)len);
+	}
+
+	assert((req = cbor_load(buf + 1, len - 1, &res)) != NULL);
+
+	switch (buf[0]) {
+	case CTAP_CBOR_LARGEBLOB:
+		fake_largeblob(req);
+		break;
+	case CTAP_CBOR_CLIENT_PIN:
+		fake_reply(fake_client_pin(req));
+		break;
+	case CTAP_CBOR_CRED_MGMT_PRE:
+		fake_reply(fake_enum(cbor_get_uint8(map_get(req, 1)),
+		    map_get(req, 2)));
+		break;
+	default:
+		abort();
+	}
+
+	cbor_decref(&req);
+
+	return ((int)len);
+}
+
+int
+fake_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	(void)d;
+	(void)cmd;
+	(void)ms;
+
+	assert(fake.reply_len <= len);
+	memcpy(buf, fake.reply, fake.reply_len);
+	if (fake.reply_len > fake.maxreply)
+		fake.maxreply = fake.reply_len;
+
+	return ((int)fake.reply_len);
+}
+
+/* an empty array, as shipped */
+static void
+fake_setup(uint16_t maxmsgsiz)
+{
+	unsigned char dgst[SHA256_DIGEST_LENGTH];
+
+	memset(&fake, 0, sizeof(fake));
+	memset(&rks, 0, sizeof(rks));
+	fake.maxmsgsiz = maxmsgsiz;
+	fake.arr[0] = 0x80;
+	SHA256(fake.arr, 1, dgst);
+	memcpy(&fake.arr[1], dgst, DIGEST_LEN);
+	fake.arr_len = 1 + DIGEST_LEN;
+}
+
+static void
+fake_clear_counters(void)
+{
+	fake.nget = 0;
+	fake.nget0 = 0;
+	fake.nset = 0;
+	fake.nwrite = 0;
+	fake.maxget = 0;
+	fake.maxset = 0;
+	fake.maxreply = 0;
+	rks.ntoken = 0;
+}
+
+static void
+mkkey(unsigned char *key, uint8_t n)
+{
+	memset(key, n, 32);
+}
+
+/* 'len' bytes that do not compress */
+static fido_blob_t *
+mkblob(uint8_t seed, size_t len)
+{
+	fido_blob_t	*b;
+	unsigned char	*p;
+	uint32_t	 x = seed;
+
+	assert((p = malloc(len)) != NULL);
+	for (size_t i = 0; i < len; i++) {
+		x = x * 1103515245 + 12345;
+		p[i] = (unsigned char)(x >> 16);
+	}
+	assert((b = fido_blob_new()) != NULL);
+	assert(fido_blob_set(b, p, len) == FIDO_OK);
+	free(p);
+
+	return (b);
+}
+
+static void
+put(fido_dev_t *d, uint8_t k, uint8_t seed, size_t len)
+{
+	unsigned char	 key[32];
+	fido_blob_t	*b;
+
+	mkkey(key, k);
+	b = mkblob(seed, len);
+	assert(fido_dev_largeblob_put(d, key, sizeof(key), b, NULL) == FIDO_OK);
+	fido_blob_free(&b);
+}
+
+/* check that key 'k' opens the blob made from 'seed' */
+static void
+check(fido_dev_t *d, uint8_t k, uint8_t seed, size_t len)
+{
+	unsigned char	 key[32];
+	fido_blob_t	*b, *out;
+
+	mkkey(key, k);
+	b = mkblob(seed, len);
+	assert((out = fido_blob_new()) != NULL);
+	assert(fido_dev_largeblob_get(d, key, sizeof(key), out) == FIDO_OK);
+	assert(fido_blob_len(out) == len);
+	assert(memcmp(fido_blob_ptr(out), fido_blob_ptr(b), len) == 0);
+	fido_blob_free(&out);
+	fido_blob_free(&b);
+}
+
+static void
+check_missing(fido_dev_t *d, uint8_t k)
+{
+	unsigned char	 key[32];
+	fido_blob_t	*out;
+
+	mkkey(key, k);
+	assert((out = fido_blob_new()) != NULL);
+	assert(fido_dev_largeblob_get(d, key, sizeof(key),
+	    out) == FIDO_ERR_NOTFOUND);
+	fido_blob_free(&out);
+}
+
+static void
+batch_put(fido_largeblob_batch_t *b, uint8_t k, uint8_t seed, size_t len)
+{
+	unsigned char	 key[32];
+	fido_blob_t	*blob;
+
+	mkkey(key, k);
+	blob = mkblob(seed, len);
+	assert(fido_largeblob_batch_put(b, key, sizeof(key), blob) == FIDO_OK);
+	fido_blob_free(&blob);
+}
+
+static void
+batch_remove(fido_largeblob_batch_t *b, uint8_t k)
+{
+	unsigned char key[32];
+
+	mkkey(key, k);
+	assert(fido_largeblob_batch_remove(b, key, sizeof(key)) == FIDO_OK);
+}
+
+static void
+batch_order(void)
+{
+	fido_largeblob_batch_t	*b;
+	fido_dev_t		*d;
+
+	fake_setup(1200);
+	d = open_fake_dev();
+	put(d, 4, 40, 100);
+
+	/* later operations on a key override earlier ones */
+	assert((b = fido_largeblob_batch_new()) != NULL);
+	batch_put(b, 1, 10, 100);
+	batch_put(b, 2, 20, 100);
+	batch_remove(b, 1);
+	batch_put(b, 3, 30, 100);
+	batch_put(b, 2, 21, 200);
+	batch_remove(b, 4);
+	batch_remove(b, 5);
+	assert(fido_largeblob_batch_count(b) == 7);
+
+	/* one read, one write */
+	fake_clear_counters();
+	assert(fido_dev_largeblob_batch(d, b, NULL) == FIDO_OK);
+	assert(fake.nget0 == 1);
+	assert(fake.nwrite == 1);
+	fido_largeblob_batch_free(&b);
+	assert(b == NULL);
+
+	check_missing(d, 1);
+	check(d, 2, 21, 200);
+	check(d, 3, 30, 100);
+	check_missing(d, 4);
+
+	close_fake_dev(d);
+}
+
+static void
+batch_failure(void)
+{
+	fido_largeblob_batch_t	*b;
+	fido_dev_t		*d;
+
+	fake_setup(1200);
+	d = open_fake_dev();
+	assert(fido_dev_largeblob_set_cache(d, true) == FIDO_OK);
+	put(d, 1, 10, 100);
+
+	/* a cached array is checked by reading its digest only */
+	fake_clear_counters();
+	check(d, 1, 10, 100);
+	assert(fake.nget == 1 && fake.nget0 == 0);
+
+	assert((b = fido_largeblob_batch_new()) != NULL);
+	batch_put(b, 2, 20, 100);
+	batch_remove(b, 1);
+
+	/* a failed read writes nothing */
+	fake.fail_get = true;
+	fake_clear_counters();
+	assert(fido_dev_largeblob_batch(d, b, NULL) != FIDO_OK);
+	assert(fake.nset == 0);
+	fake.fail_get = false;
+
+	/* a rejected write leaves the array alone and empties the cache */
+	check(d, 1, 10, 100);
+	fake.fail_set = 1;
+	fake_clear_counters();
+	assert(fido_dev_largeblob_batch(d, b, NULL) ==
+	    FIDO_ERR_PIN_AUTH_INVALID);
+	assert(fake.nset == 1 && fake.nwrite == 0);
+	fake.fail_set = 0;
+
+	fake_clear_counters();
+	check(d, 1, 10, 100);
+	assert(fake.nget0 == 1);
+	check_missing(d, 2);
+
+	/* once written, the batch is visible through the cache */
+	fake_clear_counters();
+	assert(fido_dev_largeblob_batch(d, b, NULL) == FIDO_OK);
+	assert(fake.nwrite == 1);
+	fake_clear_counters();
+	check(d, 2, 20, 100);
+	check_missing(d, 1);
+	assert(fake.nget0 == 0);
+
+	fido_largeblob_batch_free(&b);
+	close_fake_dev(d);
+}
+
+/*
+ * Fragments are sized to the authenticator's maxMsgSize, including past
+ * FIDO_MAXMSG, and replies are received whole.
+ */
+static void
+fragments(void)
+{
+	const uint16_t	 maxmsgsiz[] = { 128, 1200, 4096 };
+	size_t		 maxlen;
+	fido_dev_t	*d;
+
+	for (size_t i = 0; i < nitems(maxmsgsiz); i++) {
+		fake_setup(maxmsgsiz[i]);
+		maxlen = maxmsgsiz[i] - 64;
+		d = open_fake_dev();
+
+		fake_clear_counters();
+		put(d, 1, 10, 6000);
+		assert(fake.maxget == maxlen);
+		assert(fake.maxset == maxlen);
+		assert(fake.nset == (fake.arr_len + maxlen - 1) / maxlen);
+
+		fake_clear_counters();
+		check(d, 1, 10, 6000);
+		assert(fake.maxget == maxlen);
+		assert(fake.nget == fake.arr_len / maxlen + 1);
+		if (maxlen > FIDO_MAXMSG)
+			assert(fake.maxreply > FIDO_MAXMSG);
+
+		close_fake_dev(d);
+	}
+}
+
+/*
+ * The digest is checked across fragment boundaries, wherever it falls,
+ * and an array that does not match it reads as empty.
+ */
+static void
+digest(void)
+{
+	fido_dev_t	*d;
+	size_t		 len;
+
+	fake_setup(128);
+	d = open_fake_dev();
+
+	for (len = 1000; len < 1000 + 64; len++) {
+		put(d, 1, 10, len);
+		check(d, 1, 10, len);
+	}
+
+	fake.arr[fake.arr_len - 1] ^= 0x01;
+	check_missing(d, 1);
+	fake.arr[fake.arr_len - 1] ^= 0x01;
+	check(d, 1, 10, len - 1);
+
+	fake.arr[fake.arr_len / 2] ^= 0x01;
+	check_missing(d, 1);
+	fake.arr[fake.arr_len / 2] ^= 0x01;
+
+	fake.arr_len--;
+	check_missing(d, 1);
+	fake.arr_len = DIGEST_LEN;
+	check_missing(d, 1);
+
+	close_fake_dev(d);
+}
+
+/*
+ * A cached array is revalidated by reading its digest, and downloaded
+ * again once another handle has changed it.
+ */
+static void
+cache(void)
+{
+	fido_dev_t *d1, *d2;
+
+	fake_setup(128);
+	d1 = open_fake_dev();
+	d2 = open_fake_dev();
+	assert(fido_dev_largeblob_set_cache(d1, true) == FIDO_OK);
+	put(d1, 1, 10, 1000);
+
+	fake_clear_counters();
+	check(d1, 1, 10, 1000);
+	check(d1, 1, 10, 1000);
+	assert(fake.nget == 2 && fake.nget0 == 0);
+	assert(fake.maxreply < 64);
+
+	/* same length, different contents */
+	put(d2, 1, 11, 1000);
+	fake_clear_counters();
+	check(d1, 1, 11, 1000);
+	assert(fake.nget0 == 1);
+	fake_clear_counters();
+	check(d1, 1, 11, 1000);
+	assert(fake.nget == 1 && fake.nget0 == 0);
+
+	/* shorter: the digest offset is past the end of the array */
+	put(d2, 1, 12, 100);
+	fake_clear_counters();
+	check(d1, 1, 12, 100);
+	assert(fake.nget0 == 1);
+
+	/* disabling the cache reads the whole array again */
+	assert(fido_dev_largeblob_set_cache(d1, false) == FIDO_OK);
+	fake_clear_counters();
+	check(d1, 1, 12, 100);
+	assert(fake.nget0 == 1);
+
+	close_fake_dev(d2);
+	close_fake_dev(d1);
+}
+
+/*
+ * Entries known to open with a key follow the array as entries are
+ * replaced, removed and appended.
+ */
+static void
+key_index(void)
+{
+	fido_largeblob_batch_t	*b;
+	fido_dev_t		*d;
+	unsigned char		 key[32];
+
+	fake_setup(1200);
+	d = open_fake_dev();
+	assert(fido_dev_largeblob_set_cache(d, true) == FIDO_OK);
+
+	for (uint8_t k = 1; k <= 6; k++)
+		put(d, k, (uint8_t)(k * 10), 100);
+	for (uint8_t k = 1; k <= 6; k++)
+		check(d, k, (uint8_t)(k * 10), 100);
+
+	mkkey(key, 2);
+	assert(fido_dev_largeblob_remove(d, key, sizeof(key),
+	    NULL) == FIDO_OK);
+	check_missing(d, 2);
+	for (uint8_t k = 3; k <= 6; k++)
+		check(d, k, (uint8_t)(k * 10), 100);
+
+	put(d, 4, 41, 100);
+	put(d, 2, 21, 100);
+	check(d, 2, 21, 100);
+	check(d, 4, 41, 100);
+
+	assert((b = fido_largeblob_batch_new()) != NULL);
+	batch_remove(b, 1);
+	batch_remove(b, 3);
+	batch_put(b, 7, 70, 100);
+	batch_put(b, 5, 51, 100);
+	assert(fido_dev_largeblob_batch(d, b, NULL) == FIDO_OK);
+	fido_largeblob_batch_free(&b);
+
+	check_missing(d, 1);
+	check(d, 2, 21, 100);
+	check_missing(d, 3);
+	check(d, 4, 41, 100);
+	check(d, 5, 51, 100);
+	check(d, 6, 60, 100);
+	check(d, 7, 70, 100);
+	check_missing(d, 8);
+
+	/* the same array, read without the cache */
+	assert(fido_dev_largeblob_set_cache(d, false) == FIDO_OK);
+	check(d, 2, 21, 100);
+	check(d, 7, 70, 100);
+	check_missing(d, 3);
+
+	close_fake_dev(d);
+}
+
+/* check the original sizes of the array's entries, in order */
+static void
+check_order(const size_t *sz, size_t n)
+{
+	struct cbor_load_result	 res;
+	cbor_item_t		*arr;
+	const cbor_item_t	*v;
+
+	assert((arr = cbor_load(fake.arr, fake.arr_len - DIGEST_LEN,
+	    &res)) != NULL);
+	assert(cbor_isa_array(arr) && cbor_array_size(arr) == n);
+	for (size_t i = 0; i < n; i++) {
+		assert((v = map_get(cbor_array_handle(arr)[i], 3)) != NULL);
+		assert(cbor_get_int(v) == sz[i]);
+	}
+	cbor_decref(&arr);
+}
+
+/*
+ * Trimming keeps the entries opened by a resident credential's key, in
+ * their original order, and drops the rest.
+ */
+static void
+trim(void)
+{
+	const size_t	 kept[] = { 100, 120, 140 };
+	const size_t	 left[] = { 100, 140 };
+	fido_dev_t	*d;
+
+	for (int cached = 0; cached < 2; cached++) {
+		fake_setup(1200);
+		fake_add("a.example", 1);
+		fake_add("b.example", 2);
+		fake_add("a.example", 3);
+		d = open_fake_dev();
+		assert(fido_dev_largeblob_set_cache(d, cached) == FIDO_OK);
+
+		put(d, 1, 10, 100);
+		put(d, 4, 40, 110);
+		put(d, 2, 20, 120);
+		put(d, 5, 50, 130);
+		put(d, 3, 30, 140);
+
+		/* one token to walk the credentials, and one to write */
+		fake_clear_counters();
+		assert(fido_dev_largeblob_trim(d, PIN) == FIDO_OK);
+		assert(fake.nwrite == 1);
+		assert(rks.ntoken == 2);
+		check_order(kept, nitems(kept));
+		check(d, 1, 10, 100);
+		check(d, 2, 20, 120);
+		check(d, 3, 30, 140);
+		check_missing(d, 4);
+		check_missing(d, 5);
+
+		/* a credential deleted elsewhere loses its blob */
+		rks.cred[1] = rks.cred[--rks.ncred];
+		assert(fido_dev_largeblob_trim(d, PIN) == FIDO_OK);
+		check_order(left, nitems(left));
+		check(d, 1, 10, 100);
+		check_missing(d, 2);
+		check(d, 3, 30, 140);
+
+		close_fake_dev(d);
+	}
+}
+
+/*
+ * Without resident credentials, trimming empties the array, and with it
+ * the index of the entries opened by each key.
+ */
+static void
+trim_empty(void)
+{
+	fido_dev_t	*d;
+
+	fake_setup(1200);
+	d = open_fake_dev();
+	assert(fido_dev_largeblob_set_cache(d, true) == FIDO_OK);
+
+	put(d, 4, 40, 110);
+	put(d, 5, 50, 130);
+
+	assert(fido_dev_largeblob_trim(d, PIN) == FIDO_OK);
+	check_order(NULL, 0);
+	check_missing(d, 4);
+	check_missing(d, 5);
+
+	put(d, 5, 51, 150);
+	put(d, 4, 41, 120);
+	check(d, 5, 51, 150);
+	check(d, 4, 41, 120);
+
+	close_fake_dev(d);
+}
+
+/* 'len' bytes of text that compress well, like a PEM certificate */
+static fido_blob_t *
+mktext(size_t len)
+{
+	const char	 b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			    "abcdefghijklmnopqrstuvwxyz0123456789+/";
+	fido_blob_t	*b;
+	unsigned char	*p;
+
+	assert((p = malloc(len)) != NULL);
+	for (size_t i = 0; i < len; i++)
+		p[i] = i % 65 == 64 ? '\n' : (unsigned char)b64[(i * 7) % 64];
+	assert((b = fido_blob_new()) != NULL);
+	assert(fido_blob_set(b, p, len) == FIDO_OK);
+	free(p);
+
+	return (b);
+}
+
+/*
+ * Payloads are restored to their original size whatever the window
+ * chosen to compress them, for payloads of up to about 1 MiB.
+ */
+static void
+payload_sizes(void)
+{
+	const size_t	 len[] = { 1, 64, 511, 512, 513, 1024, 4096, 16384,
+			    32769, 65536, 1000 * 1000 };
+	unsigned char	 key[32];
+	fido_blob_t	*b, *out;
+	fido_dev_t	*d;
+
+	fake_setup(1200);
+	d = open_fake_dev();
+	mkkey(key, 1);
+
+	for (size_t i = 0; i < nitems(len); i++) {
+		b = mktext(len[i]);
+		assert(fido_dev_largeblob_put(d, key, sizeof(key), b,
+		    NULL) == FIDO_OK);
+		assert(fake.arr_len < len[i] / 2 + 256);
+		assert((out = fido_blob_new()) != NULL);
+		assert(fido_dev_largeblob_get(d, key, sizeof(key),
+		    out) == FIDO_OK);
+		assert(fido_blob_len(out) == len[i]);
+		assert(memcmp(fido_blob_ptr(out), fido_blob_ptr(b),
+		    len[i]) == 0);
+		fido_blob_free(&out);
+		fido_blob_free(&b);
+	}
+
+	/* too large to compress; nothing is written */
+	b = mktext(1024 * 1024 + 1);
+	fake_clear_counters();
+	assert(fido_dev_largeblob_put(d, key, sizeof(key), b,
+	    NULL) != FIDO_OK);
+	assert(fake.nset == 0);
+	fido_blob_free(&b);
+
+	close_fake_dev(d);
+}
+
+/*
+ * A maxMsgSize that leaves no room for a fragment fails without any
+ * traffic; one byte of room still works, digest included.
+ */
+static void
+small_maxmsgsiz(void)
+{
+	const uint16_t	 maxmsgsiz[] = { 0, 64 };
+	unsigned char	 key[32];
+	fido_blob_t	*b;
+	fido_dev_t	*d;
+
+	mkkey(key, 1);
+
+	for (size_t i = 0; i < nitems(maxmsgsiz); i++) {
+		fake_setup(maxmsgsiz[i]);
+		d = open_fake_dev();
+		b = mkblob(10, 100);
+		assert((fido_dev_largeblob_put(d, key, sizeof(key), b,
+		    NULL)) != FIDO_OK);
+		assert(fido_dev_largeblob_get(d, key, sizeof(key),
+		    b) != FIDO_OK);
+		assert(fake.nget == 0 && fake.nset == 0);
+		fido_blob_free(&b);
+		close_fake_dev(d);
+	}
+
+	fake_setup(65);
+	d = open_fake_dev();
+	put(d, 1, 10, 100);
+	assert(fake.maxget == 1 && fake.maxset == 1);
+	assert(fake.nset == fake.arr_len);
+	check(d, 1, 10, 100);
+	close_fake_dev(d);
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	batch_order();
+	batch_failure();
+	fragments();
+	digest();
+	cache();
+	key_index();
+	trim();
+	trim_empty();
+	payload_sizes();
+	small_maxmsgsiz();
+
+	exit(0);
+}
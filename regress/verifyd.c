@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <openssl/evp.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "vectors.h"
+
+static const unsigned char es256_pk[64] = {
+	REGRESS_ASSERT_ES256_PK,
+};
+
+static const unsigned char cdh[32] = {
+	REGRESS_ASSERT_CDH,
+};
+
+static const unsigned char authdata[39] = {
+	REGRESS_ASSERT_AUTHDATA,
+};
+
+static const unsigned char sig[72] = {
+	REGRESS_ASSERT_SIG,
+};
+
+static char	 dir[] = "/tmp/regress_verifyd.XXXXXXXX";
+static char	 path[sizeof(dir) + 8];
+static pid_t	 pid;
+
+/* don't leave the daemon behind if a check fails */
+static void
+sigabrt(int signo)
+{
+	(void)signo;
+
+	if (pid > 0)
+		kill(pid, SIGTERM);
+}
+
+static void
+start_daemon(const char *verifyd)
+{
+	const struct timespec ts = { 0, 10 * 1000 * 1000 };
+	struct stat st;
+
+	assert(mkdtemp(dir) != NULL);
+	assert((size_t)snprintf(path, sizeof(path), "%s/sock", dir) <
+	    sizeof(path));
+
+	assert((pid = fork()) != -1);
+	if (pid == 0) {
+		/* the socket's mode must not depend on the umask */
+		umask(0);
+		execl(verifyd, verifyd, path, (char *)NULL);
+		_exit(127);
+	}
+	signal(SIGABRT, sigabrt);
+
+	for (int i = 0; i < 500 && stat(path, &st) < 0; i++)
+		assert(nanosleep(&ts, NULL) == 0);
+
+	assert(stat(path, &st) == 0);
+	assert(S_ISSOCK(st.st_mode));
+	assert((st.st_mode & 0777) == 0600);
+}
+
+static void
+stop_daemon(void)
+{
+	struct stat st;
+	int status;
+
+	assert(kill(pid, SIGTERM) == 0);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	assert(stat(path, &st) < 0 && errno == ENOENT);
+	assert(rmdir(dir) == 0);
+}
+
+static void
+connect_daemon(FILE **in, FILE **out)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	assert(strlen(path) < sizeof(addr.sun_path));
+	memcpy(addr.sun_path, path, strlen(path));
+
+	assert((fd = socket(AF_UNIX, SOCK_STREAM, 0)) >= 0);
+	assert(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert((*in = fdopen(fd, "r")) != NULL);
+	assert((fd = dup(fd)) >= 0);
+	assert((*out = fdopen(fd, "w")) != NULL);
+}
+
+static void
+put_base64(FILE *f, const unsigned char *ptr, size_t len)
+{
+	unsigned char b64[256];
+
+	assert(len <= 3 * (sizeof(b64) / 4) - 3);
+	EVP_EncodeBlock(b64, ptr, (int)len);
+	assert(fprintf(f, "%s\n", b64) > 0);
+}
+
+static void
+put_assert(FILE *f, const unsigned char *s, size_t s_len)
+{
+	assert(fprintf(f, "assert es256\n") > 0);
+	put_base64(f, es256_pk, sizeof(es256_pk));
+	put_base64(f, cdh, sizeof(cdh));
+	assert(fprintf(f, "localhost\n") > 0);
+	put_base64(f, authdata, sizeof(authdata));
+	put_base64(f, s, s_len);
+	assert(fflush(f) == 0);
+}
+
+static void
+expect(FILE *f, const char *want)
+{
+	char line[128];
+
+	assert(fgets(line, sizeof(line), f) != NULL);
+	line[strcspn(line, "\n")] = '\0';
+	if (strcmp(line, want) != 0) {
+		fprintf(stderr, "got \"%s\", want \"%s\"\n", line, want);
+		abort();
+	}
+}
+
+/*
+ * Check the counters at the start of a stats response, then skip the
+ * latency histogram.
+ */
+static void
+expect_stats(FILE *in, FILE *out, const char *requests, const char *failed,
+    const char *keys)
+{
+	char line[128];
+
+	assert(fprintf(out, "stats\n") > 0 && fflush(out) == 0);
+	expect(in, requests);
+	expect(in, failed);
+	expect(in, "workers 4");
+	expect(in, "connections 1");
+	expect(in, "queue 0");
+	expect(in, keys);
+	expect(in, "evicted 0");
+	do {
+		assert(fgets(line, sizeof(line), in) != NULL);
+		assert(strcmp(line, "\n") == 0 ||
+		    strncmp(line, "latency_us ", 11) == 0);
+	} while (strcmp(line, "\n") != 0);
+}
+
+static void
+serve(void)
+{
+	unsigned char bad_sig[sizeof(sig)];
+	FILE *in, *out;
+
+	memcpy(bad_sig, sig, sizeof(sig));
+	bad_sig[sizeof(bad_sig) - 1] ^= 1;
+
+	connect_daemon(&in, &out);
+
+	/* a key that fails to verify is not cached */
+	put_assert(out, bad_sig, sizeof(bad_sig));
+	expect(in, "FIDO_ERR_INVALID_SIG");
+	expect_stats(in, out, "requests 1", "failed 1", "keys 0");
+
+	put_assert(out, sig, sizeof(sig));
+	expect(in, "FIDO_ERR_SUCCESS");
+	expect_stats(in, out, "requests 2", "failed 1", "keys 1");
+
+	put_assert(out, sig, sizeof(sig));
+	expect(in, "FIDO_ERR_SUCCESS");
+	expect_stats(in, out, "requests 3", "failed 1", "keys 1");
+
+	/* a malformed request is rejected, and the connection closed */
+	assert(fprintf(out, "verify es256\n") > 0 && fflush(out) == 0);
+	expect(in, "error");
+	assert(fgetc(in) == EOF);
+
+	fclose(in);
+	fclose(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2) {
+		fprintf(stderr, "usage: regress_verifyd fido2-verifyd\n");
+		exit(1);
+	}
+
+	start_daemon(argv[1]);
+	serve();
+	stop_daemon();
+
+	exit(0);
+}
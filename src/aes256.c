@@ -7,8 +7,8 @@
 #include "fido.h"
 
 static int
-aes256_cbc(const fido_blob_t *key, const u_char *iv, const fido_blob_t *in,
-    fido_blob_t *out, int encrypt)
+aes256_cbc(const fido_dev_t *dev, const fido_blob_t *key, const u_char *iv,
+    const fido_blob_t *in, fido_blob_t *out, int encrypt)
 {
 	EVP_CIPHER_CTX *ctx = NULL;
 	const EVP_CIPHER *cipher;
@@ -21,8 +21,8 @@ aes256_cbc(const fido_blob_t *key, const u_char *iv, const fido_blob_t *in,
 		goto fail;
 	}
 	out->len = in->len;
-	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
-	    (cipher = EVP_aes_256_cbc()) == NULL ||
+	if ((ctx = fido_crypto_cipher_ctx(dev)) == NULL ||
+	    (cipher = fido_crypto_aes_256_cbc(dev)) == NULL ||
 	    EVP_CipherInit(ctx, cipher, key->ptr, iv, encrypt) == 0 ||
 	    EVP_Cipher(ctx, out->ptr, in->ptr, (u_int)out->len) < 0) {
 		fido_log_debug("%s: EVP_Cipher", __func__);
@@ -31,8 +31,7 @@ aes256_cbc(const fido_blob_t *key, const u_char *iv, const fido_blob_t *in,
 
 	ok = 0;
 fail:
-	if (ctx != NULL)
-		EVP_CIPHER_CTX_free(ctx);
+	fido_crypto_cipher_ctx_done(dev, ctx);
 	if (ok < 0)
 		fido_blob_reset(out);
 
@@ -40,19 +39,19 @@ fail:
 }
 
 static int
-aes256_cbc_proto1(const fido_blob_t *key, const fido_blob_t *in,
-    fido_blob_t *out, int encrypt)
+aes256_cbc_proto1(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *in, fido_blob_t *out, int encrypt)
 {
 	u_char iv[16];
 
 	memset(&iv, 0, sizeof(iv));
 
-	return aes256_cbc(key, iv, in, out, encrypt);
+	return aes256_cbc(dev, key, iv, in, out, encrypt);
 }
 
 static int
-aes256_cbc_fips(const fido_blob_t *secret, const fido_blob_t *in,
-    fido_blob_t *out, int encrypt)
+aes256_cbc_fips(const fido_dev_t *dev, const fido_blob_t *secret,
+    const fido_blob_t *in, fido_blob_t *out, int encrypt)
 {
 	fido_blob_t key, cin, cout;
 	u_char iv[16];
@@ -75,7 +74,7 @@ aes256_cbc_fips(const fido_blob_t *secret, const fido_blob_t *in,
 	}
 	key.ptr = secret->ptr + 32;
 	key.len = secret->len - 32;
-	if (aes256_cbc(&key, iv, &cin, &cout, encrypt) < 0)
+	if (aes256_cbc(dev, &key, iv, &cin, &cout, encrypt) < 0)
 		return -1;
 	if (encrypt) {
 		if (cout.len > SIZE_MAX - sizeof(iv) ||
@@ -94,24 +93,41 @@ aes256_cbc_fips(const fido_blob_t *secret, const fido_blob_t *in,
 }
 
 static int
-aes256_gcm(const fido_blob_t *key, const fido_blob_t *nonce,
-    const fido_blob_t *aad, const fido_blob_t *in, fido_blob_t *out,
-    int encrypt)
+aes256_gcm(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *nonce, const fido_blob_t *aad, const fido_blob_t *in,
+    fido_blob_t *out, int encrypt)
 {
 	EVP_CIPHER_CTX *ctx = NULL;
 	const EVP_CIPHER *cipher;
+	size_t textlen, outlen;
+	int reuse = 0;
 	int ok = -1;
 
-	memset(out, 0, sizeof(*out));
 	if (nonce->len != 12 || key->len != 32 || aad->len > UINT_MAX ||
-	    in->len > UINT_MAX || in->len % 16 || in->len < 16 ||
-	    (out->ptr = calloc(1, in->len)) == NULL) {
+	    in->len > UINT_MAX - 16 || (!encrypt && in->len < 16)) {
 		fido_log_debug("%s: invalid param", __func__);
 		goto fail;
 	}
-	out->len = in->len;
-	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
-	    (cipher = EVP_aes_256_gcm()) == NULL ||
+	/* append the tag on encrypt; strip it on decrypt */
+	textlen = encrypt ? in->len : in->len - 16;
+	outlen = encrypt ? in->len + 16 : in->len - 16;
+	/*
+	 * A buffer of the right size left in out by a previous call, e.g.
+	 * when trying several keys on one ciphertext, is reused; on failure
+	 * it is zeroed, but kept.
+	 */
+	if (out->ptr != NULL && out->len == outlen)
+		reuse = 1;
+	else {
+		fido_blob_reset(out);
+		if ((out->ptr = calloc(1, in->len + 16)) == NULL) {
+			fido_log_debug("%s: calloc", __func__);
+			goto fail;
+		}
+		out->len = outlen;
+	}
+	if ((ctx = fido_crypto_cipher_ctx(dev)) == NULL ||
+	    (cipher = fido_crypto_aes_256_gcm(dev)) == NULL ||
 	    EVP_CipherInit(ctx, cipher, key->ptr, nonce->ptr, encrypt) == 0) {
 		fido_log_debug("%s: EVP_CipherInit", __func__);
 		goto fail;
@@ -122,7 +138,7 @@ aes256_gcm(const fido_blob_t *key, const fido_blob_t *nonce,
 		goto fail;
 	}
 	if (EVP_Cipher(ctx, NULL, aad->ptr, (u_int)aad->len) < 0 ||
-	    EVP_Cipher(ctx, out->ptr, in->ptr, (u_int)(in->len - 16)) < 0 ||
+	    EVP_Cipher(ctx, out->ptr, in->ptr, (u_int)textlen) < 0 ||
 	    EVP_Cipher(ctx, NULL, NULL, 0) < 0) {
 		fido_log_debug("%s: EVP_Cipher", __func__);
 		goto fail;
@@ -135,9 +151,10 @@ aes256_gcm(const fido_blob_t *key, const fido_blob_t *nonce,
 
 	ok = 0;
 fail:
-	if (ctx != NULL)
-		EVP_CIPHER_CTX_free(ctx);
-	if (ok < 0)
+	fido_crypto_cipher_ctx_done(dev, ctx);
+	if (ok < 0 && reuse)
+		explicit_bzero(out->ptr, out->len);
+	else if (ok < 0)
 		fido_blob_reset(out);
 
 	return ok;
@@ -147,28 +164,30 @@ int
 aes256_cbc_enc(const fido_dev_t *dev, const fido_blob_t *secret,
     const fido_blob_t *in, fido_blob_t *out)
 {
-	return fido_dev_get_pin_protocol(dev) == 2 ? aes256_cbc_fips(secret,
-	    in, out, 1) : aes256_cbc_proto1(secret, in, out, 1);
+	return fido_dev_get_pin_protocol(dev) == 2 ? aes256_cbc_fips(dev,
+	    secret, in, out, 1) : aes256_cbc_proto1(dev, secret, in, out, 1);
 }
 
 int
 aes256_cbc_dec(const fido_dev_t *dev, const fido_blob_t *secret,
     const fido_blob_t *in, fido_blob_t *out)
 {
-	return fido_dev_get_pin_protocol(dev) == 2 ? aes256_cbc_fips(secret,
-	    in, out, 0) : aes256_cbc_proto1(secret, in, out, 0);
+	return fido_dev_get_pin_protocol(dev) == 2 ? aes256_cbc_fips(dev,
+	    secret, in, out, 0) : aes256_cbc_proto1(dev, secret, in, out, 0);
 }
 
 int
-aes256_gcm_enc(const fido_blob_t *key, const fido_blob_t *nonce,
-    const fido_blob_t *aad, const fido_blob_t *in, fido_blob_t *out)
+aes256_gcm_enc(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *nonce, const fido_blob_t *aad, const fido_blob_t *in,
+    fido_blob_t *out)
 {
-	return aes256_gcm(key, nonce, aad, in, out, 1);
+	return aes256_gcm(dev, key, nonce, aad, in, out, 1);
 }
 
 int
-aes256_gcm_dec(const fido_blob_t *key, const fido_blob_t *nonce,
-    const fido_blob_t *aad, const fido_blob_t *in, fido_blob_t *out)
+aes256_gcm_dec(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *nonce, const fido_blob_t *aad, const fido_blob_t *in,
+    fido_blob_t *out)
 {
-	return aes256_gcm(key, nonce, aad, in, out, 0);
+	return aes256_gcm(dev, key, nonce, aad, in, out, 0);
 }
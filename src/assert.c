@@ -4,7 +4,6 @@
  * license that can be found in the LICENSE file.
  */
 
-#include <openssl/ecdsa.h>
 #include <openssl/sha.h>
 
 #include "fido.h"
@@ -13,18 +12,9 @@
 #include "fido/eddsa.h"
 
 static int
-adjust_assert_count(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+adjust_assert_count(const cbor_item_t *val, fido_assert_t *assert)
 {
-	fido_assert_t	*assert = arg;
-	uint64_t	 n;
-
-	/* numberOfCredentials; see section 6.2 */
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8 ||
-	    cbor_get_uint8(key) != 5) {
-		fido_log_debug("%s: cbor_type", __func__);
-		return (0); /* ignore */
-	}
+	uint64_t n;
 
 	if (cbor_decode_uint64(val, &n) < 0 || n > SIZE_MAX) {
 		fido_log_debug("%s: cbor_decode_uint64", __func__);
@@ -38,12 +28,34 @@ adjust_assert_count(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 		return (-1);
 	}
 
-	if (fido_assert_set_count(assert, (size_t)n) != FIDO_OK) {
-		fido_log_debug("%s: fido_assert_set_count", __func__);
+	/* statements are allocated as they are fetched */
+	assert->stmt_total = (size_t)n;
+
+	return (0);
+}
+
+static int
+fido_assert_grow(fido_assert_t *assert, size_t n)
+{
+	void *new_stmt;
+
+	if (n <= assert->stmt_cnt)
+		return (0);
+
+#ifdef FIDO_FUZZ
+	if (n > UINT8_MAX) {
+		fido_log_debug("%s: n > UINT8_MAX", __func__);
 		return (-1);
 	}
+#endif
 
-	assert->stmt_len = 0; /* XXX */
+	new_stmt = recallocarray(assert->stmt, assert->stmt_cnt, n,
+	    sizeof(fido_assert_stmt));
+	if (new_stmt == NULL)
+		return (-1);
+
+	assert->stmt = new_stmt;
+	assert->stmt_cnt = n;
 
 	return (0);
 }
@@ -63,6 +75,10 @@ parse_assert_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	case 1: /* credential id */
 		return (cbor_decode_cred_id(val, &stmt->id));
 	case 2: /* authdata */
+		if (fido_blob_decode(val, &stmt->authdata_raw) < 0) {
+			fido_log_debug("%s: fido_blob_decode", __func__);
+			return (-1);
+		}
 		return (cbor_decode_assert_authdata(val, &stmt->authdata_cbor,
 		    &stmt->authdata, &stmt->authdata_ext,
 		    &stmt->hmac_secret_enc));
@@ -78,9 +94,24 @@ parse_assert_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	}
 }
 
+static int
+parse_first_assert_reply(const cbor_item_t *key, const cbor_item_t *val,
+    void *arg)
+{
+	fido_assert_t *assert = arg;
+
+	/* numberOfCredentials; see section 6.2 */
+	if (cbor_isa_uint(key) && cbor_int_get_width(key) == CBOR_INT_8 &&
+	    cbor_get_uint8(key) == 5)
+		return (adjust_assert_count(val, assert));
+
+	return (parse_assert_reply(key, val, &assert->stmt[assert->stmt_len]));
+}
+
 static int
 fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin)
+    const fido_blob_array_t *allow_list, const es256_pk_t *pk,
+    const fido_blob_t *ecdh, const char *pin, const fido_blob_t *token)
 {
 	fido_blob_t	 f;
 	cbor_item_t	*argv[7];
@@ -106,9 +137,8 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 	}
 
 	/* allowed credentials */
-	if (assert->allow_list.len) {
-		const fido_blob_array_t *cl = &assert->allow_list;
-		if ((argv[2] = cbor_encode_pubkey_list(cl)) == NULL) {
+	if (allow_list->len) {
+		if ((argv[2] = cbor_encode_pubkey_list(allow_list)) == NULL) {
 			fido_log_debug("%s: cbor_encode_pubkey_list", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
@@ -133,12 +163,21 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 		}
 
 	/* user verification */
-	if (fido_dev_can_get_uv_token(dev, pin, assert->uv))
+	if (token != NULL) {
+		if ((argv[5] = cbor_encode_pin_auth(dev, token,
+		    &assert->cdh)) == NULL ||
+		    (argv[6] = cbor_encode_pin_opt(dev)) == NULL) {
+			fido_log_debug("%s: cbor encode", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+	} else if (fido_dev_can_get_uv_token(dev, pin, assert->uv)) {
 		if ((r = cbor_add_uv_params(dev, cmd, &assert->cdh, pk, ecdh,
 		    pin, assert->rp_id, &argv[5], &argv[6])) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
 		}
+	}
 
 	/* frame and transmit */
 	if (cbor_build_frame(cmd, argv, nitems(argv), &f) < 0 ||
@@ -177,18 +216,12 @@ fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 
 	assert->stmt_len = 0;
 	assert->stmt_cnt = 1;
+	assert->stmt_total = 1;
 
-	/* adjust as needed */
+	/* parse the first assertion and adjust the count as needed */
 	if ((r = cbor_parse_reply(reply, (size_t)reply_len, assert,
-	    adjust_assert_count)) != FIDO_OK) {
-		fido_log_debug("%s: adjust_assert_count", __func__);
-		return (r);
-	}
-
-	/* parse the first assertion */
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len,
-	    &assert->stmt[assert->stmt_len], parse_assert_reply)) != FIDO_OK) {
-		fido_log_debug("%s: parse_assert_reply", __func__);
+	    parse_first_assert_reply)) != FIDO_OK) {
+		fido_log_debug("%s: parse_first_assert_reply", __func__);
 		return (r);
 	}
 
@@ -239,23 +272,272 @@ fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int ms)
 	return (FIDO_OK);
 }
 
+static int
+parse_silent_assert_reply(const cbor_item_t *key, const cbor_item_t *val,
+    void *arg)
+{
+	fido_blob_t *id = arg;
+
+	if (cbor_isa_uint(key) == false ||
+	    cbor_int_get_width(key) != CBOR_INT_8 ||
+	    cbor_get_uint8(key) != 1) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (0); /* ignore */
+	}
+
+	return (cbor_decode_cred_id(val, id));
+}
+
+static int
+fido_dev_silent_assert_tx(fido_dev_t *dev, const char *rp_id,
+    const fido_blob_t *cdh, const fido_blob_array_t *cl,
+    const fido_blob_t *token)
+{
+	fido_blob_t	 f;
+	cbor_item_t	*argv[7];
+	int		 r;
+
+	memset(argv, 0, sizeof(argv));
+	memset(&f, 0, sizeof(f));
+
+	if ((argv[0] = cbor_build_string(rp_id)) == NULL ||
+	    (argv[1] = fido_blob_encode(cdh)) == NULL ||
+	    (argv[2] = cbor_encode_pubkey_list(cl)) == NULL ||
+	    (argv[4] = cbor_encode_assert_opt(FIDO_OPT_FALSE,
+	    FIDO_OPT_OMIT)) == NULL) {
+		fido_log_debug("%s: cbor encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	/* user verification */
+	if (token != NULL && ((argv[5] = cbor_encode_pin_auth(dev, token,
+	    cdh)) == NULL || (argv[6] = cbor_encode_pin_opt(dev)) == NULL)) {
+		fido_log_debug("%s: cbor encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if (cbor_build_frame(CTAP_CBOR_ASSERT, argv, nitems(argv), &f) < 0 ||
+	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		r = FIDO_ERR_TX;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	cbor_vector_free(argv, nitems(argv));
+	free(f.ptr);
+
+	return (r);
+}
+
+static int
+fido_dev_silent_assert_rx(fido_dev_t *dev, fido_blob_t *id, int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+	int		r;
+
+	fido_blob_reset(id);
+
+	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
+	    ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	if ((r = cbor_parse_reply(reply, (size_t)reply_len, id,
+	    parse_silent_assert_reply)) != FIDO_OK) {
+		fido_log_debug("%s: parse_silent_assert_reply", __func__);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Locate the credential in 'list' known to the authenticator by issuing
+ * getAssertion requests with up=false over device-sized chunks of 'list'.
+ * Credentials whose ids exceed maxCredentialIdLength are skipped, as the
+ * authenticator could not have issued them. If 'token' is not NULL, the
+ * requests carry a pinUvAuthParam, making credentials protected with
+ * credProtect=userVerificationRequired visible.
+ */
+int
+fido_dev_find_cred(fido_dev_t *dev, const char *rp_id, const fido_blob_t *cdh,
+    const fido_blob_array_t *list, const fido_blob_t *token, fido_blob_t *id,
+    int ms)
+{
+	fido_blob_array_t	 cl;
+	fido_blob_array_t	 chunk;
+	uint64_t		 maxcnt = fido_dev_maxcredcntlst(dev);
+	uint64_t		 maxlen = fido_dev_maxcredidlen(dev);
+	int			 r;
+
+	memset(&cl, 0, sizeof(cl));
+
+	if (rp_id == NULL || cdh->ptr == NULL || list->len == 0) {
+		fido_log_debug("%s: rp_id=%p, cdh->ptr=%p, list->len=%zu",
+		    __func__, (const void *)rp_id, (void *)cdh->ptr, list->len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/* shallow copy of the usable entries */
+	if ((cl.ptr = calloc(list->len, sizeof(*cl.ptr))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	for (size_t i = 0; i < list->len; i++)
+		if (maxlen == 0 || list->ptr[i].len <= maxlen)
+			cl.ptr[cl.len++] = list->ptr[i];
+
+	for (size_t i = 0; i < cl.len; i += chunk.len) {
+		chunk.ptr = &cl.ptr[i];
+		chunk.len = cl.len - i;
+		if (maxcnt != 0 && chunk.len > maxcnt)
+			chunk.len = (size_t)maxcnt;
+		if ((r = fido_dev_silent_assert_tx(dev, rp_id, cdh, &chunk,
+		    token)) != FIDO_OK)
+			goto fail;
+		if ((r = fido_dev_silent_assert_rx(dev, id, ms)) ==
+		    FIDO_ERR_NO_CREDENTIALS)
+			continue;
+		if (r != FIDO_OK)
+			goto fail;
+		/* the credential may be omitted if the list has one entry */
+		if (id->ptr == NULL && (chunk.len != 1 ||
+		    fido_blob_set(id, chunk.ptr[0].ptr, chunk.ptr[0].len) < 0)) {
+			fido_log_debug("%s: credential id", __func__);
+			r = FIDO_ERR_INVALID_CBOR;
+			goto fail;
+		}
+		r = FIDO_OK;
+		goto fail;
+	}
+
+	r = FIDO_ERR_NO_CREDENTIALS;
+fail:
+	free(cl.ptr);
+
+	return (r);
+}
+
+bool
+fido_dev_cred_list_fits(const fido_dev_t *dev, const fido_blob_array_t *list)
+{
+	uint64_t maxcnt = fido_dev_maxcredcntlst(dev);
+	uint64_t maxlen = fido_dev_maxcredidlen(dev);
+
+	if (maxcnt != 0 && list->len > maxcnt)
+		return (false);
+	for (size_t i = 0; maxlen != 0 && i < list->len; i++)
+		if (list->ptr[i].len > maxlen)
+			return (false);
+
+	return (true);
+}
+
+static int
+fido_dev_get_assert_first(fido_dev_t *dev, fido_assert_t *assert,
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int ms)
+{
+	const fido_blob_array_t	*cl = &assert->allow_list;
+	fido_blob_array_t	 match;
+	fido_blob_t		*token = NULL;
+	fido_blob_t		 id;
+	int			 r;
+
+	memset(&id, 0, sizeof(id));
+
+	/*
+	 * Narrow an oversized allow list down to a single credential. The
+	 * lookup runs under the same pinUvAuthToken as the assertion, so
+	 * that it sees the same credentials.
+	 */
+	if (cl->len != 0 && fido_dev_cred_list_fits(dev, cl) == false) {
+		if (fido_dev_can_get_uv_token(dev, pin, assert->uv)) {
+			if ((token = fido_blob_new()) == NULL) {
+				r = FIDO_ERR_INTERNAL;
+				goto fail;
+			}
+			if ((r = fido_dev_get_uv_token(dev, CTAP_CBOR_ASSERT,
+			    pin, ecdh, pk, assert->rp_id, token)) != FIDO_OK) {
+				fido_log_debug("%s: fido_dev_get_uv_token",
+				    __func__);
+				goto fail;
+			}
+		}
+		if ((r = fido_dev_find_cred(dev, assert->rp_id, &assert->cdh,
+		    cl, token, &id, ms)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_find_cred", __func__);
+			goto fail;
+		}
+		match.ptr = &id;
+		match.len = 1;
+		cl = &match;
+	}
+
+	if ((r = fido_dev_get_assert_tx(dev, assert, cl, pk, ecdh, pin,
+	    token)) != FIDO_OK ||
+	    (r = fido_dev_get_assert_rx(dev, assert, ms)) != FIDO_OK)
+		goto fail;
+
+	r = FIDO_OK;
+fail:
+	fido_blob_free(&token);
+	free(id.ptr);
+
+	return (r);
+}
+
+static int
+fido_dev_get_assert_next_wait(fido_dev_t *dev, fido_assert_t *assert, int ms)
+{
+	size_t	n = assert->stmt_len + 1;
+	int	r;
+
+	/* double the array, up to the number of credentials announced */
+	if (n > assert->stmt_cnt) {
+		if (assert->stmt_cnt * 2 > n)
+			n = assert->stmt_cnt * 2;
+		if (n > assert->stmt_total)
+			n = assert->stmt_total;
+	}
+
+	if (fido_assert_grow(assert, n) < 0) {
+		fido_log_debug("%s: fido_assert_grow", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if ((r = fido_get_next_assert_tx(dev)) != FIDO_OK ||
+	    (r = fido_get_next_assert_rx(dev, assert, ms)) != FIDO_OK)
+		return (r);
+
+	assert->stmt_len++;
+
+	return (FIDO_OK);
+}
+
 static int
 fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
     const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int ms)
 {
 	int r;
 
-	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin)) != FIDO_OK ||
-	    (r = fido_dev_get_assert_rx(dev, assert, ms)) != FIDO_OK)
+	if ((r = fido_dev_get_assert_first(dev, assert, pk, ecdh, pin,
+	    ms)) != FIDO_OK)
 		return (r);
 
-	while (assert->stmt_len < assert->stmt_cnt) {
-		if ((r = fido_get_next_assert_tx(dev)) != FIDO_OK ||
-		    (r = fido_get_next_assert_rx(dev, assert, ms)) != FIDO_OK)
-			return (r);
-		assert->stmt_len++;
+	if (fido_assert_grow(assert, assert->stmt_total) < 0) {
+		fido_log_debug("%s: fido_assert_grow", __func__);
+		return (FIDO_ERR_INTERNAL);
 	}
 
+	while (assert->stmt_len < assert->stmt_total)
+		if ((r = fido_dev_get_assert_next_wait(dev, assert,
+		    ms)) != FIDO_OK)
+			return (r);
+
 	return (FIDO_OK);
 }
 
@@ -278,8 +560,14 @@ decrypt_hmac_secrets(const fido_dev_t *dev, fido_assert_t *assert,
 	return (0);
 }
 
-int
-fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+/*
+ * Obtain the first statement of an assertion and, if 'all' is set, the
+ * remaining ones. Otherwise, the shared secret needed to decrypt
+ * hmac-secret outputs is kept for fido_dev_get_assert_next().
+ */
+static int
+fido_dev_get_assert_common(fido_dev_t *dev, fido_assert_t *assert,
+    const char *pin, bool all)
 {
 	fido_blob_t	*ecdh = NULL;
 	es256_pk_t	*pk = NULL;
@@ -305,14 +593,26 @@ fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
 		}
 	}
 
-	r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, -1);
-	if (r == FIDO_OK && (assert->ext.mask & FIDO_EXT_HMAC_SECRET))
+	if (all)
+		r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, -1);
+	else
+		r = fido_dev_get_assert_first(dev, assert, pk, ecdh, pin, -1);
+	if (r != FIDO_OK)
+		goto fail;
+
+	if (assert->ext.mask & FIDO_EXT_HMAC_SECRET) {
 		if (decrypt_hmac_secrets(dev, assert, ecdh) < 0) {
 			fido_log_debug("%s: decrypt_hmac_secrets", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+		if (all == false) {
+			assert->ecdh = ecdh;
+			ecdh = NULL;
+		}
+	}
 
+	r = FIDO_OK;
 fail:
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
@@ -320,6 +620,45 @@ fail:
 	return (r);
 }
 
+int
+fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+{
+	return (fido_dev_get_assert_common(dev, assert, pin, true));
+}
+
+int
+fido_dev_get_assert_begin(fido_dev_t *dev, fido_assert_t *assert,
+    const char *pin)
+{
+	return (fido_dev_get_assert_common(dev, assert, pin, false));
+}
+
+int
+fido_dev_get_assert_next(fido_dev_t *dev, fido_assert_t *assert)
+{
+	fido_assert_stmt	*stmt;
+	int			 r;
+
+	if (assert->stmt_len == 0 || assert->stmt_len >= assert->stmt_total) {
+		fido_log_debug("%s: stmt_len=%zu, stmt_total=%zu", __func__,
+		    assert->stmt_len, assert->stmt_total);
+		return (FIDO_ERR_NOT_ALLOWED);
+	}
+
+	if ((r = fido_dev_get_assert_next_wait(dev, assert, -1)) != FIDO_OK)
+		return (r);
+
+	stmt = &assert->stmt[assert->stmt_len - 1];
+	if (assert->ecdh != NULL && stmt->hmac_secret_enc.ptr != NULL &&
+	    aes256_cbc_dec(dev, assert->ecdh, &stmt->hmac_secret_enc,
+	    &stmt->hmac_secret) < 0) {
+		fido_log_debug("%s: aes256_cbc_dec", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_check_flags(uint8_t flags, fido_opt_t up, fido_opt_t uv)
 {
@@ -355,52 +694,60 @@ check_extensions(int authdata_ext, int ext)
 	return (0);
 }
 
+/*
+ * For EdDSA, the signed message is returned as is, in a right-sized buffer
+ * that replaces dgst->ptr and must be released by the caller using free().
+ */
 int
 fido_get_signed_hash(int cose_alg, fido_blob_t *dgst,
-    const fido_blob_t *clientdata, const fido_blob_t *authdata_cbor)
+    const fido_blob_t *clientdata, const fido_blob_t *authdata)
 {
-	cbor_item_t		*item = NULL;
-	unsigned char		*authdata_ptr = NULL;
-	size_t			 authdata_len;
-	struct cbor_load_result	 cbor;
-	SHA256_CTX		 ctx;
-	int			 ok = -1;
-
-	if ((item = cbor_load(authdata_cbor->ptr, authdata_cbor->len,
-	    &cbor)) == NULL || cbor_isa_bytestring(item) == false ||
-	    cbor_bytestring_is_definite(item) == false) {
-		fido_log_debug("%s: authdata", __func__);
-		goto fail;
-	}
-
-	authdata_ptr = cbor_bytestring_handle(item);
-	authdata_len = cbor_bytestring_length(item);
+	SHA256_CTX	 ctx;
+	unsigned char	*msg;
 
 	if (cose_alg != COSE_EDDSA) {
 		if (dgst->len < SHA256_DIGEST_LENGTH || SHA256_Init(&ctx) == 0 ||
-		    SHA256_Update(&ctx, authdata_ptr, authdata_len) == 0 ||
+		    SHA256_Update(&ctx, authdata->ptr, authdata->len) == 0 ||
 		    SHA256_Update(&ctx, clientdata->ptr, clientdata->len) == 0 ||
 		    SHA256_Final(dgst->ptr, &ctx) == 0) {
 			fido_log_debug("%s: sha256", __func__);
-			goto fail;
+			return (-1);
 		}
 		dgst->len = SHA256_DIGEST_LENGTH;
 	} else {
-		if (SIZE_MAX - authdata_len < clientdata->len ||
-		    dgst->len < authdata_len + clientdata->len) {
-			fido_log_debug("%s: memcpy", __func__);
-			goto fail;
+		if (SIZE_MAX - authdata->len < clientdata->len ||
+		    (msg = malloc(authdata->len + clientdata->len)) == NULL) {
+			fido_log_debug("%s: malloc", __func__);
+			return (-1);
 		}
-		memcpy(dgst->ptr, authdata_ptr, authdata_len);
-		memcpy(dgst->ptr + authdata_len, clientdata->ptr,
-		    clientdata->len);
-		dgst->len = authdata_len + clientdata->len;
+		memcpy(msg, authdata->ptr, authdata->len);
+		memcpy(msg + authdata->len, clientdata->ptr, clientdata->len);
+		dgst->ptr = msg;
+		dgst->len = authdata->len + clientdata->len;
+	}
+
+	return (0);
+}
+
+static int
+verify_sig_es256_pkey(const fido_blob_t *dgst, EVP_PKEY *pkey,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY_CTX	*pctx = NULL;
+	int		 ok = -1;
+
+	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	    EVP_PKEY_verify_init(pctx) != 1 ||
+	    EVP_PKEY_verify(pctx, sig->ptr, sig->len, dgst->ptr,
+	    dgst->len) != 1) {
+		fido_log_debug("%s: EVP_PKEY_verify", __func__);
+		goto fail;
 	}
 
 	ok = 0;
 fail:
-	if (item != NULL)
-		cbor_decref(&item);
+	if (pctx != NULL)
+		EVP_PKEY_CTX_free(pctx);
 
 	return (ok);
 }
@@ -410,36 +757,61 @@ fido_verify_sig_es256(const fido_blob_t *dgst, const es256_pk_t *pk,
     const fido_blob_t *sig)
 {
 	EVP_PKEY	*pkey = NULL;
-	EC_KEY		*ec = NULL;
 	int		 ok = -1;
 
-	/* ECDSA_verify needs ints */
-	if (dgst->len > INT_MAX || sig->len > INT_MAX) {
-		fido_log_debug("%s: dgst->len=%zu, sig->len=%zu", __func__,
-		    dgst->len, sig->len);
-		return (-1);
+	if ((pkey = es256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: es256_pk_to_EVP_PKEY", __func__);
+		goto fail;
 	}
 
-	if ((pkey = es256_pk_to_EVP_PKEY(pk)) == NULL ||
-	    (ec = EVP_PKEY_get0_EC_KEY(pkey)) == NULL) {
-		fido_log_debug("%s: pk -> ec", __func__);
+	ok = verify_sig_es256_pkey(dgst, pkey, sig);
+fail:
+	if (pkey != NULL)
+		EVP_PKEY_free(pkey);
+
+	return (ok);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+int
+fido_verify_sig_rs256(const fido_blob_t *dgst, const rs256_pk_t *pk,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY	*pkey = NULL;
+	EVP_PKEY_CTX	*pctx = NULL;
+	const EVP_MD	*md;
+	int		 ok = -1;
+
+	if ((pkey = rs256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: rs256_pk_to_EVP_PKEY", __func__);
 		goto fail;
 	}
 
-	if (ECDSA_verify(0, dgst->ptr, (int)dgst->len, sig->ptr,
-	    (int)sig->len, ec) != 1) {
-		fido_log_debug("%s: ECDSA_verify", __func__);
+	if ((md = EVP_sha256()) == NULL ||
+	    (pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	    EVP_PKEY_verify_init(pctx) != 1 ||
+	    EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) != 1 ||
+	    EVP_PKEY_CTX_set_signature_md(pctx, md) != 1) {
+		fido_log_debug("%s: EVP_PKEY_CTX", __func__);
+		goto fail;
+	}
+
+	if (EVP_PKEY_verify(pctx, sig->ptr, sig->len, dgst->ptr,
+	    dgst->len) != 1) {
+		fido_log_debug("%s: EVP_PKEY_verify", __func__);
 		goto fail;
 	}
 
 	ok = 0;
 fail:
+	if (pctx != NULL)
+		EVP_PKEY_CTX_free(pctx);
 	if (pkey != NULL)
 		EVP_PKEY_free(pkey);
 
 	return (ok);
 }
-
+#else
 int
 fido_verify_sig_rs256(const fido_blob_t *dgst, const rs256_pk_t *pk,
     const fido_blob_t *sig)
@@ -474,15 +846,12 @@ fail:
 
 	return (ok);
 }
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
 
-int
-fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
-    const fido_blob_t *sig)
+static int
+verify_sig_eddsa_ctx(EVP_MD_CTX *mdctx, EVP_PKEY *pkey,
+    const fido_blob_t *dgst, const fido_blob_t *sig)
 {
-	EVP_PKEY	*pkey = NULL;
-	EVP_MD_CTX	*mdctx = NULL;
-	int		 ok = -1;
-
 	/* EVP_DigestVerify needs ints */
 	if (dgst->len > INT_MAX || sig->len > INT_MAX) {
 		fido_log_debug("%s: dgst->len=%zu, sig->len=%zu", __func__,
@@ -490,6 +859,29 @@ fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
 		return (-1);
 	}
 
+	if (EVP_MD_CTX_reset(mdctx) != 1 ||
+	    EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) != 1) {
+		fido_log_debug("%s: EVP_DigestVerifyInit", __func__);
+		return (-1);
+	}
+
+	if (EVP_DigestVerify(mdctx, sig->ptr, sig->len, dgst->ptr,
+	    dgst->len) != 1) {
+		fido_log_debug("%s: EVP_DigestVerify", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
+    const fido_blob_t *sig)
+{
+	EVP_PKEY	*pkey = NULL;
+	EVP_MD_CTX	*mdctx = NULL;
+	int		 ok = -1;
+
 	if ((pkey = eddsa_pk_to_EVP_PKEY(pk)) == NULL) {
 		fido_log_debug("%s: pk -> pkey", __func__);
 		goto fail;
@@ -500,14 +892,8 @@ fido_verify_sig_eddsa(const fido_blob_t *dgst, const eddsa_pk_t *pk,
 		goto fail;
 	}
 
-	if (EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) != 1) {
-		fido_log_debug("%s: EVP_DigestVerifyInit", __func__);
-		goto fail;
-	}
-
-	if (EVP_DigestVerify(mdctx, sig->ptr, sig->len, dgst->ptr,
-	    dgst->len) != 1) {
-		fido_log_debug("%s: EVP_DigestVerify", __func__);
+	if (verify_sig_eddsa_ctx(mdctx, pkey, dgst, sig) < 0) {
+		fido_log_debug("%s: verify_sig_eddsa_ctx", __func__);
 		goto fail;
 	}
 
@@ -522,62 +908,96 @@ fail:
 	return (ok);
 }
 
-int
-fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
-    const void *pk)
+/*
+ * Check everything but the signature of assert->stmt[idx] and compute the
+ * digest to be verified. If dgst->ptr changes, the caller must free() it.
+ */
+static int
+assert_verify_check(const fido_assert_t *assert, size_t idx)
 {
-	unsigned char		 buf[1024]; /* XXX */
-	fido_blob_t		 dgst;
-	const fido_assert_stmt	*stmt = NULL;
-	int			 ok = -1;
-	int			 r;
-
-	dgst.ptr = buf;
-	dgst.len = sizeof(buf);
+	const fido_assert_stmt *stmt;
 
-	if (idx >= assert->stmt_len || pk == NULL) {
-		r = FIDO_ERR_INVALID_ARGUMENT;
-		goto out;
-	}
+	if (idx >= assert->stmt_len)
+		return (FIDO_ERR_INVALID_ARGUMENT);
 
 	stmt = &assert->stmt[idx];
 
 	/* do we have everything we need? */
-	if (assert->cdh.ptr == NULL || assert->rp_id == NULL ||
+	if (assert->cdh.ptr == NULL || assert->rp_id_hash_set == false ||
 	    stmt->authdata_cbor.ptr == NULL || stmt->sig.ptr == NULL) {
 		fido_log_debug("%s: cdh=%p, rp_id=%s, authdata=%p, sig=%p",
 		    __func__, (void *)assert->cdh.ptr, assert->rp_id,
 		    (void *)stmt->authdata_cbor.ptr, (void *)stmt->sig.ptr);
-		r = FIDO_ERR_INVALID_ARGUMENT;
-		goto out;
+		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
 	if (fido_check_flags(stmt->authdata.flags, assert->up,
 	    assert->uv) < 0) {
 		fido_log_debug("%s: fido_check_flags", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
-		goto out;
+		return (FIDO_ERR_INVALID_PARAM);
 	}
 
 	if (check_extensions(stmt->authdata_ext, assert->ext.mask) < 0) {
 		fido_log_debug("%s: check_extensions", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
-		goto out;
+		return (FIDO_ERR_INVALID_PARAM);
 	}
 
-	if (fido_check_rp_id(assert->rp_id, stmt->authdata.rp_id_hash) != 0) {
+	if (fido_check_rp_id(assert->rp_id_hash,
+	    stmt->authdata.rp_id_hash) != 0) {
 		fido_log_debug("%s: fido_check_rp_id", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
-		goto out;
+		return (FIDO_ERR_INVALID_PARAM);
 	}
 
-	if (fido_get_signed_hash(cose_alg, &dgst, &assert->cdh,
-	    &stmt->authdata_cbor) < 0) {
+	return (FIDO_OK);
+}
+
+static int
+assert_verify_prepare(const fido_assert_t *assert, size_t idx, int cose_alg,
+    fido_blob_t *dgst)
+{
+	const fido_assert_stmt	*stmt;
+	int			 r;
+
+	if ((r = assert_verify_check(assert, idx)) != FIDO_OK)
+		return (r);
+
+	stmt = &assert->stmt[idx];
+
+	if (fido_get_signed_hash(cose_alg, dgst, &assert->cdh,
+	    &stmt->authdata_raw) < 0) {
 		fido_log_debug("%s: fido_get_signed_hash", __func__);
-		r = FIDO_ERR_INTERNAL;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
+    const void *pk)
+{
+	unsigned char		 buf[SHA256_DIGEST_LENGTH];
+	fido_blob_t		 dgst;
+	const fido_assert_stmt	*stmt;
+	int			 ok = -1;
+	int			 r;
+
+	dgst.ptr = buf;
+	dgst.len = sizeof(buf);
+
+	if (pk == NULL) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if ((r = assert_verify_prepare(assert, idx, cose_alg,
+	    &dgst)) != FIDO_OK) {
+		fido_log_debug("%s: assert_verify_prepare", __func__);
 		goto out;
 	}
 
+	stmt = &assert->stmt[idx];
+
 	switch (cose_alg) {
 	case COSE_ES256:
 		ok = fido_verify_sig_es256(&dgst, pk, &stmt->sig);
@@ -600,11 +1020,258 @@ fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
 	else
 		r = FIDO_OK;
 out:
+	if (dgst.ptr != buf)
+		free(dgst.ptr);
 	explicit_bzero(buf, sizeof(buf));
 
 	return (r);
 }
 
+int
+fido_assert_verify_prepared(const fido_assert_t *assert, size_t idx,
+    const es256_pk_prepared_t *pk)
+{
+	unsigned char	buf[SHA256_DIGEST_LENGTH];
+	fido_blob_t	dgst;
+	int		r;
+
+	dgst.ptr = buf;
+	dgst.len = sizeof(buf);
+
+	if (pk == NULL) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if ((r = assert_verify_prepare(assert, idx, COSE_ES256,
+	    &dgst)) != FIDO_OK) {
+		fido_log_debug("%s: assert_verify_prepare", __func__);
+		goto out;
+	}
+
+	if (verify_sig_es256_pkey(&dgst, pk->pkey,
+	    &assert->stmt[idx].sig) < 0)
+		r = FIDO_ERR_INVALID_SIG;
+	else
+		r = FIDO_OK;
+out:
+	if (dgst.ptr != buf)
+		free(dgst.ptr);
+	explicit_bzero(buf, sizeof(buf));
+
+	return (r);
+}
+
+/*
+ * EdDSA batch: share one EVP_MD_CTX across the batch, and the EVP_PKEY
+ * across consecutive items that use the same key.
+ */
+static int
+assert_verify_batch_eddsa(const fido_assert_t *const *assert,
+    const size_t *idx, size_t n, const void *const *pk, int *status)
+{
+	EVP_MD_CTX	*mdctx = NULL;
+	EVP_PKEY	*pkey = NULL;
+	const void	*pkey_pk = NULL;
+	unsigned char	 buf[SHA256_DIGEST_LENGTH];
+	fido_blob_t	 dgst;
+	int		 r = FIDO_OK;
+
+	if ((mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		for (size_t i = 0; i < n; i++)
+			status[i] = FIDO_ERR_INTERNAL;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		dgst.ptr = buf;
+		dgst.len = sizeof(buf);
+
+		if (assert[i] == NULL || pk[i] == NULL)
+			status[i] = FIDO_ERR_INVALID_ARGUMENT;
+		else
+			status[i] = assert_verify_prepare(assert[i], idx[i],
+			    COSE_EDDSA, &dgst);
+
+		if (status[i] == FIDO_OK && pk[i] != pkey_pk) {
+			if (pkey != NULL)
+				EVP_PKEY_free(pkey);
+			if ((pkey = eddsa_pk_to_EVP_PKEY(pk[i])) == NULL)
+				fido_log_debug("%s: pk -> pkey", __func__);
+			pkey_pk = pkey != NULL ? pk[i] : NULL;
+		}
+
+		if (status[i] == FIDO_OK && (pkey == NULL ||
+		    verify_sig_eddsa_ctx(mdctx, pkey, &dgst,
+		    &assert[i]->stmt[idx[i]].sig) < 0))
+			status[i] = FIDO_ERR_INVALID_SIG;
+
+		if (dgst.ptr != buf)
+			free(dgst.ptr);
+		if (status[i] != FIDO_OK && r == FIDO_OK)
+			r = status[i];
+	}
+
+	explicit_bzero(buf, sizeof(buf));
+	EVP_MD_CTX_free(mdctx);
+
+	if (pkey != NULL)
+		EVP_PKEY_free(pkey);
+
+	return (r);
+}
+
+/*
+ * ES256 and RS256 batch: hash every statement back to back through one
+ * EVP_MD_CTX, then check the signatures against the digests. An ES256
+ * key is converted once for consecutive items that use it.
+ */
+static int
+assert_verify_batch_hash(const fido_assert_t *const *assert,
+    const size_t *idx, size_t n, const void *const *pk, unsigned char *buf,
+    int *status)
+{
+	EVP_MD_CTX		*mdctx = NULL;
+	EVP_MD			*md = NULL;
+	const EVP_MD		*const_md;
+	const fido_assert_stmt	*stmt;
+	unsigned int		 dgst_len;
+	int			 r = FIDO_ERR_INTERNAL;
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	const_md = md = EVP_MD_fetch(NULL, "SHA256", NULL);
+#else
+	const_md = EVP_sha256();
+#endif
+	if (const_md == NULL || (mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (assert[i] == NULL || pk[i] == NULL) {
+			status[i] = FIDO_ERR_INVALID_ARGUMENT;
+			continue;
+		}
+		if ((status[i] = assert_verify_check(assert[i],
+		    idx[i])) != FIDO_OK)
+			continue;
+		stmt = &assert[i]->stmt[idx[i]];
+		if (EVP_DigestInit_ex(mdctx, const_md, NULL) != 1 ||
+		    EVP_DigestUpdate(mdctx, stmt->authdata_raw.ptr,
+		    stmt->authdata_raw.len) != 1 ||
+		    EVP_DigestUpdate(mdctx, assert[i]->cdh.ptr,
+		    assert[i]->cdh.len) != 1 ||
+		    EVP_DigestFinal_ex(mdctx, buf + i * SHA256_DIGEST_LENGTH,
+		    &dgst_len) != 1 || dgst_len != SHA256_DIGEST_LENGTH) {
+			fido_log_debug("%s: sha256", __func__);
+			status[i] = FIDO_ERR_INTERNAL;
+		}
+	}
+
+	r = FIDO_OK;
+fail:
+	EVP_MD_CTX_free(mdctx);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MD_free(md);
+#else
+	(void)md;
+#endif
+
+	return (r);
+}
+
+static int
+assert_verify_batch_sha256(const fido_assert_t *const *assert,
+    const size_t *idx, size_t n, int cose_alg, const void *const *pk,
+    int *status)
+{
+	EVP_PKEY	*pkey = NULL;
+	const void	*pkey_pk = NULL;
+	unsigned char	*buf = NULL;
+	fido_blob_t	 dgst;
+	int		 ok;
+	int		 r = FIDO_OK;
+
+	if (n > SIZE_MAX / SHA256_DIGEST_LENGTH ||
+	    (buf = calloc(n, SHA256_DIGEST_LENGTH)) == NULL ||
+	    assert_verify_batch_hash(assert, idx, n, pk, buf,
+	    status) != FIDO_OK) {
+		fido_log_debug("%s: hash", __func__);
+		free(buf);
+		for (size_t i = 0; i < n; i++)
+			status[i] = FIDO_ERR_INTERNAL;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		dgst.ptr = buf + i * SHA256_DIGEST_LENGTH;
+		dgst.len = SHA256_DIGEST_LENGTH;
+
+		if (status[i] == FIDO_OK && cose_alg == COSE_ES256 &&
+		    pk[i] != pkey_pk) {
+			if (pkey != NULL)
+				EVP_PKEY_free(pkey);
+			if ((pkey = es256_pk_to_EVP_PKEY(pk[i])) == NULL)
+				fido_log_debug("%s: pk -> pkey", __func__);
+			pkey_pk = pkey != NULL ? pk[i] : NULL;
+		}
+
+		if (status[i] == FIDO_OK) {
+			if (cose_alg == COSE_ES256)
+				ok = pkey == NULL ? -1 :
+				    verify_sig_es256_pkey(&dgst, pkey,
+				    &assert[i]->stmt[idx[i]].sig);
+			else
+				ok = fido_verify_sig_rs256(&dgst, pk[i],
+				    &assert[i]->stmt[idx[i]].sig);
+			if (ok < 0)
+				status[i] = FIDO_ERR_INVALID_SIG;
+		}
+
+		if (status[i] != FIDO_OK && r == FIDO_OK)
+			r = status[i];
+	}
+
+	explicit_bzero(buf, n * SHA256_DIGEST_LENGTH);
+	free(buf);
+
+	if (pkey != NULL)
+		EVP_PKEY_free(pkey);
+
+	return (r);
+}
+
+int
+fido_assert_verify_batch(const fido_assert_t *const *assert, const size_t *idx,
+    size_t n, int cose_alg, const void *const *pk, int *status)
+{
+	int r = FIDO_OK;
+
+	if (assert == NULL || idx == NULL || pk == NULL || status == NULL ||
+	    n == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (cose_alg == COSE_EDDSA)
+		return (assert_verify_batch_eddsa(assert, idx, n, pk, status));
+	if (cose_alg == COSE_ES256 || cose_alg == COSE_RS256)
+		return (assert_verify_batch_sha256(assert, idx, n, cose_alg,
+		    pk, status));
+
+	for (size_t i = 0; i < n; i++) {
+		if (assert[i] == NULL)
+			status[i] = FIDO_ERR_INVALID_ARGUMENT;
+		else
+			status[i] = fido_assert_verify(assert[i], idx[i],
+			    cose_alg, pk[i]);
+		if (status[i] != FIDO_OK && r == FIDO_OK)
+			r = status[i];
+	}
+
+	return (r);
+}
+
 int
 fido_assert_set_clientdata_hash(fido_assert_t *assert,
     const unsigned char *hash, size_t hash_len)
@@ -646,11 +1313,46 @@ fido_assert_set_rp(fido_assert_t *assert, const char *id)
 		assert->rp_id = NULL;
 	}
 
+	explicit_bzero(assert->rp_id_hash, sizeof(assert->rp_id_hash));
+	assert->rp_id_hash_set = false;
+
 	if (id == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((assert->rp_id = strdup(id)) == NULL)
+	if ((assert->rp_id = strdup(id)) == NULL ||
+	    fido_hash_rp_id(id, assert->rp_id_hash) < 0) {
+		free(assert->rp_id);
+		assert->rp_id = NULL;
 		return (FIDO_ERR_INTERNAL);
+	}
+
+	assert->rp_id_hash_set = true;
+
+	return (FIDO_OK);
+}
+
+int
+fido_assert_set_rp_id_hash(fido_assert_t *assert, const unsigned char *ptr,
+    size_t len)
+{
+	/* the hash of an id set by fido_assert_set_rp() must not change */
+	if (assert->rp_id != NULL) {
+		if (ptr == NULL || len != sizeof(assert->rp_id_hash) ||
+		    timingsafe_bcmp(ptr, assert->rp_id_hash, len) != 0) {
+			fido_log_debug("%s: rp id mismatch", __func__);
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		}
+		return (FIDO_OK);
+	}
+
+	explicit_bzero(assert->rp_id_hash, sizeof(assert->rp_id_hash));
+	assert->rp_id_hash_set = false;
+
+	if (ptr == NULL || len != sizeof(assert->rp_id_hash))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memcpy(assert->rp_id_hash, ptr, len);
+	assert->rp_id_hash_set = true;
 
 	return (FIDO_OK);
 }
@@ -754,7 +1456,9 @@ fido_assert_reset_tx(fido_assert_t *assert)
 	fido_free_blob_array(&assert->allow_list);
 	memset(&assert->ext, 0, sizeof(assert->ext));
 	memset(&assert->allow_list, 0, sizeof(assert->allow_list));
+	memset(assert->rp_id_hash, 0, sizeof(assert->rp_id_hash));
 	assert->rp_id = NULL;
+	assert->rp_id_hash_set = false;
 	assert->up = FIDO_OPT_OMIT;
 	assert->uv = FIDO_OPT_OMIT;
 }
@@ -771,14 +1475,17 @@ fido_assert_reset_rx(fido_assert_t *assert)
 		fido_blob_reset(&assert->stmt[i].hmac_secret);
 		fido_blob_reset(&assert->stmt[i].hmac_secret_enc);
 		fido_blob_reset(&assert->stmt[i].authdata_cbor);
+		fido_blob_reset(&assert->stmt[i].authdata_raw);
 		fido_blob_reset(&assert->stmt[i].largeblob_key);
 		fido_blob_reset(&assert->stmt[i].sig);
 		memset(&assert->stmt[i], 0, sizeof(assert->stmt[i]));
 	}
 	free(assert->stmt);
+	fido_blob_free(&assert->ecdh);
 	assert->stmt = NULL;
 	assert->stmt_len = 0;
 	assert->stmt_cnt = 0;
+	assert->stmt_total = 0;
 }
 
 void
@@ -800,6 +1507,15 @@ fido_assert_count(const fido_assert_t *assert)
 	return (assert->stmt_len);
 }
 
+size_t
+fido_assert_pending(const fido_assert_t *assert)
+{
+	if (assert->stmt_total < assert->stmt_len)
+		return (0);
+
+	return (assert->stmt_total - assert->stmt_len);
+}
+
 const char *
 fido_assert_rp_id(const fido_assert_t *assert)
 {
@@ -963,6 +1679,7 @@ static void
 fido_assert_clean_authdata(fido_assert_stmt *stmt)
 {
 	fido_blob_reset(&stmt->authdata_cbor);
+	fido_blob_reset(&stmt->authdata_raw);
 	fido_blob_reset(&stmt->hmac_secret_enc);
 	memset(&stmt->authdata_ext, 0, sizeof(stmt->authdata_ext));
 	memset(&stmt->authdata, 0, sizeof(stmt->authdata));
@@ -989,6 +1706,12 @@ fido_assert_set_authdata(fido_assert_t *assert, size_t idx,
 		goto fail;
 	}
 
+	if (fido_blob_decode(item, &stmt->authdata_raw) < 0) {
+		fido_log_debug("%s: fido_blob_decode", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
 	if (cbor_decode_assert_authdata(item, &stmt->authdata_cbor,
 	    &stmt->authdata, &stmt->authdata_ext, &stmt->hmac_secret_enc) < 0) {
 		fido_log_debug("%s: cbor_decode_assert_authdata", __func__);
@@ -1021,6 +1744,12 @@ fido_assert_set_authdata_raw(fido_assert_t *assert, size_t idx,
 	stmt = &assert->stmt[idx];
 	fido_assert_clean_authdata(stmt);
 
+	if (fido_blob_set(&stmt->authdata_raw, ptr, len) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
 	if ((item = cbor_build_bytestring(ptr, len)) == NULL) {
 		fido_log_debug("%s: cbor_build_bytestring", __func__);
 		r = FIDO_ERR_INTERNAL;
@@ -1087,6 +1816,7 @@ fido_assert_set_count(fido_assert_t *assert, size_t n)
 	assert->stmt = new_stmt;
 	assert->stmt_cnt = n;
 	assert->stmt_len = n;
+	assert->stmt_total = n;
 
 	return (FIDO_OK);
 }
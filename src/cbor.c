@@ -4,7 +4,6 @@
  * license that can be found in the LICENSE file.
  */
 
-#include <openssl/hmac.h>
 #include <openssl/sha.h>
 #include "fido.h"
 
@@ -646,9 +645,7 @@ cbor_item_t *
 cbor_encode_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
     const fido_blob_t *data)
 {
-	const EVP_MD	*md = NULL;
 	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
-	unsigned int	 dgst_len;
 	size_t		 outlen;
 	uint8_t		 prot;
 	fido_blob_t	 key;
@@ -666,12 +663,10 @@ cbor_encode_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
 	if (prot == CTAP_PIN_PROTOCOL2 && key.len > 32)
 		key.len = 32;
 
-	if ((md = EVP_sha256()) == NULL || HMAC(md, key.ptr,
-	    (int)key.len, data->ptr, data->len, dgst,
-	    &dgst_len) == NULL || dgst_len != SHA256_DIGEST_LENGTH)
+	if (fido_hmac_sha256(dev, &key, data, 1, dgst) < 0)
 		return (NULL);
 
-	outlen = (prot == CTAP_PIN_PROTOCOL1) ? 16 : dgst_len;
+	outlen = (prot == CTAP_PIN_PROTOCOL1) ? 16 : sizeof(dgst);
 
 	return (cbor_build_bytestring(dgst, outlen));
 }
@@ -694,20 +689,16 @@ cbor_encode_change_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
     const fido_blob_t *new_pin_enc, const fido_blob_t *pin_hash_enc)
 {
 	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
-	unsigned int	 dgst_len;
 	cbor_item_t	*item = NULL;
-	const EVP_MD	*md = NULL;
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-	HMAC_CTX	 ctx;
-#else
-	HMAC_CTX	*ctx = NULL;
-#endif
 	fido_blob_t	 key;
+	fido_blob_t	 data[2];
 	uint8_t		 prot;
 	size_t		 outlen;
 
 	key.ptr = secret->ptr;
 	key.len = secret->len;
+	data[0] = *new_pin_enc;
+	data[1] = *pin_hash_enc;
 
 	if ((prot = fido_dev_get_pin_protocol(dev)) == 0) {
 		fido_log_debug("%s: fido_dev_get_pin_protocol", __func__);
@@ -717,32 +708,12 @@ cbor_encode_change_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
 	if (prot == CTAP_PIN_PROTOCOL2 && key.len > 32)
 		key.len = 32;
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-	HMAC_CTX_init(&ctx);
-
-	if ((md = EVP_sha256()) == NULL ||
-	    HMAC_Init_ex(&ctx, key.ptr, (int)key.len, md, NULL) == 0 ||
-	    HMAC_Update(&ctx, new_pin_enc->ptr, new_pin_enc->len) == 0 ||
-	    HMAC_Update(&ctx, pin_hash_enc->ptr, pin_hash_enc->len) == 0 ||
-	    HMAC_Final(&ctx, dgst, &dgst_len) == 0 ||
-	    dgst_len != SHA256_DIGEST_LENGTH) {
-		fido_log_debug("%s: HMAC", __func__);
-		goto fail;
-	}
-#else
-	if ((ctx = HMAC_CTX_new()) == NULL ||
-	    (md = EVP_sha256())  == NULL ||
-	    HMAC_Init_ex(ctx, key.ptr, (int)key.len, md, NULL) == 0 ||
-	    HMAC_Update(ctx, new_pin_enc->ptr, new_pin_enc->len) == 0 ||
-	    HMAC_Update(ctx, pin_hash_enc->ptr, pin_hash_enc->len) == 0 ||
-	    HMAC_Final(ctx, dgst, &dgst_len) == 0 ||
-	    dgst_len != SHA256_DIGEST_LENGTH) {
-		fido_log_debug("%s: HMAC", __func__);
+	if (fido_hmac_sha256(dev, &key, data, nitems(data), dgst) < 0) {
+		fido_log_debug("%s: fido_hmac_sha256", __func__);
 		goto fail;
 	}
-#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
-	outlen = (prot == CTAP_PIN_PROTOCOL1) ? 16 : dgst_len;
+	outlen = (prot == CTAP_PIN_PROTOCOL1) ? 16 : sizeof(dgst);
 
 	if ((item = cbor_build_bytestring(dgst, outlen)) == NULL) {
 		fido_log_debug("%s: cbor_build_bytestring", __func__);
@@ -750,11 +721,6 @@ cbor_encode_change_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
 	}
 
 fail:
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-	if (ctx != NULL)
-		HMAC_CTX_free(ctx);
-#endif
-
 	return (item);
 }
 
@@ -4,69 +4,102 @@
  * license that can be found in the LICENSE file.
  */
 
-#ifdef WITH_ZLIB
 #include <zlib.h>
 #include "fido.h"
 
 #define BOUND (1024UL * 1024UL)
 
-static int
-do_compress(fido_blob_t *out, const fido_blob_t *in, size_t origsiz, int decomp)
+/*
+ * zlib's default parameters allocate and clear some 256 KiB of state,
+ * which dwarfs the work of compressing a large blob of a few kilobytes.
+ * Size the window and hash table to the payload instead; the window
+ * size is recorded in the stream, and inflate() sizes its own state
+ * accordingly.
+ */
+static void
+deflate_params(u_long len, int *wbits, int *memlevel)
 {
+	*wbits = 9;
+	while (*wbits < MAX_WBITS && (1UL << *wbits) < len)
+		(*wbits)++;
+	*memlevel = *wbits - 7 > 1 ? *wbits - 7 : 1;
+}
+
+int
+fido_compress(fido_blob_t *out, const fido_blob_t *in)
+{
+	z_stream zs;
 	u_long ilen, olen;
-	int r;
+	int wbits, memlevel;
+	int ok = FIDO_ERR_COMPRESS;
 
 	memset(out, 0, sizeof(*out));
-	if (in->len > ULONG_MAX || (ilen = (u_long)in->len) > BOUND ||
-	    origsiz > ULONG_MAX || (olen = decomp ? (u_long)origsiz :
-	    compressBound(ilen)) > BOUND)
+	memset(&zs, 0, sizeof(zs));
+	if (in->len > ULONG_MAX || (ilen = (u_long)in->len) > BOUND)
 		return FIDO_ERR_INVALID_ARGUMENT;
-	if ((out->ptr = calloc(1, olen)) == NULL)
+	deflate_params(ilen, &wbits, &memlevel);
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, wbits,
+	    memlevel, Z_DEFAULT_STRATEGY) != Z_OK)
 		return FIDO_ERR_INTERNAL;
-	out->len = olen;
-	if (decomp)
-		r = uncompress(out->ptr, &olen, in->ptr, ilen);
-	else
-		r = compress(out->ptr, &olen, in->ptr, ilen);
-	if (r != Z_OK || olen > SIZE_MAX || olen > out->len) {
-		fido_blob_reset(out);
-		return FIDO_ERR_COMPRESS;
+	if ((olen = deflateBound(&zs, ilen)) > BOUND ||
+	    (out->ptr = calloc(1, olen)) == NULL) {
+		ok = FIDO_ERR_INTERNAL;
+		goto fail;
 	}
-	out->len = olen;
+	zs.next_in = in->ptr;
+	zs.avail_in = (uInt)ilen;
+	zs.next_out = out->ptr;
+	zs.avail_out = (uInt)olen;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out > olen)
+		goto fail;
+	out->len = zs.total_out;
 
-	return FIDO_OK;
-}
+	ok = FIDO_OK;
+fail:
+	deflateEnd(&zs);
+	if (ok != FIDO_OK)
+		fido_blob_reset(out);
 
-int
-fido_compress(fido_blob_t *out, const fido_blob_t *in)
-{
-	return do_compress(out, in, 0, 0);
+	return ok;
 }
 
+/*
+ * The declared size of the plaintext is covered by the large blob's
+ * authentication tag, so it is trusted to size the output buffer.
+ * inflate() is told so with Z_FINISH, which lets it decompress straight
+ * into the buffer without allocating a sliding window of its own.
+ */
 int
 fido_uncompress(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
 {
-	return do_compress(out, in, origsiz, 1);
-}
-#else
-#include "fido.h"
-
-int
-fido_compress(fido_blob_t *out, const fido_blob_t *in)
-{
-	(void)out;
-	(void)in;
+	z_stream zs;
+	u_long ilen, olen;
+	int ok = FIDO_ERR_COMPRESS;
 
-	return FIDO_ERR_INTERNAL;
-}
+	memset(out, 0, sizeof(*out));
+	memset(&zs, 0, sizeof(zs));
+	if (in->len > ULONG_MAX || (ilen = (u_long)in->len) > BOUND ||
+	    origsiz > ULONG_MAX || (olen = (u_long)origsiz) > BOUND)
+		return FIDO_ERR_INVALID_ARGUMENT;
+	if (inflateInit(&zs) != Z_OK)
+		return FIDO_ERR_INTERNAL;
+	if ((out->ptr = calloc(1, olen)) == NULL) {
+		ok = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	zs.next_in = in->ptr;
+	zs.avail_in = (uInt)ilen;
+	zs.next_out = out->ptr;
+	zs.avail_out = (uInt)olen;
+	if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out > olen)
+		goto fail;
+	out->len = zs.total_out;
 
-int
-fido_uncompress(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
-{
-	(void)out;
-	(void)in;
-	(void)origsiz;
+	ok = FIDO_OK;
+fail:
+	inflateEnd(&zs);
+	if (ok != FIDO_OK)
+		fido_blob_reset(out);
 
-	return FIDO_ERR_INTERNAL;
+	return ok;
 }
-#endif
@@ -43,7 +43,8 @@ parse_makecred_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 }
 
 static int
-fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred,
+    const fido_blob_array_t *excl, const char *pin, const fido_blob_t *token)
 {
 	fido_blob_t	 f;
 	fido_blob_t	*ecdh = NULL;
@@ -72,8 +73,8 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 	}
 
 	/* excluded credentials */
-	if (cred->excl.len)
-		if ((argv[4] = cbor_encode_pubkey_list(&cred->excl)) == NULL) {
+	if (excl != NULL && excl->len)
+		if ((argv[4] = cbor_encode_pubkey_list(excl)) == NULL) {
 			fido_log_debug("%s: cbor_encode_pubkey_list", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
@@ -97,7 +98,15 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 		}
 
 	/* user verification */
-	if (fido_dev_can_get_uv_token(dev, pin, cred->uv)) {
+	if (token != NULL) {
+		if ((argv[7] = cbor_encode_pin_auth(dev, token,
+		    &cred->cdh)) == NULL ||
+		    (argv[8] = cbor_encode_pin_opt(dev)) == NULL) {
+			fido_log_debug("%s: cbor encode", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+	} else if (fido_dev_can_get_uv_token(dev, pin, cred->uv)) {
 		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
 			fido_log_debug("%s: fido_do_ecdh", __func__);
 			goto fail;
@@ -158,17 +167,95 @@ fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int ms)
 	return (FIDO_OK);
 }
 
+/*
+ * Look for a credential in the exclude list ahead of makeCredential.
+ * Without user verification, makeCredential ignores excluded credentials
+ * protected with credProtect=userVerificationRequired, and so does an
+ * unauthenticated lookup. When makeCredential is to be authenticated,
+ * the lookup is authenticated too, with a token that is then reused for
+ * makeCredential. If that is not possible, fail rather than risk
+ * creating a duplicate credential.
+ */
+static int
+fido_dev_find_excluded(fido_dev_t *dev, const fido_cred_t *cred,
+    const char *pin, fido_blob_t **token, fido_blob_t *id, int ms)
+{
+	es256_pk_t	*pk = NULL;
+	fido_blob_t	*ecdh = NULL;
+	int		 r;
+
+	if (fido_dev_can_get_uv_token(dev, pin, cred->uv)) {
+		if ((*token = fido_blob_new()) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+			fido_log_debug("%s: fido_do_ecdh", __func__);
+			goto fail;
+		}
+		if ((r = fido_dev_get_uv_token(dev,
+		    FIDO_UV_TOKEN_MAKECRED_ASSERT, pin, ecdh, pk, cred->rp.id,
+		    *token)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_get_uv_token", __func__);
+			goto fail;
+		}
+	} else if (cred->uv == FIDO_OPT_TRUE) {
+		fido_log_debug("%s: uv without token", __func__);
+		r = FIDO_ERR_UNSUPPORTED_OPTION;
+		goto fail;
+	}
+
+	if ((r = fido_dev_find_cred(dev, cred->rp.id, &cred->cdh, &cred->excl,
+	    *token, id, ms)) != FIDO_OK && r != FIDO_ERR_NO_CREDENTIALS)
+		fido_log_debug("%s: fido_dev_find_cred", __func__);
+fail:
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	return (r);
+}
+
 static int
 fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
     int ms)
 {
-	int  r;
+	const fido_blob_array_t	*excl = &cred->excl;
+	fido_blob_array_t	 match;
+	fido_blob_t		*token = NULL;
+	fido_blob_t		 id;
+	int			 r;
+
+	memset(&id, 0, sizeof(id));
+
+	/*
+	 * If the exclude list does not fit the authenticator, look for an
+	 * excluded credential first. makeCredential is then sent with that
+	 * credential alone, so that the authenticator collects user presence
+	 * before reporting it, or without an exclude list at all.
+	 */
+	if (excl->len != 0 && fido_dev_cred_list_fits(dev, excl) == false) {
+		if ((r = fido_dev_find_excluded(dev, cred, pin, &token, &id,
+		    ms)) == FIDO_OK) {
+			match.ptr = &id;
+			match.len = 1;
+			excl = &match;
+		} else if (r == FIDO_ERR_NO_CREDENTIALS)
+			excl = NULL;
+		else
+			goto fail;
+	}
 
-	if ((r = fido_dev_make_cred_tx(dev, cred, pin)) != FIDO_OK ||
+	if ((r = fido_dev_make_cred_tx(dev, cred, excl, pin,
+	    token)) != FIDO_OK ||
 	    (r = fido_dev_make_cred_rx(dev, cred, ms)) != FIDO_OK)
-		return (r);
+		goto fail;
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+fail:
+	fido_blob_free(&token);
+	free(id.ptr);
+
+	return (r);
 }
 
 int
@@ -181,6 +268,9 @@ fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 		return (u2f_register(dev, cred, -1));
 	}
 
+	/* the new credential may be resident */
+	fido_credman_cache_reset(dev->credman);
+
 	return (fido_dev_make_cred_wait(dev, cred, pin, -1));
 }
 
@@ -198,18 +288,20 @@ check_extensions(const fido_cred_ext_t *authdata_ext,
 }
 
 int
-fido_check_rp_id(const char *id, const unsigned char *obtained_hash)
+fido_hash_rp_id(const char *id, unsigned char *hash)
 {
-	unsigned char expected_hash[SHA256_DIGEST_LENGTH];
-
-	explicit_bzero(expected_hash, sizeof(expected_hash));
-
-	if (SHA256((const unsigned char *)id, strlen(id),
-	    expected_hash) != expected_hash) {
+	if (SHA256((const unsigned char *)id, strlen(id), hash) != hash) {
 		fido_log_debug("%s: sha256", __func__);
 		return (-1);
 	}
 
+	return (0);
+}
+
+int
+fido_check_rp_id(const unsigned char *expected_hash,
+    const unsigned char *obtained_hash)
+{
 	return (timingsafe_bcmp(expected_hash, obtained_hash,
 	    SHA256_DIGEST_LENGTH));
 }
@@ -246,13 +338,12 @@ verify_sig(const fido_blob_t *dgst, const fido_blob_t *x5c,
 	BIO		*rawcert = NULL;
 	X509		*cert = NULL;
 	EVP_PKEY	*pkey = NULL;
-	EC_KEY		*ec;
+	EVP_PKEY_CTX	*pctx = NULL;
 	int		 ok = -1;
 
 	/* openssl needs ints */
-	if (dgst->len > INT_MAX || x5c->len > INT_MAX || sig->len > INT_MAX) {
-		fido_log_debug("%s: dgst->len=%zu, x5c->len=%zu, sig->len=%zu",
-		    __func__, dgst->len, x5c->len, sig->len);
+	if (x5c->len > INT_MAX) {
+		fido_log_debug("%s: x5c->len=%zu", __func__, x5c->len);
 		return (-1);
 	}
 
@@ -260,14 +351,16 @@ verify_sig(const fido_blob_t *dgst, const fido_blob_t *x5c,
 	if ((rawcert = BIO_new_mem_buf(x5c->ptr, (int)x5c->len)) == NULL ||
 	    (cert = d2i_X509_bio(rawcert, NULL)) == NULL ||
 	    (pkey = X509_get_pubkey(cert)) == NULL ||
-	    (ec = EVP_PKEY_get0_EC_KEY(pkey)) == NULL) {
+	    EVP_PKEY_base_id(pkey) != EVP_PKEY_EC) {
 		fido_log_debug("%s: x509 key", __func__);
 		goto fail;
 	}
 
-	if (ECDSA_verify(0, dgst->ptr, (int)dgst->len, sig->ptr,
-	    (int)sig->len, ec) != 1) {
-		fido_log_debug("%s: ECDSA_verify", __func__);
+	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	    EVP_PKEY_verify_init(pctx) != 1 ||
+	    EVP_PKEY_verify(pctx, sig->ptr, sig->len, dgst->ptr,
+	    dgst->len) != 1) {
+		fido_log_debug("%s: EVP_PKEY_verify", __func__);
 		goto fail;
 	}
 
@@ -277,6 +370,8 @@ fail:
 		BIO_free(rawcert);
 	if (cert != NULL)
 		X509_free(cert);
+	if (pctx != NULL)
+		EVP_PKEY_CTX_free(pctx);
 	if (pkey != NULL)
 		EVP_PKEY_free(pkey);
 
@@ -297,7 +392,7 @@ fido_cred_verify(const fido_cred_t *cred)
 	if (cred->cdh.ptr == NULL || cred->authdata_cbor.ptr == NULL ||
 	    cred->attstmt.x5c.ptr == NULL || cred->attstmt.sig.ptr == NULL ||
 	    cred->fmt == NULL || cred->attcred.id.ptr == NULL ||
-	    cred->rp.id == NULL) {
+	    cred->rp_id_hash_set == false) {
 		fido_log_debug("%s: cdh=%p, authdata=%p, x5c=%p, sig=%p, "
 		    "fmt=%p id=%p, rp.id=%s", __func__, (void *)cred->cdh.ptr,
 		    (void *)cred->authdata_cbor.ptr,
@@ -308,7 +403,8 @@ fido_cred_verify(const fido_cred_t *cred)
 		goto out;
 	}
 
-	if (fido_check_rp_id(cred->rp.id, cred->authdata.rp_id_hash) != 0) {
+	if (fido_check_rp_id(cred->rp_id_hash,
+	    cred->authdata.rp_id_hash) != 0) {
 		fido_log_debug("%s: fido_check_rp_id", __func__);
 		r = FIDO_ERR_INVALID_PARAM;
 		goto out;
@@ -329,7 +425,7 @@ fido_cred_verify(const fido_cred_t *cred)
 
 	if (!strcmp(cred->fmt, "packed")) {
 		if (fido_get_signed_hash(COSE_ES256, &dgst, &cred->cdh,
-		    &cred->authdata_cbor) < 0) {
+		    &cred->authdata_raw) < 0) {
 			fido_log_debug("%s: fido_get_signed_hash", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto out;
@@ -360,7 +456,7 @@ out:
 int
 fido_cred_verify_self(const fido_cred_t *cred)
 {
-	unsigned char	buf[1024]; /* XXX */
+	unsigned char	buf[SHA256_DIGEST_LENGTH];
 	fido_blob_t	dgst;
 	int		ok = -1;
 	int		r;
@@ -372,7 +468,7 @@ fido_cred_verify_self(const fido_cred_t *cred)
 	if (cred->cdh.ptr == NULL || cred->authdata_cbor.ptr == NULL ||
 	    cred->attstmt.x5c.ptr != NULL || cred->attstmt.sig.ptr == NULL ||
 	    cred->fmt == NULL || cred->attcred.id.ptr == NULL ||
-	    cred->rp.id == NULL) {
+	    cred->rp_id_hash_set == false) {
 		fido_log_debug("%s: cdh=%p, authdata=%p, x5c=%p, sig=%p, "
 		    "fmt=%p id=%p, rp.id=%s", __func__, (void *)cred->cdh.ptr,
 		    (void *)cred->authdata_cbor.ptr,
@@ -383,7 +479,8 @@ fido_cred_verify_self(const fido_cred_t *cred)
 		goto out;
 	}
 
-	if (fido_check_rp_id(cred->rp.id, cred->authdata.rp_id_hash) != 0) {
+	if (fido_check_rp_id(cred->rp_id_hash,
+	    cred->authdata.rp_id_hash) != 0) {
 		fido_log_debug("%s: fido_check_rp_id", __func__);
 		r = FIDO_ERR_INVALID_PARAM;
 		goto out;
@@ -412,7 +509,7 @@ fido_cred_verify_self(const fido_cred_t *cred)
 
 	if (!strcmp(cred->fmt, "packed")) {
 		if (fido_get_signed_hash(cred->attcred.type, &dgst, &cred->cdh,
-		    &cred->authdata_cbor) < 0) {
+		    &cred->authdata_raw) < 0) {
 			fido_log_debug("%s: fido_get_signed_hash", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto out;
@@ -453,6 +550,8 @@ fido_cred_verify_self(const fido_cred_t *cred)
 		r = FIDO_OK;
 
 out:
+	if (dgst.ptr != buf)
+		free(dgst.ptr);
 	explicit_bzero(buf, sizeof(buf));
 
 	return (r);
@@ -492,9 +591,11 @@ fido_cred_reset_tx(fido_cred_t *cred)
 
 	memset(&cred->cdh, 0, sizeof(cred->cdh));
 	memset(&cred->rp, 0, sizeof(cred->rp));
+	memset(cred->rp_id_hash, 0, sizeof(cred->rp_id_hash));
 	memset(&cred->user, 0, sizeof(cred->user));
 	memset(&cred->excl, 0, sizeof(cred->excl));
 	memset(&cred->ext, 0, sizeof(cred->ext));
+	cred->rp_id_hash_set = false;
 
 	cred->type = 0;
 	cred->rk = FIDO_OPT_OMIT;
@@ -713,11 +814,17 @@ fido_cred_set_rp(fido_cred_t *cred, const char *id, const char *name)
 		rp->name = NULL;
 	}
 
-	if (id != NULL && (rp->id = strdup(id)) == NULL)
+	explicit_bzero(cred->rp_id_hash, sizeof(cred->rp_id_hash));
+	cred->rp_id_hash_set = false;
+
+	if (id != NULL && ((rp->id = strdup(id)) == NULL ||
+	    fido_hash_rp_id(id, cred->rp_id_hash) < 0))
 		goto fail;
 	if (name != NULL && (rp->name = strdup(name)) == NULL)
 		goto fail;
 
+	cred->rp_id_hash_set = (id != NULL);
+
 	return (FIDO_OK);
 fail:
 	free(rp->id);
@@ -728,6 +835,32 @@ fail:
 	return (FIDO_ERR_INTERNAL);
 }
 
+int
+fido_cred_set_rp_id_hash(fido_cred_t *cred, const unsigned char *ptr,
+    size_t len)
+{
+	/* the hash of an id set by fido_cred_set_rp() must not change */
+	if (cred->rp.id != NULL) {
+		if (ptr == NULL || len != sizeof(cred->rp_id_hash) ||
+		    timingsafe_bcmp(ptr, cred->rp_id_hash, len) != 0) {
+			fido_log_debug("%s: rp id mismatch", __func__);
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		}
+		return (FIDO_OK);
+	}
+
+	explicit_bzero(cred->rp_id_hash, sizeof(cred->rp_id_hash));
+	cred->rp_id_hash_set = false;
+
+	if (ptr == NULL || len != sizeof(cred->rp_id_hash))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memcpy(cred->rp_id_hash, ptr, len);
+	cred->rp_id_hash_set = true;
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_set_user(fido_cred_t *cred, const unsigned char *user_id,
     size_t user_id_len, const char *name, const char *display_name,
@@ -979,7 +1112,8 @@ fido_cred_pubkey_len(const fido_cred_t *cred)
 
 	switch (cred->attcred.type) {
 	case COSE_ES256:
-		len = sizeof(cred->attcred.pubkey.es256);
+		len = sizeof(cred->attcred.pubkey.es256.x) +
+		    sizeof(cred->attcred.pubkey.es256.y);
 		break;
 	case COSE_RS256:
 		len = sizeof(cred->attcred.pubkey.rs256);
@@ -17,6 +17,112 @@
 #define CMD_RK_NEXT		0x05
 #define CMD_DELETE_CRED		0x06
 
+/*
+ * The replies to an enumeration of the authenticator's relying parties,
+ * or of the credentials of one relying party, kept in the device handle
+ * when caching is enabled. An enumeration is replayed by parsing its
+ * replies again for as long as the credential metadata reported by the
+ * authenticator is unchanged, and the handle has not been used to create
+ * or delete a credential.
+ */
+typedef struct credman_enum {
+	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH]; /* rk only */
+	fido_blob_t	*reply;
+	size_t		 nreply;
+} credman_enum_t;
+
+struct credman_cache {
+	fido_credman_metadata_t	 metadata; /* metadata at enumeration */
+	bool			 valid;    /* metadata is set */
+	credman_enum_t		 rp;       /* relying parties */
+	credman_enum_t		*rk;       /* credentials, per relying party */
+	size_t			 nrk;
+};
+
+static void
+credman_enum_reset(credman_enum_t *e)
+{
+	for (size_t i = 0; i < e->nreply; i++)
+		fido_blob_reset(&e->reply[i]);
+
+	free(e->reply);
+	explicit_bzero(e, sizeof(*e));
+}
+
+static int
+credman_enum_append(credman_enum_t *e, const unsigned char *ptr, size_t len)
+{
+	fido_blob_t *reply;
+
+	if (e->nreply == SIZE_MAX || (reply = recallocarray(e->reply,
+	    e->nreply, e->nreply + 1, sizeof(*reply))) == NULL)
+		return (-1);
+
+	e->reply = reply;
+
+	if (fido_blob_set(&e->reply[e->nreply], ptr, len) < 0)
+		return (-1);
+
+	e->nreply++;
+
+	return (0);
+}
+
+void
+fido_credman_cache_reset(struct credman_cache *c)
+{
+	if (c == NULL)
+		return;
+
+	credman_enum_reset(&c->rp);
+	for (size_t i = 0; i < c->nrk; i++)
+		credman_enum_reset(&c->rk[i]);
+
+	free(c->rk);
+	explicit_bzero(c, sizeof(*c));
+}
+
+void
+fido_credman_cache_free(struct credman_cache **cp)
+{
+	struct credman_cache *c;
+
+	if (cp == NULL || (c = *cp) == NULL)
+		return;
+	fido_credman_cache_reset(c);
+	free(c);
+
+	*cp = NULL;
+}
+
+static const credman_enum_t *
+credman_cache_lookup_rk(const struct credman_cache *c, const unsigned char *dgst)
+{
+	for (size_t i = 0; i < c->nrk; i++)
+		if (memcmp(c->rk[i].rp_id_hash, dgst,
+		    sizeof(c->rk[i].rp_id_hash)) == 0)
+			return (&c->rk[i]);
+
+	return (NULL);
+}
+
+static int
+credman_cache_store_rk(struct credman_cache *c, credman_enum_t *e)
+{
+	credman_enum_t *rk;
+
+	if (c->nrk == SIZE_MAX || (rk = recallocarray(c->rk, c->nrk,
+	    c->nrk + 1, sizeof(*rk))) == NULL)
+		return (-1);
+
+	/* hand the replies over to the cache */
+	c->rk = rk;
+	c->rk[c->nrk++] = *e;
+	memset(e, 0, sizeof(*e));
+
+	return (0);
+}
+
 static int
 credman_grow_array(void **ptr, size_t *n_alloc, size_t *n_rx, size_t n,
     size_t size)
@@ -97,13 +203,50 @@ fail:
 }
 
 static int
-credman_tx(fido_dev_t *dev, uint8_t subcmd, const fido_blob_t *param,
-    const char *pin, const char *rp_id)
+credman_get_token(fido_dev_t *dev, const char *pin, const char *rp_id,
+    fido_blob_t **token)
 {
-	fido_blob_t	 f;
 	fido_blob_t	*ecdh = NULL;
-	fido_blob_t	 hmac;
 	es256_pk_t	*pk = NULL;
+	int		 r;
+
+	if ((*token = fido_blob_new()) == NULL) {
+		fido_log_debug("%s: fido_blob_new", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
+		fido_log_debug("%s: fido_do_ecdh", __func__);
+		goto fail;
+	}
+	if ((r = fido_dev_get_uv_token(dev, CTAP_CBOR_CRED_MGMT_PRE, pin,
+	    ecdh, pk, rp_id, *token)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_get_uv_token", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_blob_free(token);
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	return (r);
+}
+
+/*
+ * Transmit a credential management subcommand, authenticated with token
+ * if not NULL. A token can be reused for as long as the authenticator
+ * keeps it, which saves a key agreement and a token request per
+ * subcommand when walking or modifying many credentials.
+ */
+static int
+credman_tx_token(fido_dev_t *dev, uint8_t subcmd, const fido_blob_t *param,
+    const fido_blob_t *token)
+{
+	fido_blob_t	 f;
+	fido_blob_t	 hmac;
 	cbor_item_t	*argv[4];
 	const uint8_t	 cmd = CTAP_CBOR_CRED_MGMT_PRE;
 	int		 r = FIDO_ERR_INTERNAL;
@@ -119,18 +262,15 @@ credman_tx(fido_dev_t *dev, uint8_t subcmd, const fido_blob_t *param,
 	}
 
 	/* pinProtocol, pinAuth */
-	if (fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT)) {
+	if (token != NULL) {
 		if (credman_prepare_hmac(subcmd, param, &argv[1], &hmac) < 0) {
 			fido_log_debug("%s: credman_prepare_hmac", __func__);
 			goto fail;
 		}
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
-			goto fail;
-		}
-		if ((r = cbor_add_uv_params(dev, cmd, &hmac, pk, ecdh, pin,
-		    rp_id, &argv[3], &argv[2])) != FIDO_OK) {
-			fido_log_debug("%s: cbor_add_uv_params", __func__);
+		if ((argv[3] = cbor_encode_pin_auth(dev, token,
+		    &hmac)) == NULL ||
+		    (argv[2] = cbor_encode_pin_opt(dev)) == NULL) {
+			fido_log_debug("%s: cbor encode", __func__);
 			goto fail;
 		}
 	}
@@ -145,8 +285,6 @@ credman_tx(fido_dev_t *dev, uint8_t subcmd, const fido_blob_t *param,
 
 	r = FIDO_OK;
 fail:
-	es256_pk_free(&pk);
-	fido_blob_free(&ecdh);
 	cbor_vector_free(argv, nitems(argv));
 	free(f.ptr);
 	free(hmac.ptr);
@@ -154,6 +292,25 @@ fail:
 	return (r);
 }
 
+static int
+credman_tx(fido_dev_t *dev, uint8_t subcmd, const fido_blob_t *param,
+    const char *pin, const char *rp_id)
+{
+	fido_blob_t	*token = NULL;
+	int		 r;
+
+	if (fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT) &&
+	    (r = credman_get_token(dev, pin, rp_id, &token)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_token", __func__);
+		return (r);
+	}
+
+	r = credman_tx_token(dev, subcmd, param, token);
+	fido_blob_free(&token);
+
+	return (r);
+}
+
 static int
 credman_parse_metadata(const cbor_item_t *key, const cbor_item_t *val,
     void *arg)
@@ -214,6 +371,39 @@ credman_get_metadata_wait(fido_dev_t *dev, fido_credman_metadata_t *metadata,
 	return (FIDO_OK);
 }
 
+/*
+ * Compare the credential metadata reported by the authenticator with
+ * the one recorded in the cache, and empty the cache if they differ.
+ * The request is authenticated with the caller's token, which is then
+ * reused for the enumeration itself.
+ */
+static int
+credman_cache_check(fido_dev_t *dev, const fido_blob_t *token, int ms)
+{
+	struct credman_cache	*c = dev->credman;
+	fido_credman_metadata_t	 metadata;
+	int			 r;
+
+	if ((r = credman_tx_token(dev, CMD_CRED_METADATA, NULL,
+	    token)) != FIDO_OK ||
+	    (r = credman_rx_metadata(dev, &metadata, ms)) != FIDO_OK) {
+		fido_log_debug("%s: metadata", __func__);
+		return (r);
+	}
+
+	if (c->valid &&
+	    metadata.rk_existing == c->metadata.rk_existing &&
+	    metadata.rk_remaining == c->metadata.rk_remaining)
+		return (FIDO_OK);
+
+	fido_log_debug("%s: stale", __func__);
+	fido_credman_cache_reset(c);
+	c->metadata = metadata;
+	c->valid = true;
+
+	return (FIDO_OK);
+}
+
 int
 fido_credman_get_dev_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata,
     const char *pin)
@@ -305,22 +495,15 @@ credman_parse_rk_count(const cbor_item_t *key, const cbor_item_t *val,
 }
 
 static int
-credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
+credman_parse_rk_first(fido_credman_rk_t *rk, const unsigned char *reply,
+    size_t reply_len)
 {
-	unsigned char	reply[FIDO_MAXMSG];
-	int		reply_len;
-	int		r;
+	int r;
 
 	credman_reset_rk(rk);
 
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
-	}
-
 	/* adjust as needed */
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, rk,
+	if ((r = cbor_parse_reply(reply, reply_len, rk,
 	    credman_parse_rk_count)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rk_count", __func__);
 		return (r);
@@ -332,7 +515,7 @@ credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 	}
 
 	/* parse the first rk */
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, &rk->ptr[0],
+	if ((r = cbor_parse_reply(reply, reply_len, &rk->ptr[0],
 	    credman_parse_rk)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rk", __func__);
 		return (r);
@@ -344,17 +527,10 @@ credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 }
 
 static int
-credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
+credman_parse_rk_next(fido_credman_rk_t *rk, const unsigned char *reply,
+    size_t reply_len)
 {
-	unsigned char	reply[FIDO_MAXMSG];
-	int		reply_len;
-	int		r;
-
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
-	}
+	int r;
 
 	/* sanity check */
 	if (rk->n_rx >= rk->n_alloc) {
@@ -363,7 +539,7 @@ credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, &rk->ptr[rk->n_rx],
+	if ((r = cbor_parse_reply(reply, reply_len, &rk->ptr[rk->n_rx],
 	    credman_parse_rk)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rk", __func__);
 		return (r);
@@ -372,13 +548,100 @@ credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int ms)
 	return (FIDO_OK);
 }
 
+/*
+ * Receive a reply to an enumeration subcommand into reply, and record
+ * it in rec, if not NULL.
+ */
+static int
+credman_rx_enum(fido_dev_t *dev, unsigned char *reply, size_t reply_max,
+    credman_enum_t *rec, int ms)
+{
+	int reply_len;
+
+	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, reply, reply_max,
+	    ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (-1);
+	}
+
+	if (rec != NULL && credman_enum_append(rec, reply,
+	    (size_t)reply_len) < 0) {
+		fido_log_debug("%s: credman_enum_append", __func__);
+		return (-1);
+	}
+
+	return (reply_len);
+}
+
+static int
+credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, credman_enum_t *rec,
+    int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+
+	if ((reply_len = credman_rx_enum(dev, reply, sizeof(reply), rec,
+	    ms)) < 0) {
+		fido_log_debug("%s: credman_rx_enum", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (credman_parse_rk_first(rk, reply, (size_t)reply_len));
+}
+
+static int
+credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk,
+    credman_enum_t *rec, int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+
+	if ((reply_len = credman_rx_enum(dev, reply, sizeof(reply), rec,
+	    ms)) < 0) {
+		fido_log_debug("%s: credman_rx_enum", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (credman_parse_rk_next(rk, reply, (size_t)reply_len));
+}
+
+static int
+credman_replay_rk(const credman_enum_t *e, fido_credman_rk_t *rk)
+{
+	int r;
+
+	if (e->nreply == 0) {
+		fido_log_debug("%s: nreply=0", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if ((r = credman_parse_rk_first(rk, e->reply[0].ptr,
+	    e->reply[0].len)) != FIDO_OK)
+		return (r);
+
+	for (size_t i = 1; i < e->nreply; i++) {
+		if ((r = credman_parse_rk_next(rk, e->reply[i].ptr,
+		    e->reply[i].len)) != FIDO_OK)
+			return (r);
+		rk->n_rx++;
+	}
+
+	return (FIDO_OK);
+}
+
 static int
 credman_get_rk_wait(fido_dev_t *dev, const char *rp_id, fido_credman_rk_t *rk,
     const char *pin, int ms)
 {
-	fido_blob_t	rp_dgst;
-	uint8_t		dgst[SHA256_DIGEST_LENGTH];
-	int		r;
+	const credman_enum_t	*cached;
+	credman_enum_t		 rec;
+	credman_enum_t		*recp = NULL;
+	fido_blob_t		*token = NULL;
+	fido_blob_t		 rp_dgst;
+	uint8_t			 dgst[SHA256_DIGEST_LENGTH];
+	int			 r;
+
+	memset(&rec, 0, sizeof(rec));
 
 	if (SHA256((const unsigned char *)rp_id, strlen(rp_id), dgst) != dgst) {
 		fido_log_debug("%s: sha256", __func__);
@@ -388,18 +651,56 @@ credman_get_rk_wait(fido_dev_t *dev, const char *rp_id, fido_credman_rk_t *rk,
 	rp_dgst.ptr = dgst;
 	rp_dgst.len = sizeof(dgst);
 
-	if ((r = credman_tx(dev, CMD_RK_BEGIN, &rp_dgst, pin, rp_id)) != FIDO_OK ||
-	    (r = credman_rx_rk(dev, rk, ms)) != FIDO_OK)
-		return (r);
+	/*
+	 * With the cache, the token is also used for the metadata check,
+	 * which does not accept tokens bound to a relying party.
+	 */
+	if (fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT) &&
+	    (r = credman_get_token(dev, pin, dev->credman != NULL ? NULL :
+	    rp_id, &token)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_token", __func__);
+		goto fail;
+	}
+
+	if (dev->credman != NULL) {
+		if ((r = credman_cache_check(dev, token, ms)) != FIDO_OK)
+			goto fail;
+		if ((cached = credman_cache_lookup_rk(dev->credman,
+		    dgst)) != NULL) {
+			r = credman_replay_rk(cached, rk);
+			goto fail;
+		}
+		memcpy(rec.rp_id_hash, dgst, sizeof(rec.rp_id_hash));
+		recp = &rec;
+	}
+
+	if ((r = credman_tx_token(dev, CMD_RK_BEGIN, &rp_dgst,
+	    token)) != FIDO_OK ||
+	    (r = credman_rx_rk(dev, rk, recp, ms)) != FIDO_OK)
+		goto fail;
 
 	while (rk->n_rx < rk->n_alloc) {
-		if ((r = credman_tx(dev, CMD_RK_NEXT, NULL, NULL, NULL)) != FIDO_OK ||
-		    (r = credman_rx_next_rk(dev, rk, ms)) != FIDO_OK)
-			return (r);
+		if ((r = credman_tx_token(dev, CMD_RK_NEXT, NULL,
+		    NULL)) != FIDO_OK ||
+		    (r = credman_rx_next_rk(dev, rk, recp, ms)) != FIDO_OK)
+			goto fail;
 		rk->n_rx++;
 	}
 
-	return (FIDO_OK);
+	if (recp != NULL && credman_cache_store_rk(dev->credman, recp) < 0) {
+		fido_log_debug("%s: credman_cache_store_rk", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_credman_cache_reset(dev->credman);
+	credman_enum_reset(&rec);
+	fido_blob_free(&token);
+
+	return (r);
 }
 
 int
@@ -426,6 +727,8 @@ credman_del_rk_wait(fido_dev_t *dev, const unsigned char *cred_id,
 	if (fido_blob_set(&cred, cred_id, cred_id_len) < 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
+	fido_credman_cache_reset(dev->credman);
+
 	if ((r = credman_tx(dev, CMD_DELETE_CRED, &cred, pin, NULL)) != FIDO_OK ||
 	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK)
 		goto fail;
@@ -449,6 +752,92 @@ fido_credman_del_dev_rk(fido_dev_t *dev, const unsigned char *cred_id,
 	return (credman_del_rk_wait(dev, cred_id, cred_id_len, pin, -1));
 }
 
+/*
+ * Transport failures and a rejected or expired token affect every
+ * deletion that would follow under the same token.
+ */
+static bool
+credman_del_rk_fatal(int r)
+{
+	switch (r) {
+	case FIDO_ERR_TX:
+	case FIDO_ERR_RX:
+	case FIDO_ERR_PIN_AUTH_INVALID:
+	case FIDO_ERR_PIN_TOKEN_EXPIRED:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+/*
+ * Delete n credentials under a single PIN/UV auth token. The auth
+ * parameter of each deletion still covers its own credential id, but
+ * the key agreement and token request are done once.
+ */
+static int
+credman_del_rk_batch_wait(fido_dev_t *dev, const unsigned char *const *cred_id,
+    const size_t *cred_id_len, size_t n, int *status, bool stop_on_error,
+    const char *pin, int ms)
+{
+	fido_blob_t	 cred;
+	fido_blob_t	*token = NULL;
+	int		 first = FIDO_OK;
+	int		 r;
+
+	memset(&cred, 0, sizeof(cred));
+
+	fido_credman_cache_reset(dev->credman);
+
+	if ((r = credman_get_token(dev, pin, NULL, &token)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_token", __func__);
+		for (size_t i = 0; i < n; i++)
+			status[i] = r;
+		return (r);
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (cred_id[i] == NULL ||
+		    fido_blob_set(&cred, cred_id[i], cred_id_len[i]) < 0)
+			r = FIDO_ERR_INVALID_ARGUMENT;
+		else if ((r = credman_tx_token(dev, CMD_DELETE_CRED, &cred,
+		    token)) == FIDO_OK)
+			r = fido_rx_cbor_status(dev, ms);
+
+		fido_blob_reset(&cred);
+
+		if ((status[i] = r) != FIDO_OK) {
+			fido_log_debug("%s: i=%zu, r=%d", __func__, i, r);
+			if (first == FIDO_OK)
+				first = r;
+			if (stop_on_error || credman_del_rk_fatal(r)) {
+				while (++i < n)
+					status[i] = r;
+				break;
+			}
+		}
+	}
+
+	fido_blob_free(&token);
+
+	return (first);
+}
+
+int
+fido_credman_del_dev_rk_batch(fido_dev_t *dev,
+    const unsigned char *const *cred_id, const size_t *cred_id_len, size_t n,
+    int *status, bool stop_on_error, const char *pin)
+{
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (!fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT) ||
+	    cred_id == NULL || cred_id_len == NULL || status == NULL || n == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (credman_del_rk_batch_wait(dev, cred_id, cred_id_len, n, status,
+	    stop_on_error, pin, -1));
+}
+
 static int
 credman_parse_rp(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 {
@@ -519,22 +908,15 @@ credman_parse_rp_count(const cbor_item_t *key, const cbor_item_t *val,
 }
 
 static int
-credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
+credman_parse_rp_first(fido_credman_rp_t *rp, const unsigned char *reply,
+    size_t reply_len)
 {
-	unsigned char	reply[FIDO_MAXMSG];
-	int		reply_len;
-	int		r;
+	int r;
 
 	credman_reset_rp(rp);
 
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
-	}
-
 	/* adjust as needed */
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, rp,
+	if ((r = cbor_parse_reply(reply, reply_len, rp,
 	    credman_parse_rp_count)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp_count", __func__);
 		return (r);
@@ -546,7 +928,7 @@ credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 	}
 
 	/* parse the first rp */
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, &rp->ptr[0],
+	if ((r = cbor_parse_reply(reply, reply_len, &rp->ptr[0],
 	    credman_parse_rp)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp", __func__);
 		return (r);
@@ -558,17 +940,10 @@ credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 }
 
 static int
-credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
+credman_parse_rp_next(fido_credman_rp_t *rp, const unsigned char *reply,
+    size_t reply_len)
 {
-	unsigned char	reply[FIDO_MAXMSG];
-	int		reply_len;
-	int		r;
-
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		return (FIDO_ERR_RX);
-	}
+	int r;
 
 	/* sanity check */
 	if (rp->n_rx >= rp->n_alloc) {
@@ -577,7 +952,7 @@ credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, &rp->ptr[rp->n_rx],
+	if ((r = cbor_parse_reply(reply, reply_len, &rp->ptr[rp->n_rx],
 	    credman_parse_rp)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp", __func__);
 		return (r);
@@ -587,18 +962,54 @@ credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int ms)
 }
 
 static int
-credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin,
+credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, credman_enum_t *rec,
     int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+
+	if ((reply_len = credman_rx_enum(dev, reply, sizeof(reply), rec,
+	    ms)) < 0) {
+		fido_log_debug("%s: credman_rx_enum", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (credman_parse_rp_first(rp, reply, (size_t)reply_len));
+}
+
+static int
+credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp,
+    credman_enum_t *rec, int ms)
+{
+	unsigned char	reply[FIDO_MAXMSG];
+	int		reply_len;
+
+	if ((reply_len = credman_rx_enum(dev, reply, sizeof(reply), rec,
+	    ms)) < 0) {
+		fido_log_debug("%s: credman_rx_enum", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (credman_parse_rp_next(rp, reply, (size_t)reply_len));
+}
+
+static int
+credman_replay_rp(const credman_enum_t *e, fido_credman_rp_t *rp)
 {
 	int r;
 
-	if ((r = credman_tx(dev, CMD_RP_BEGIN, NULL, pin, NULL)) != FIDO_OK ||
-	    (r = credman_rx_rp(dev, rp, ms)) != FIDO_OK)
+	if (e->nreply == 0) {
+		fido_log_debug("%s: nreply=0", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if ((r = credman_parse_rp_first(rp, e->reply[0].ptr,
+	    e->reply[0].len)) != FIDO_OK)
 		return (r);
 
-	while (rp->n_rx < rp->n_alloc) {
-		if ((r = credman_tx(dev, CMD_RP_NEXT, NULL, NULL, NULL)) != FIDO_OK ||
-		    (r = credman_rx_next_rp(dev, rp, ms)) != FIDO_OK)
+	for (size_t i = 1; i < e->nreply; i++) {
+		if ((r = credman_parse_rp_next(rp, e->reply[i].ptr,
+		    e->reply[i].len)) != FIDO_OK)
 			return (r);
 		rp->n_rx++;
 	}
@@ -606,6 +1017,61 @@ credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin,
 	return (FIDO_OK);
 }
 
+static int
+credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin,
+    int ms)
+{
+	credman_enum_t	 rec;
+	credman_enum_t	*recp = NULL;
+	fido_blob_t	*token = NULL;
+	int		 r;
+
+	memset(&rec, 0, sizeof(rec));
+
+	if (fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT) &&
+	    (r = credman_get_token(dev, pin, NULL, &token)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_token", __func__);
+		goto fail;
+	}
+
+	if (dev->credman != NULL) {
+		if ((r = credman_cache_check(dev, token, ms)) != FIDO_OK)
+			goto fail;
+		if (dev->credman->rp.nreply != 0) {
+			r = credman_replay_rp(&dev->credman->rp, rp);
+			goto fail;
+		}
+		recp = &rec;
+	}
+
+	if ((r = credman_tx_token(dev, CMD_RP_BEGIN, NULL, token)) != FIDO_OK ||
+	    (r = credman_rx_rp(dev, rp, recp, ms)) != FIDO_OK)
+		goto fail;
+
+	while (rp->n_rx < rp->n_alloc) {
+		if ((r = credman_tx_token(dev, CMD_RP_NEXT, NULL,
+		    NULL)) != FIDO_OK ||
+		    (r = credman_rx_next_rp(dev, rp, recp, ms)) != FIDO_OK)
+			goto fail;
+		rp->n_rx++;
+	}
+
+	if (recp != NULL) {
+		/* hand the replies over to the cache */
+		dev->credman->rp = rec;
+		memset(&rec, 0, sizeof(rec));
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_credman_cache_reset(dev->credman);
+	credman_enum_reset(&rec);
+	fido_blob_free(&token);
+
+	return (r);
+}
+
 int
 fido_credman_get_dev_rp(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin)
 {
@@ -617,6 +1083,127 @@ fido_credman_get_dev_rp(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin)
 	return (credman_get_rp_wait(dev, rp, pin, -1));
 }
 
+/*
+ * Move the credentials received in rk to the end of all, recording the
+ * relying party they belong to.
+ */
+static int
+credman_append_rk(fido_credman_rk_t *all, fido_credman_rk_t *rk,
+    const struct fido_credman_single_rp *rp)
+{
+	fido_cred_t	*ptr;
+	size_t		 n;
+
+	if (rk->n_rx == 0)
+		return (FIDO_OK);
+
+	if (all->n_alloc > SIZE_MAX - rk->n_rx ||
+	    (ptr = recallocarray(all->ptr, all->n_alloc, all->n_alloc +
+	    rk->n_rx, sizeof(*ptr))) == NULL) {
+		fido_log_debug("%s: recallocarray", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	all->ptr = ptr;
+	n = all->n_alloc;
+	all->n_alloc += rk->n_rx;
+
+	for (size_t i = 0; i < rk->n_rx; i++) {
+		all->ptr[n + i] = rk->ptr[i];
+		memset(&rk->ptr[i], 0, sizeof(rk->ptr[i]));
+		all->n_rx++;
+		if (fido_cred_set_rp(&all->ptr[n + i], rp->rp_entity.id,
+		    rp->rp_entity.name) != FIDO_OK) {
+			fido_log_debug("%s: fido_cred_set_rp", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Walk every relying party and its credentials under a single PIN/UV
+ * auth token, instead of one per fido_credman_get_dev_rp() and
+ * fido_credman_get_dev_rk() call. Credentials are enumerated by the
+ * relying party id hash reported by the authenticator, so relying
+ * parties whose id was truncated are enumerated as well.
+ */
+static int
+credman_get_all_wait(fido_dev_t *dev, fido_credman_rk_t *all,
+    const char *pin, int ms)
+{
+	fido_credman_rp_t	*rp = NULL;
+	fido_credman_rk_t	*rk = NULL;
+	fido_blob_t		*token = NULL;
+	int			 r;
+
+	credman_reset_rk(all);
+
+	if ((rp = fido_credman_rp_new()) == NULL ||
+	    (rk = fido_credman_rk_new()) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if ((r = credman_get_token(dev, pin, NULL, &token)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_token", __func__);
+		goto fail;
+	}
+
+	if ((r = credman_tx_token(dev, CMD_RP_BEGIN, NULL, token)) != FIDO_OK ||
+	    (r = credman_rx_rp(dev, rp, NULL, ms)) != FIDO_OK)
+		goto fail;
+
+	while (rp->n_rx < rp->n_alloc) {
+		if ((r = credman_tx_token(dev, CMD_RP_NEXT, NULL,
+		    NULL)) != FIDO_OK ||
+		    (r = credman_rx_next_rp(dev, rp, NULL, ms)) != FIDO_OK)
+			goto fail;
+		rp->n_rx++;
+	}
+
+	for (size_t i = 0; i < rp->n_rx; i++) {
+		if ((r = credman_tx_token(dev, CMD_RK_BEGIN,
+		    &rp->ptr[i].rp_id_hash, token)) != FIDO_OK ||
+		    (r = credman_rx_rk(dev, rk, NULL, ms)) != FIDO_OK)
+			goto fail;
+		while (rk->n_rx < rk->n_alloc) {
+			if ((r = credman_tx_token(dev, CMD_RK_NEXT, NULL,
+			    NULL)) != FIDO_OK ||
+			    (r = credman_rx_next_rk(dev, rk, NULL,
+			    ms)) != FIDO_OK)
+				goto fail;
+			rk->n_rx++;
+		}
+		if ((r = credman_append_rk(all, rk, &rp->ptr[i])) != FIDO_OK)
+			goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		credman_reset_rk(all);
+	fido_credman_rp_free(&rp);
+	fido_credman_rk_free(&rk);
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+int
+fido_credman_get_dev_all(fido_dev_t *dev, fido_credman_rk_t *rk,
+    const char *pin)
+{
+	if (fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_COMMAND);
+	if (fido_dev_can_get_uv_token(dev, pin, FIDO_OPT_OMIT) == false)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (credman_get_all_wait(dev, rk, pin, -1));
+}
+
 fido_credman_rk_t *
 fido_credman_rk_new(void)
 {
@@ -741,3 +1328,18 @@ fido_credman_rp_id_hash_ptr(const fido_credman_rp_t *rp, size_t idx)
 
 	return (rp->ptr[idx].rp_id_hash.ptr);
 }
+
+int
+fido_credman_set_dev_cache(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_credman_cache_free(&dev->credman);
+		return (FIDO_OK);
+	}
+
+	if (dev->credman == NULL && (dev->credman = calloc(1,
+	    sizeof(*dev->credman))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
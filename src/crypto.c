@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#endif
+
+#include "fido.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static int
+EVP_CIPHER_CTX_reset(EVP_CIPHER_CTX *ctx)
+{
+	return (EVP_CIPHER_CTX_cleanup(ctx));
+}
+#endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
+
+/*
+ * Cipher and HMAC contexts are kept per device, so that loops over
+ * hmac-secret outputs, large-blob entries and PIN/UV auth parameters do
+ * not allocate new state on every call. The contexts are allocated with
+ * the device and reset after each use, which clears any key material
+ * they hold. With OpenSSL 3, the device also holds the SHA-256 and
+ * AES-256 algorithms, fetched once when the device is allocated, and an
+ * HMAC-SHA256 context, which is rekeyed by EVP_MAC_init() on each use.
+ * EVP_MAC_CTX cannot be reset, so the last HMAC key stays in the context
+ * until the next use or until the device is freed.
+ */
+struct fido_crypto {
+	EVP_CIPHER_CTX	*cipher;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MD		*sha256;
+	EVP_CIPHER	*aes_256_cbc;
+	EVP_CIPHER	*aes_256_gcm;
+	EVP_MAC_CTX	*hmac;
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX	*hmac;
+#endif
+};
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+static EVP_MAC_CTX *
+hmac_sha256_new(void)
+{
+	EVP_MAC		*mac;
+	EVP_MAC_CTX	*ctx = NULL;
+	OSSL_PARAM	 params[2];
+	char		 digest[] = "SHA256";
+
+	if ((mac = EVP_MAC_fetch(NULL, "HMAC", NULL)) == NULL) {
+		fido_log_debug("%s: EVP_MAC_fetch", __func__);
+		return (NULL);
+	}
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+	    digest, 0);
+	params[1] = OSSL_PARAM_construct_end();
+
+	if ((ctx = EVP_MAC_CTX_new(mac)) == NULL ||
+	    EVP_MAC_CTX_set_params(ctx, params) == 0) {
+		fido_log_debug("%s: EVP_MAC_CTX", __func__);
+		EVP_MAC_CTX_free(ctx);
+		ctx = NULL;
+	}
+
+	EVP_MAC_free(mac);
+
+	return (ctx);
+}
+#endif
+
+struct fido_crypto *
+fido_crypto_new(void)
+{
+	struct fido_crypto *c;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+		return (NULL);
+
+	if ((c->cipher = EVP_CIPHER_CTX_new()) == NULL)
+		goto fail;
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if ((c->sha256 = EVP_MD_fetch(NULL, "SHA256", NULL)) == NULL ||
+	    (c->aes_256_cbc = EVP_CIPHER_fetch(NULL, "AES-256-CBC",
+	    NULL)) == NULL ||
+	    (c->aes_256_gcm = EVP_CIPHER_fetch(NULL, "AES-256-GCM",
+	    NULL)) == NULL) {
+		fido_log_debug("%s: fetch", __func__);
+		goto fail;
+	}
+	if ((c->hmac = hmac_sha256_new()) == NULL)
+		goto fail;
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if ((c->hmac = HMAC_CTX_new()) == NULL)
+		goto fail;
+#endif
+
+	return (c);
+fail:
+	fido_crypto_free(&c);
+
+	return (NULL);
+}
+
+void
+fido_crypto_reset(struct fido_crypto *c)
+{
+	if (c == NULL)
+		return;
+	if (c->cipher != NULL)
+		EVP_CIPHER_CTX_reset(c->cipher);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+    (OPENSSL_VERSION_NUMBER < 0x30000000L || defined(LIBRESSL_VERSION_NUMBER))
+	if (c->hmac != NULL)
+		HMAC_CTX_reset(c->hmac);
+#endif
+}
+
+void
+fido_crypto_free(struct fido_crypto **cp)
+{
+	struct fido_crypto *c;
+
+	if (cp == NULL || (c = *cp) == NULL)
+		return;
+	if (c->cipher != NULL)
+		EVP_CIPHER_CTX_free(c->cipher);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	EVP_MD_free(c->sha256);
+	EVP_CIPHER_free(c->aes_256_cbc);
+	EVP_CIPHER_free(c->aes_256_gcm);
+	if (c->hmac != NULL)
+		EVP_MAC_CTX_free(c->hmac);
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (c->hmac != NULL)
+		HMAC_CTX_free(c->hmac);
+#endif
+	free(c);
+
+	*cp = NULL;
+}
+
+const EVP_MD *
+fido_crypto_sha256(const fido_dev_t *dev)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (dev != NULL && dev->crypto != NULL)
+		return (dev->crypto->sha256);
+#else
+	(void)dev;
+#endif
+	return (EVP_sha256());
+}
+
+const EVP_CIPHER *
+fido_crypto_aes_256_cbc(const fido_dev_t *dev)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (dev != NULL && dev->crypto != NULL)
+		return (dev->crypto->aes_256_cbc);
+#else
+	(void)dev;
+#endif
+	return (EVP_aes_256_cbc());
+}
+
+const EVP_CIPHER *
+fido_crypto_aes_256_gcm(const fido_dev_t *dev)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+	if (dev != NULL && dev->crypto != NULL)
+		return (dev->crypto->aes_256_gcm);
+#else
+	(void)dev;
+#endif
+	return (EVP_aes_256_gcm());
+}
+
+EVP_CIPHER_CTX *
+fido_crypto_cipher_ctx(const fido_dev_t *dev)
+{
+	if (dev == NULL || dev->crypto == NULL)
+		return (EVP_CIPHER_CTX_new());
+
+	return (dev->crypto->cipher);
+}
+
+void
+fido_crypto_cipher_ctx_done(const fido_dev_t *dev, EVP_CIPHER_CTX *ctx)
+{
+	if (ctx == NULL)
+		return;
+	if (dev != NULL && dev->crypto != NULL && dev->crypto->cipher == ctx)
+		EVP_CIPHER_CTX_reset(ctx);
+	else
+		EVP_CIPHER_CTX_free(ctx);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+int
+fido_hmac_sha256(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *data, size_t n, unsigned char *dgst)
+{
+	EVP_MAC_CTX	*ctx = NULL;
+	size_t		 dgst_len;
+	int		 ok = -1;
+
+	if (dev != NULL && dev->crypto != NULL)
+		ctx = dev->crypto->hmac;
+	else
+		ctx = hmac_sha256_new();
+
+	if (ctx == NULL || EVP_MAC_init(ctx, key->ptr, key->len, NULL) == 0) {
+		fido_log_debug("%s: EVP_MAC_init", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (EVP_MAC_update(ctx, data[i].ptr, data[i].len) == 0) {
+			fido_log_debug("%s: EVP_MAC_update", __func__);
+			goto fail;
+		}
+
+	if (EVP_MAC_final(ctx, dgst, &dgst_len, SHA256_DIGEST_LENGTH) == 0 ||
+	    dgst_len != SHA256_DIGEST_LENGTH) {
+		fido_log_debug("%s: EVP_MAC_final", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (dev == NULL || dev->crypto == NULL || dev->crypto->hmac != ctx)
+		EVP_MAC_CTX_free(ctx);
+
+	return (ok);
+}
+#elif OPENSSL_VERSION_NUMBER >= 0x10100000L
+int
+fido_hmac_sha256(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *data, size_t n, unsigned char *dgst)
+{
+	HMAC_CTX	*ctx = NULL;
+	const EVP_MD	*md;
+	unsigned int	 dgst_len;
+	int		 ok = -1;
+
+	if (key->len > INT_MAX) {
+		fido_log_debug("%s: key->len=%zu", __func__, key->len);
+		return (-1);
+	}
+
+	if (dev != NULL && dev->crypto != NULL)
+		ctx = dev->crypto->hmac;
+	else
+		ctx = HMAC_CTX_new();
+
+	if (ctx == NULL || (md = fido_crypto_sha256(dev)) == NULL ||
+	    HMAC_Init_ex(ctx, key->ptr, (int)key->len, md, NULL) == 0) {
+		fido_log_debug("%s: HMAC_Init_ex", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (HMAC_Update(ctx, data[i].ptr, data[i].len) == 0) {
+			fido_log_debug("%s: HMAC_Update", __func__);
+			goto fail;
+		}
+
+	if (HMAC_Final(ctx, dgst, &dgst_len) == 0 ||
+	    dgst_len != SHA256_DIGEST_LENGTH) {
+		fido_log_debug("%s: HMAC_Final", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (ctx != NULL && dev != NULL && dev->crypto != NULL &&
+	    dev->crypto->hmac == ctx)
+		HMAC_CTX_reset(ctx);
+	else
+		HMAC_CTX_free(ctx);
+
+	return (ok);
+}
+#else
+int
+fido_hmac_sha256(const fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *data, size_t n, unsigned char *dgst)
+{
+	HMAC_CTX	 ctx;
+	const EVP_MD	*md;
+	unsigned int	 dgst_len;
+	int		 ok = -1;
+
+	(void)dev;
+
+	if (key->len > INT_MAX) {
+		fido_log_debug("%s: key->len=%zu", __func__, key->len);
+		return (-1);
+	}
+
+	HMAC_CTX_init(&ctx);
+
+	if ((md = EVP_sha256()) == NULL ||
+	    HMAC_Init_ex(&ctx, key->ptr, (int)key->len, md, NULL) == 0) {
+		fido_log_debug("%s: HMAC_Init_ex", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (HMAC_Update(&ctx, data[i].ptr, data[i].len) == 0) {
+			fido_log_debug("%s: HMAC_Update", __func__);
+			goto fail;
+		}
+
+	if (HMAC_Final(&ctx, dgst, &dgst_len) == 0 ||
+	    dgst_len != SHA256_DIGEST_LENGTH) {
+		fido_log_debug("%s: HMAC_Final", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	HMAC_CTX_cleanup(&ctx);
+
+	return (ok);
+}
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
@@ -96,9 +96,21 @@ fido_dev_set_protocol_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
 		}
 }
 
+static void
+fido_dev_set_version_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
+{
+	char * const	*ptr = fido_cbor_info_versions_ptr(info);
+	size_t		 len = fido_cbor_info_versions_len(info);
+
+	for (size_t i = 0; i < len; i++)
+		if (strcmp(ptr[i], "FIDO_2_1") == 0)
+			dev->flags |= FIDO_DEV_SELECTION;
+}
+
 static void
 fido_dev_set_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
 {
+	fido_dev_set_version_flags(dev, info);
 	fido_dev_set_extension_flags(dev, info);
 	fido_dev_set_option_flags(dev, info);
 	fido_dev_set_protocol_flags(dev, info);
@@ -221,6 +233,8 @@ fido_dev_open_rx(fido_dev_t *dev, int ms)
 		dev->maxmsgsize = fido_cbor_info_maxmsgsiz(info);
 		fido_log_debug("%s: FIDO_MAXMSG=%d, maxmsgsiz=%lu", __func__,
 		    FIDO_MAXMSG, (unsigned long)dev->maxmsgsize);
+		dev->maxcredcntlst = fido_cbor_info_maxcredcntlst(info);
+		dev->maxcredidlen = fido_cbor_info_maxcredidlen(info);
 	}
 
 	r = FIDO_OK;
@@ -362,6 +376,9 @@ fido_dev_close(fido_dev_t *dev)
 	dev->io.close(dev->io_handle);
 	dev->io_handle = NULL;
 	dev->cid = CTAP_CID_BROADCAST;
+	fido_crypto_reset(dev->crypto);
+	fido_largeblob_cache_reset(dev->largeblob);
+	fido_credman_cache_reset(dev->credman);
 
 	return (FIDO_OK);
 }
@@ -391,6 +408,19 @@ fido_dev_cancel(fido_dev_t *dev)
 	return (FIDO_OK);
 }
 
+static int
+fido_dev_selection_tx(fido_dev_t *dev)
+{
+	const unsigned char cbor[] = { CTAP_CBOR_SELECTION };
+
+	if (fido_tx(dev, CTAP_CMD_CBOR, cbor, sizeof(cbor)) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_get_touch_begin(fido_dev_t *dev)
 {
@@ -411,6 +441,8 @@ fido_dev_get_touch_begin(fido_dev_t *dev)
 
 	if (fido_dev_is_fido2(dev) == false)
 		return (u2f_get_touch_begin(dev));
+	if (fido_dev_supports_selection(dev))
+		return (fido_dev_selection_tx(dev));
 
 	if (SHA256((const void *)clientdata, strlen(clientdata), cdh) != cdh) {
 		fido_log_debug("%s: sha256", __func__);
@@ -539,6 +571,12 @@ fido_dev_new(void)
 	if ((dev = calloc(1, sizeof(*dev))) == NULL)
 		return (NULL);
 
+	if ((dev->crypto = fido_crypto_new()) == NULL) {
+		fido_log_debug("%s: fido_crypto_new", __func__);
+		fido_dev_free(&dev);
+		return (NULL);
+	}
+
 	dev->cid = CTAP_CID_BROADCAST;
 	dev->io = (fido_dev_io_t) {
 		&fido_hid_open,
@@ -558,6 +596,12 @@ fido_dev_new_with_info(const fido_dev_info_t *di)
 	if ((dev = calloc(1, sizeof(*dev))) == NULL)
 		return (NULL);
 
+	if ((dev->crypto = fido_crypto_new()) == NULL) {
+		fido_log_debug("%s: fido_crypto_new", __func__);
+		fido_dev_free(&dev);
+		return (NULL);
+	}
+
 	if (di->io.open == NULL || di->io.close == NULL ||
 	    di->io.read == NULL || di->io.write == NULL) {
 		fido_log_debug("%s: NULL function", __func__);
@@ -587,6 +631,9 @@ fido_dev_free(fido_dev_t **dev_p)
 	if (dev_p == NULL || (dev = *dev_p) == NULL)
 		return;
 
+	fido_crypto_free(&dev->crypto);
+	fido_largeblob_cache_free(&dev->largeblob);
+	fido_credman_cache_free(&dev->credman);
 	free(dev->path);
 	free(dev);
 
@@ -671,6 +718,12 @@ fido_dev_supports_permissions(const fido_dev_t *dev)
 	return (dev->flags & FIDO_DEV_TOKEN_PERMS);
 }
 
+bool
+fido_dev_supports_selection(const fido_dev_t *dev)
+{
+	return (dev->flags & FIDO_DEV_SELECTION);
+}
+
 void
 fido_dev_force_u2f(fido_dev_t *dev)
 {
@@ -700,3 +753,15 @@ fido_dev_maxmsgsize(const fido_dev_t *dev)
 {
 	return (dev->maxmsgsize);
 }
+
+uint64_t
+fido_dev_maxcredcntlst(const fido_dev_t *dev)
+{
+	return (dev->maxcredcntlst);
+}
+
+uint64_t
+fido_dev_maxcredidlen(const fido_dev_t *dev)
+{
+	return (dev->maxcredidlen);
+}
@@ -68,6 +68,16 @@ EVP_MD_CTX_free(EVP_MD_CTX *ctx)
 {
 	(void)ctx;
 }
+
+int
+EVP_MD_CTX_reset(EVP_MD_CTX *ctx)
+{
+	(void)ctx;
+
+	fido_log_debug("%s: unimplemented", __func__);
+
+	return (0);
+}
 #endif /* OPENSSL_VERSION_NUMBER < 0x10100000L */
 
 static int
@@ -6,6 +6,9 @@
 
 #include <openssl/bn.h>
 #include <openssl/obj_mac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+#include <openssl/core_names.h>
+#endif
 
 #include "fido.h"
 #include "fido/es256.h"
@@ -169,15 +172,18 @@ es256_pk_free(es256_pk_t **pkp)
 int
 es256_pk_from_ptr(es256_pk_t *pk, const void *ptr, size_t len)
 {
-	const uint8_t *p = ptr;
+	const uint8_t	*p = ptr;
+	const size_t	 xy_len = sizeof(pk->x) + sizeof(pk->y);
 
-	if (len < sizeof(*pk))
+	if (len < xy_len)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if (len == sizeof(*pk) + 1 && *p == 0x04)
-		memcpy(pk, ++p, sizeof(*pk)); /* uncompressed format */
-	else
-		memcpy(pk, ptr, sizeof(*pk)); /* libfido2 x||y format */
+	if (len == xy_len + 1 && *p == 0x04)
+		p++; /* uncompressed format */
+
+	/* libfido2 x||y format */
+	memcpy(pk->x, p, sizeof(pk->x));
+	memcpy(pk->y, p + sizeof(pk->x), sizeof(pk->y));
 
 	return (FIDO_OK);
 }
@@ -198,6 +204,40 @@ es256_pk_set_y(es256_pk_t *pk, const unsigned char *y)
 	return (0);
 }
 
+/*
+ * Convert pk to an EVP_PKEY once, sparing repeated verifications with the
+ * same key the conversion and the point validation that comes with it.
+ */
+es256_pk_prepared_t *
+es256_pk_prepare(const es256_pk_t *pk)
+{
+	es256_pk_prepared_t *prep;
+
+	if ((prep = calloc(1, sizeof(*prep))) == NULL)
+		return (NULL);
+
+	if ((prep->pkey = es256_pk_to_EVP_PKEY(pk)) == NULL) {
+		fido_log_debug("%s: es256_pk_to_EVP_PKEY", __func__);
+		free(prep);
+		return (NULL);
+	}
+
+	return (prep);
+}
+
+void
+es256_pk_prepared_free(es256_pk_prepared_t **prepp)
+{
+	es256_pk_prepared_t *prep;
+
+	if (prepp == NULL || (prep = *prepp) == NULL)
+		return;
+
+	EVP_PKEY_free(prep->pkey);
+	free(prep);
+	*prepp = NULL;
+}
+
 int
 es256_sk_create(es256_sk_t *key)
 {
@@ -247,6 +287,43 @@ fail:
 	return (ok);
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L && !defined(LIBRESSL_VERSION_NUMBER)
+/*
+ * Build a provider-native key, so that EVP_PKEY_verify() does not have to
+ * export a legacy EC_KEY on every call.
+ */
+EVP_PKEY *
+es256_pk_to_EVP_PKEY(const es256_pk_t *k)
+{
+	EVP_PKEY_CTX	*pctx = NULL;
+	EVP_PKEY	*pkey = NULL;
+	OSSL_PARAM	 params[3];
+	unsigned char	 q[1 + sizeof(k->x) + sizeof(k->y)];
+	char		 group[] = SN_X9_62_prime256v1;
+
+	q[0] = POINT_CONVERSION_UNCOMPRESSED;
+	memcpy(&q[1], k->x, sizeof(k->x));
+	memcpy(&q[1 + sizeof(k->x)], k->y, sizeof(k->y));
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_PKEY_PARAM_GROUP_NAME,
+	    group, 0);
+	params[1] = OSSL_PARAM_construct_octet_string(OSSL_PKEY_PARAM_PUB_KEY,
+	    q, sizeof(q));
+	params[2] = OSSL_PARAM_construct_end();
+
+	if ((pctx = EVP_PKEY_CTX_new_from_name(NULL, "EC", NULL)) == NULL ||
+	    EVP_PKEY_fromdata_init(pctx) != 1 ||
+	    EVP_PKEY_fromdata(pctx, &pkey, EVP_PKEY_PUBLIC_KEY, params) != 1) {
+		fido_log_debug("%s: EVP_PKEY_fromdata", __func__);
+		pkey = NULL;
+	}
+
+	if (pctx != NULL)
+		EVP_PKEY_CTX_free(pctx);
+
+	return (pkey);
+}
+#else
 EVP_PKEY *
 es256_pk_to_EVP_PKEY(const es256_pk_t *k)
 {
@@ -315,6 +392,7 @@ fail:
 
 	return (pkey);
 }
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
 
 int
 es256_pk_from_EC_KEY(es256_pk_t *pk, const EC_KEY *ec)
@@ -9,6 +9,8 @@
 		es256_pk_from_EC_KEY;
 		es256_pk_from_ptr;
 		es256_pk_new;
+		es256_pk_prepare;
+		es256_pk_prepared_free;
 		es256_pk_to_EVP_PKEY;
 		fido_assert_allow_cred;
 		fido_assert_authdata_len;
@@ -25,6 +27,7 @@
 		fido_assert_largeblob_key_len;
 		fido_assert_largeblob_key_ptr;
 		fido_assert_new;
+		fido_assert_pending;
 		fido_assert_rp_id;
 		fido_assert_set_authdata;
 		fido_assert_set_authdata_raw;
@@ -35,6 +38,7 @@
 		fido_assert_set_hmac_secret;
 		fido_assert_set_options;
 		fido_assert_set_rp;
+		fido_assert_set_rp_id_hash;
 		fido_assert_set_sig;
 		fido_assert_set_up;
 		fido_assert_set_uv;
@@ -47,6 +51,8 @@
 		fido_assert_user_id_ptr;
 		fido_assert_user_name;
 		fido_assert_verify;
+		fido_assert_verify_batch;
+		fido_assert_verify_prepared;
 		fido_bio_dev_enroll_begin;
 		fido_bio_dev_enroll_cancel;
 		fido_bio_dev_enroll_continue;
@@ -116,6 +122,8 @@
 		fido_cred_aaguid_len;
 		fido_cred_aaguid_ptr;
 		fido_credman_del_dev_rk;
+		fido_credman_del_dev_rk_batch;
+		fido_credman_get_dev_all;
 		fido_credman_get_dev_metadata;
 		fido_credman_get_dev_rk;
 		fido_credman_get_dev_rp;
@@ -134,6 +142,7 @@
 		fido_credman_rp_id_hash_ptr;
 		fido_credman_rp_name;
 		fido_credman_rp_new;
+		fido_credman_set_dev_cache;
 		fido_cred_new;
 		fido_cred_prot;
 		fido_cred_pubkey_len;
@@ -149,6 +158,7 @@
 		fido_cred_set_prot;
 		fido_cred_set_rk;
 		fido_cred_set_rp;
+		fido_cred_set_rp_id_hash;
 		fido_cred_set_sig;
 		fido_cred_set_type;
 		fido_cred_set_user;
@@ -174,6 +184,8 @@
 		fido_dev_force_u2f;
 		fido_dev_free;
 		fido_dev_get_assert;
+		fido_dev_get_assert_begin;
+		fido_dev_get_assert_next;
 		fido_dev_get_cbor_info;
 		fido_dev_get_retry_count;
 		fido_dev_get_uv_retry_count;
@@ -213,7 +225,14 @@
 		fido_dev_largeblob_get;
 		fido_dev_largeblob_put;
 		fido_dev_largeblob_remove;
+		fido_dev_largeblob_set_cache;
+		fido_dev_largeblob_batch;
 		fido_init;
+		fido_largeblob_batch_count;
+		fido_largeblob_batch_free;
+		fido_largeblob_batch_new;
+		fido_largeblob_batch_put;
+		fido_largeblob_batch_remove;
 		fido_set_log_handler;
 		fido_strerr;
 		rs256_pk_free;
@@ -29,10 +29,12 @@ int aes256_cbc_dec(const fido_dev_t *dev, const fido_blob_t *,
     const fido_blob_t *, fido_blob_t *);
 int aes256_cbc_enc(const fido_dev_t *dev, const fido_blob_t *,
     const fido_blob_t *, fido_blob_t *);
-int aes256_gcm_dec(const fido_blob_t *, const fido_blob_t *,
-    const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
-int aes256_gcm_enc(const fido_blob_t *, const fido_blob_t *,
-    const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
+int aes256_gcm_dec(const fido_dev_t *, const fido_blob_t *,
+    const fido_blob_t *, const fido_blob_t *, const fido_blob_t *,
+    fido_blob_t *);
+int aes256_gcm_enc(const fido_dev_t *, const fido_blob_t *,
+    const fido_blob_t *, const fido_blob_t *, const fido_blob_t *,
+    fido_blob_t *);
 
 /* cbor encoding functions */
 cbor_item_t *cbor_build_uint(const uint64_t);
@@ -159,6 +161,11 @@ int u2f_authenticate(fido_dev_t *, fido_assert_t *, int);
 int u2f_get_touch_begin(fido_dev_t *);
 int u2f_get_touch_status(fido_dev_t *, int *, int);
 
+/* assertion */
+bool fido_dev_cred_list_fits(const fido_dev_t *, const fido_blob_array_t *);
+int fido_dev_find_cred(fido_dev_t *, const char *, const fido_blob_t *,
+    const fido_blob_array_t *, const fido_blob_t *, fido_blob_t *, int);
+
 /* unexposed fido ops */
 uint8_t fido_dev_get_pin_protocol(const fido_dev_t *);
 int fido_dev_authkey(fido_dev_t *, es256_pk_t *);
@@ -166,8 +173,11 @@ int fido_dev_get_cbor_info_wait(fido_dev_t *, fido_cbor_info_t *, int);
 int fido_dev_get_uv_token(fido_dev_t *, uint8_t, const char *,
     const fido_blob_t *, const es256_pk_t *, const char *, fido_blob_t *);
 uint64_t fido_dev_maxmsgsize(const fido_dev_t *);
+uint64_t fido_dev_maxcredcntlst(const fido_dev_t *);
+uint64_t fido_dev_maxcredidlen(const fido_dev_t *);
 int fido_do_ecdh(fido_dev_t *, es256_pk_t **, fido_blob_t **);
 bool fido_dev_supports_permissions(const fido_dev_t *);
+bool fido_dev_supports_selection(const fido_dev_t *);
 bool fido_dev_can_get_uv_token(const fido_dev_t *, const char *, fido_opt_t);
 
 /* misc */
@@ -175,11 +185,22 @@ void fido_assert_reset_rx(fido_assert_t *);
 void fido_assert_reset_tx(fido_assert_t *);
 void fido_cred_reset_rx(fido_cred_t *);
 void fido_cred_reset_tx(fido_cred_t *);
-int fido_check_rp_id(const char *, const unsigned char *);
+int fido_check_rp_id(const unsigned char *, const unsigned char *);
 int fido_check_flags(uint8_t, fido_opt_t, fido_opt_t);
 int fido_get_random(void *, size_t);
+int fido_hash_rp_id(const char *, unsigned char *);
 
 /* crypto */
+struct fido_crypto *fido_crypto_new(void);
+void fido_crypto_reset(struct fido_crypto *);
+void fido_crypto_free(struct fido_crypto **);
+const EVP_MD *fido_crypto_sha256(const fido_dev_t *);
+const EVP_CIPHER *fido_crypto_aes_256_cbc(const fido_dev_t *);
+const EVP_CIPHER *fido_crypto_aes_256_gcm(const fido_dev_t *);
+EVP_CIPHER_CTX *fido_crypto_cipher_ctx(const fido_dev_t *);
+void fido_crypto_cipher_ctx_done(const fido_dev_t *, EVP_CIPHER_CTX *);
+int fido_hmac_sha256(const fido_dev_t *, const fido_blob_t *,
+    const fido_blob_t *, size_t, unsigned char *);
 int fido_verify_sig_es256(const fido_blob_t *, const es256_pk_t *,
     const fido_blob_t *);
 int fido_verify_sig_rs256(const fido_blob_t *, const rs256_pk_t *,
@@ -189,6 +210,14 @@ int fido_verify_sig_eddsa(const fido_blob_t *, const eddsa_pk_t *,
 int fido_get_signed_hash(int, fido_blob_t *, const fido_blob_t *,
     const fido_blob_t *);
 
+/* large blob cache */
+void fido_largeblob_cache_reset(struct largeblob_cache *);
+void fido_largeblob_cache_free(struct largeblob_cache **);
+
+/* credential management cache */
+void fido_credman_cache_reset(struct credman_cache *);
+void fido_credman_cache_free(struct credman_cache **);
+
 /* device manifest functions */
 int fido_hid_manifest(fido_dev_info_t *, size_t, size_t *);
 int fido_nfc_manifest(fido_dev_info_t *, size_t, size_t *);
@@ -213,6 +242,10 @@ uint32_t uniform_random(uint32_t);
 #define FIDO_DEV_UV_SET 	0x040
 #define FIDO_DEV_UV_UNSET	0x080
 #define FIDO_DEV_TOKEN_PERMS	0x100
+#define FIDO_DEV_SELECTION	0x200
+
+/* fido_dev_get_uv_token(): makeCredential after a silent getAssertion */
+#define FIDO_UV_TOKEN_MAKECRED_ASSERT	0xff
 
 /* miscellanea */
 #define FIDO_DUMMY_CLIENTDATA	""
@@ -109,10 +109,15 @@ int fido_assert_set_hmac_secret(fido_assert_t *, size_t, const unsigned char *,
     size_t);
 int fido_assert_set_options(fido_assert_t *, bool, bool);
 int fido_assert_set_rp(fido_assert_t *, const char *);
+int fido_assert_set_rp_id_hash(fido_assert_t *, const unsigned char *, size_t);
 int fido_assert_set_up(fido_assert_t *, fido_opt_t);
 int fido_assert_set_uv(fido_assert_t *, fido_opt_t);
 int fido_assert_set_sig(fido_assert_t *, size_t, const unsigned char *, size_t);
 int fido_assert_verify(const fido_assert_t *, size_t, int, const void *);
+int fido_assert_verify_batch(const fido_assert_t *const *, const size_t *,
+    size_t, int, const void *const *, int *);
+int fido_assert_verify_prepared(const fido_assert_t *, size_t,
+    const es256_pk_prepared_t *);
 int fido_cred_exclude(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_prot(const fido_cred_t *);
 int fido_cred_set_authdata(fido_cred_t *, const unsigned char *, size_t);
@@ -124,6 +129,7 @@ int fido_cred_set_options(fido_cred_t *, bool, bool);
 int fido_cred_set_prot(fido_cred_t *, int);
 int fido_cred_set_rk(fido_cred_t *, fido_opt_t);
 int fido_cred_set_rp(fido_cred_t *, const char *, const char *);
+int fido_cred_set_rp_id_hash(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_sig(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_type(fido_cred_t *, int);
 int fido_cred_set_uv(fido_cred_t *, fido_opt_t);
@@ -137,6 +143,8 @@ int fido_dev_set_sigmask(fido_dev_t *, const fido_sigset_t *);
 int fido_dev_cancel(fido_dev_t *);
 int fido_dev_close(fido_dev_t *);
 int fido_dev_get_assert(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_begin(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_next(fido_dev_t *, fido_assert_t *);
 int fido_dev_get_cbor_info(fido_dev_t *, fido_cbor_info_t *);
 int fido_dev_get_retry_count(fido_dev_t *, int *);
 int fido_dev_get_uv_retry_count(fido_dev_t *, int *);
@@ -154,6 +162,7 @@ int fido_dev_set_transport_functions(fido_dev_t *, const fido_dev_transport_t *)
 size_t fido_assert_authdata_len(const fido_assert_t *, size_t);
 size_t fido_assert_clientdata_hash_len(const fido_assert_t *);
 size_t fido_assert_count(const fido_assert_t *);
+size_t fido_assert_pending(const fido_assert_t *);
 size_t fido_assert_hmac_secret_len(const fido_assert_t *, size_t);
 size_t fido_assert_id_len(const fido_assert_t *, size_t);
 size_t fido_assert_largeblob_key_len(const fido_assert_t *, size_t);
@@ -211,6 +220,17 @@ int fido_dev_largeblob_put(fido_dev_t *, const unsigned char *, size_t,
 int fido_dev_largeblob_remove(fido_dev_t *, const unsigned char *, size_t,
     const char *);
 int fido_dev_largeblob_trim(fido_dev_t *, const char *);
+int fido_dev_largeblob_set_cache(fido_dev_t *, bool);
+int fido_dev_largeblob_batch(fido_dev_t *, const fido_largeblob_batch_t *,
+    const char *);
+
+fido_largeblob_batch_t *fido_largeblob_batch_new(void);
+void fido_largeblob_batch_free(fido_largeblob_batch_t **);
+int fido_largeblob_batch_put(fido_largeblob_batch_t *, const unsigned char *,
+    size_t, const fido_blob_t *);
+int fido_largeblob_batch_remove(fido_largeblob_batch_t *,
+    const unsigned char *, size_t);
+size_t fido_largeblob_batch_count(const fido_largeblob_batch_t *);
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -7,6 +7,7 @@
 #ifndef _FIDO_CREDMAN_H
 #define _FIDO_CREDMAN_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -66,11 +67,15 @@ fido_credman_rp_t *fido_credman_rp_new(void);
 
 int fido_credman_del_dev_rk(fido_dev_t *, const unsigned char *, size_t,
     const char *);
+int fido_credman_del_dev_rk_batch(fido_dev_t *, const unsigned char *const *,
+    const size_t *, size_t, int *, bool, const char *);
+int fido_credman_get_dev_all(fido_dev_t *, fido_credman_rk_t *, const char *);
 int fido_credman_get_dev_metadata(fido_dev_t *, fido_credman_metadata_t *,
     const char *);
 int fido_credman_get_dev_rk(fido_dev_t *, const char *, fido_credman_rk_t *,
     const char *);
 int fido_credman_get_dev_rp(fido_dev_t *, fido_credman_rp_t *, const char *);
+int fido_credman_set_dev_cache(fido_dev_t *, bool);
 
 size_t fido_credman_rk_count(const fido_credman_rk_t *);
 size_t fido_credman_rp_count(const fido_credman_rp_t *);
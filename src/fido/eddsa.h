@@ -43,6 +43,7 @@ int EVP_DigestVerify(EVP_MD_CTX *, const unsigned char *, size_t,
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
 EVP_MD_CTX *EVP_MD_CTX_new(void);
 void EVP_MD_CTX_free(EVP_MD_CTX *);
+int EVP_MD_CTX_reset(EVP_MD_CTX *);
 #endif
 
 #endif /* _FIDO_INTERNAL */
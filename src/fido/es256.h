@@ -29,6 +29,9 @@ EVP_PKEY *es256_pk_to_EVP_PKEY(const es256_pk_t *);
 int es256_pk_from_EC_KEY(es256_pk_t *, const EC_KEY *);
 int es256_pk_from_ptr(es256_pk_t *, const void *, size_t);
 
+es256_pk_prepared_t *es256_pk_prepare(const es256_pk_t *);
+void es256_pk_prepared_free(es256_pk_prepared_t **);
+
 #ifdef _FIDO_INTERNAL
 es256_sk_t *es256_sk_new(void);
 void es256_sk_free(es256_sk_t **);
@@ -64,6 +64,11 @@ typedef struct es256_pk {
 	unsigned char	y[32];
 } es256_pk_t;
 
+/* COSE ES256 public key converted by es256_pk_prepare() */
+typedef struct es256_pk_prepared {
+	EVP_PKEY	*pkey;
+} es256_pk_prepared_t;
+
 /* COSE ES256 (ECDSA over P-256 with SHA-256) (secret) key */
 typedef struct es256_sk {
 	unsigned char	d[32];
@@ -131,6 +136,8 @@ typedef struct fido_cred_ext {
 typedef struct fido_cred {
 	fido_blob_t       cdh;           /* client data hash */
 	fido_rp_t         rp;            /* relying party */
+	unsigned char     rp_id_hash[32]; /* sha256 of rp.id */
+	bool              rp_id_hash_set; /* rp_id_hash is valid */
 	fido_user_t       user;          /* user entity */
 	fido_blob_array_t excl;          /* list of credential ids to exclude */
 	fido_opt_t        rk;            /* resident key */
@@ -154,6 +161,7 @@ typedef struct _fido_assert_stmt {
 	fido_blob_t     hmac_secret;     /* hmac secret */
 	int             authdata_ext;    /* decoded extensions */
 	fido_blob_t     authdata_cbor;   /* raw cbor payload */
+	fido_blob_t     authdata_raw;    /* cbor-decoded payload */
 	fido_authdata_t authdata;        /* decoded authdata payload */
 	fido_blob_t     sig;             /* signature of cdh + authdata */
 	fido_blob_t     largeblob_key;   /* decoded large blob key */
@@ -166,6 +174,8 @@ typedef struct fido_assert_ext {
 
 typedef struct fido_assert {
 	char              *rp_id;        /* relying party id */
+	unsigned char      rp_id_hash[32]; /* sha256 of rp_id */
+	bool               rp_id_hash_set; /* rp_id_hash is valid */
 	fido_blob_t        cdh;          /* client data hash */
 	fido_blob_array_t  allow_list;   /* list of allowed credentials */
 	fido_opt_t         up;           /* user presence */
@@ -174,6 +184,8 @@ typedef struct fido_assert {
 	fido_assert_stmt  *stmt;         /* array of expected assertions */
 	size_t             stmt_cnt;     /* number of allocated assertions */
 	size_t             stmt_len;     /* number of received assertions */
+	size_t             stmt_total;   /* number of reported assertions */
+	fido_blob_t       *ecdh;         /* shared secret for hmac-secret */
 } fido_assert_t;
 
 typedef struct fido_opt_array {
@@ -214,6 +226,16 @@ typedef struct fido_dev_info {
 	fido_dev_transport_t  transport;    /* transport functions */
 } fido_dev_info_t;
 
+typedef struct fido_largeblob_op {
+	fido_blob_t key;  /* large-blob key */
+	fido_blob_t data; /* plaintext to store; empty to remove */
+} fido_largeblob_op_t;
+
+typedef struct fido_largeblob_batch {
+	fido_largeblob_op_t *op; /* pending operations, in order */
+	size_t               n;  /* number of pending operations */
+} fido_largeblob_batch_t;
+
 PACKED_TYPE(fido_ctap_info_t,
 /* defined in section 8.1.9.1.3 (CTAPHID_INIT) of the fido2 ctap spec */
 struct fido_ctap_info {
@@ -239,6 +261,11 @@ typedef struct fido_dev {
 	int                   flags;      /* internal flags; see FIDO_DEV_* */
 	fido_dev_transport_t  transport;  /* transport functions */
 	uint64_t	      maxmsgsize; /* max message size */
+	uint64_t	      maxcredcntlst; /* max credentials in list */
+	uint64_t	      maxcredidlen; /* max credential id length */
+	struct fido_crypto   *crypto;     /* reusable crypto contexts */
+	struct largeblob_cache *largeblob; /* cached large-blob array */
+	struct credman_cache *credman;  /* cached credman enumerations */
 } fido_dev_t;
 
 #else
@@ -248,7 +275,9 @@ typedef struct fido_cbor_info fido_cbor_info_t;
 typedef struct fido_cred fido_cred_t;
 typedef struct fido_dev fido_dev_t;
 typedef struct fido_dev_info fido_dev_info_t;
+typedef struct fido_largeblob_batch fido_largeblob_batch_t;
 typedef struct es256_pk es256_pk_t;
+typedef struct es256_pk_prepared es256_pk_prepared_t;
 typedef struct es256_sk es256_sk_t;
 typedef struct rs256_pk rs256_pk_t;
 typedef struct eddsa_pk eddsa_pk_t;
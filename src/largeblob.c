@@ -20,6 +20,23 @@ typedef struct largeblob {
 	size_t      sz;
 } largeblob_t;
 
+/*
+ * A copy of the serialised large-blob array, kept in the device handle
+ * when caching is enabled, along with the entries of that array which
+ * are known to be opened by a given key. Keys are recorded by their
+ * SHA-256 hash, and their entries are found without trial decryption.
+ */
+typedef struct largeblob_key {
+	unsigned char	hash[SHA256_DIGEST_LENGTH];
+	size_t		entry;
+} largeblob_key_t;
+
+struct largeblob_cache {
+	fido_blob_t	 arr;  /* serialised array, including digest */
+	largeblob_key_t	*key;  /* keys known to open an entry of arr */
+	size_t		 nkey;
+};
+
 static largeblob_t *
 largeblob_new(void)
 {
@@ -85,14 +102,15 @@ largeblob_aad(uint64_t size)
 }
 
 static fido_blob_t *
-largeblob_pt(const largeblob_t *blob, const fido_blob_t *key)
+largeblob_pt(const fido_dev_t *dev, const largeblob_t *blob,
+    const fido_blob_t *key)
 {
 	fido_blob_t	*aad = NULL;
 	fido_blob_t	*pt = NULL;
 
 	if ((pt = fido_blob_new()) == NULL ||
 	    (aad = largeblob_aad(blob->sz)) == NULL ||
-	    aes256_gcm_dec(key, &blob->nonce, aad, &blob->ct, pt) < 0)
+	    aes256_gcm_dec(dev, key, &blob->nonce, aad, &blob->ct, pt) < 0)
 		fido_blob_free(&pt);
 
 	fido_blob_free(&aad);
@@ -100,9 +118,43 @@ largeblob_pt(const largeblob_t *blob, const fido_blob_t *key)
 	return (pt);
 }
 
+/*
+ * Return the index of the first key in keys that opens blob, or -1 if
+ * there is none. The additional authenticated data and the size of the
+ * plaintext depend only on the blob, so every key is tried with the same
+ * aad and decrypts into the same buffer, which aes256_gcm_dec() reuses.
+ */
 static int
-largeblob_comp_enc(largeblob_t *blob, const fido_blob_t *pt,
-    const fido_blob_t *key)
+largeblob_opener(const fido_dev_t *dev, const largeblob_t *blob,
+    const fido_blob_array_t *keys)
+{
+	fido_blob_t	*aad = NULL;
+	fido_blob_t	 pt;
+	int		 opener = -1;
+
+	memset(&pt, 0, sizeof(pt));
+
+	if (blob->ct.len < LARGEBLOB_TAG_LENGTH ||
+	    (aad = largeblob_aad(blob->sz)) == NULL)
+		goto fail;
+
+	for (size_t i = 0; i < keys->len && i < INT_MAX; i++)
+		if (keys->ptr[i].len == 32 && aes256_gcm_dec(dev,
+		    &keys->ptr[i], &blob->nonce, aad, &blob->ct, &pt) == 0) {
+			opener = (int)i;
+			break;
+		}
+
+fail:
+	fido_blob_reset(&pt);
+	fido_blob_free(&aad);
+
+	return (opener);
+}
+
+static int
+largeblob_comp_enc(const fido_dev_t *dev, largeblob_t *blob,
+    const fido_blob_t *pt, const fido_blob_t *key)
 {
 	fido_blob_t	*aad = NULL;
 	fido_blob_t	*df = NULL;
@@ -112,7 +164,7 @@ largeblob_comp_enc(largeblob_t *blob, const fido_blob_t *pt,
 	    (aad = largeblob_aad(pt->len)) == NULL ||
 	    largeblob_gen_nonce(blob) < 0 ||
 	    fido_compress(df, pt) != FIDO_OK ||
-	    aes256_gcm_enc(key, &blob->nonce, aad, df, &blob->ct) < 0)
+	    aes256_gcm_enc(dev, key, &blob->nonce, aad, df, &blob->ct) < 0)
 		goto fail;
 
 	blob->sz = pt->len;
@@ -154,74 +206,284 @@ prepare_hmac(const size_t offset, const unsigned char *data, const size_t len,
 	return (fido_blob_set(hmac, buf, sizeof(buf)));
 }
 
+void
+fido_largeblob_cache_reset(struct largeblob_cache *c)
+{
+	if (c == NULL)
+		return;
+
+	fido_blob_reset(&c->arr);
+	freezero(c->key, c->nkey * sizeof(*c->key));
+	c->key = NULL;
+	c->nkey = 0;
+}
+
+void
+fido_largeblob_cache_free(struct largeblob_cache **cp)
+{
+	struct largeblob_cache *c;
+
+	if (cp == NULL || (c = *cp) == NULL)
+		return;
+	fido_largeblob_cache_reset(c);
+	free(c);
+
+	*cp = NULL;
+}
+
+static int
+largeblob_key_hash(const fido_blob_t *key,
+    unsigned char hash[SHA256_DIGEST_LENGTH])
+{
+	if (SHA256(key->ptr, key->len, hash) != hash) {
+		fido_log_debug("%s: sha256", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static const largeblob_key_t *
+largeblob_cache_lookup(const fido_dev_t *dev,
+    const unsigned char hash[SHA256_DIGEST_LENGTH])
+{
+	const struct largeblob_cache *c = dev->largeblob;
+
+	if (c == NULL || hash == NULL)
+		return (NULL);
+
+	for (size_t i = 0; i < c->nkey; i++)
+		if (timingsafe_bcmp(c->key[i].hash, hash,
+		    SHA256_DIGEST_LENGTH) == 0)
+			return (&c->key[i]);
+
+	return (NULL);
+}
+
+/* an entry opened by a known key cannot be opened by another key */
+static bool
+largeblob_cache_opened(const fido_dev_t *dev, size_t entry)
+{
+	const struct largeblob_cache *c = dev->largeblob;
+
+	if (c == NULL)
+		return (false);
+
+	for (size_t i = 0; i < c->nkey; i++)
+		if (c->key[i].entry == entry)
+			return (true);
+
+	return (false);
+}
+
+static void
+largeblob_cache_learn(const fido_dev_t *dev,
+    const unsigned char hash[SHA256_DIGEST_LENGTH], size_t entry)
+{
+	struct largeblob_cache	*c = dev->largeblob;
+	largeblob_key_t		*k;
+
+	if (c == NULL || hash == NULL)
+		return;
+
+	for (size_t i = 0; i < c->nkey; i++)
+		if (c->key[i].entry == entry ||
+		    memcmp(c->key[i].hash, hash, SHA256_DIGEST_LENGTH) == 0) {
+			memcpy(c->key[i].hash, hash, SHA256_DIGEST_LENGTH);
+			c->key[i].entry = entry;
+			return;
+		}
+
+	if ((k = recallocarray(c->key, c->nkey, c->nkey + 1,
+	    sizeof(*k))) == NULL) {
+		fido_log_debug("%s: recallocarray", __func__);
+		return;
+	}
+
+	c->key = k;
+	memcpy(c->key[c->nkey].hash, hash, SHA256_DIGEST_LENGTH);
+	c->key[c->nkey++].entry = entry;
+}
+
+/* entry has been dropped from the array; renumber the ones after it */
+static void
+largeblob_cache_drop(const fido_dev_t *dev, size_t entry)
+{
+	struct largeblob_cache	*c = dev->largeblob;
+	size_t			 n = 0;
+
+	if (c == NULL)
+		return;
+
+	for (size_t i = 0; i < c->nkey; i++) {
+		if (c->key[i].entry == entry)
+			continue;
+		c->key[n] = c->key[i];
+		if (c->key[n].entry > entry)
+			c->key[n].entry--;
+		n++;
+	}
+
+	explicit_bzero(c->key + n, (c->nkey - n) * sizeof(*c->key));
+	c->nkey = n;
+}
+
+/*
+ * CTAP 2.1 caps both the "get" and "set" fragments of authenticatorLargeBlobs
+ * at maxFragmentLength, defined as the authenticator's maxMsgSize minus 64;
+ * an authenticator rejects anything larger with CTAP1_ERR_INVALID_LENGTH.
+ * The 64 bytes are the spec's allowance for the command's own CBOR, so use
+ * them as is, and do not clamp the fragment to FIDO_MAXMSG: large-blob
+ * replies are received into buffers sized by largeblob_reply_len().
+ */
 static size_t
 max_fragment_length(fido_dev_t *dev)
 {
 	uint64_t	maxfraglen;
 
 	maxfraglen = fido_dev_maxmsgsize(dev);
-	if (maxfraglen > SIZE_MAX)
-		maxfraglen = SIZE_MAX;
-	if (maxfraglen > FIDO_MAXMSG)
-		maxfraglen = FIDO_MAXMSG;
+	if (maxfraglen > UINT16_MAX)
+		maxfraglen = UINT16_MAX;
 
 	maxfraglen = maxfraglen > 64 ? maxfraglen - 64 : 0;
 
 	return ((size_t)maxfraglen);
 }
 
+/*
+ * Length of a reply carrying a fragment of up to maxlen bytes: a status
+ * byte, a one-entry map, its key, and a byte string of maxlen bytes.
+ */
+static size_t
+largeblob_reply_len(size_t maxlen)
+{
+	size_t	hdr;
+
+	if (maxlen < 24)
+		hdr = 1;
+	else if (maxlen <= UINT8_MAX)
+		hdr = 2;
+	else
+		hdr = 3; /* maxlen <= UINT16_MAX */
+
+	return (3 + hdr + maxlen);
+}
+
+/*
+ * The serialised large-blob array is received in fragments, which are
+ * appended to a geometrically grown buffer and hashed as they arrive.
+ * The last LARGEBLOB_DIGEST_LENGTH bytes received are held back from
+ * the hash, as they may turn out to be the array's trailing digest.
+ */
+typedef struct largeblob_rx {
+	SHA256_CTX	 ctx;
+	unsigned char	*ptr;
+	size_t		 len;    /* bytes received */
+	size_t		 size;   /* bytes allocated */
+	size_t		 hashed; /* bytes fed to ctx */
+	size_t		 frag;   /* length of the last fragment */
+	bool		 seen;   /* fragment present in the last reply */
+} largeblob_rx_t;
+
 static int
-parse_largeblob_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+largeblob_rx_append(largeblob_rx_t *rx, const cbor_item_t *item)
 {
-	fido_blob_t	*fragment = arg;
+	unsigned char	*tmp;
+	size_t		 len;
+	size_t		 size;
 
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8) {
+	if (rx->seen || cbor_isa_bytestring(item) == false ||
+	    cbor_bytestring_is_definite(item) == false) {
 		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
+		return (-1);
 	}
 
-	switch (cbor_get_uint8(key)) {
-	case 1: /* substring of serialized large blob array */
-		return (fido_blob_decode(val, fragment));
-	default: /* ignore */
-		fido_log_debug("%s: cbor type", __func__);
+	rx->seen = true;
+	rx->frag = len = cbor_bytestring_length(item);
+
+	if (len == 0)
 		return (0);
+	if (SIZE_MAX - rx->len < len) {
+		fido_log_debug("%s: overflow", __func__);
+		return (-1);
 	}
-}
 
-static int
-largeblob_array_digest(const unsigned char *data, const size_t len,
-    unsigned char dgst[LARGEBLOB_DIGEST_LENGTH])
-{
-	unsigned char	actual_dgst[SHA256_DIGEST_LENGTH];
+	if (rx->len + len > rx->size) {
+		size = rx->size ? rx->size : len;
+		while (size < rx->len + len)
+			size = size <= SIZE_MAX / 2 ? size * 2 : rx->len + len;
+		if ((tmp = realloc(rx->ptr, size)) == NULL) {
+			fido_log_debug("%s: realloc", __func__);
+			return (-1);
+		}
+		rx->ptr = tmp;
+		rx->size = size;
+	}
 
-	explicit_bzero(actual_dgst, sizeof(actual_dgst));
-	if (data == NULL || len == 0 ||
-	    SHA256(data, len, actual_dgst) != actual_dgst) {
-		fido_log_debug("%s: sha256", __func__);
-		return (-1);
+	memcpy(rx->ptr + rx->len, cbor_bytestring_handle(item), len);
+	rx->len += len;
+
+	if (rx->len > LARGEBLOB_DIGEST_LENGTH &&
+	    rx->len - LARGEBLOB_DIGEST_LENGTH > rx->hashed) {
+		len = rx->len - LARGEBLOB_DIGEST_LENGTH - rx->hashed;
+		if (SHA256_Update(&rx->ctx, rx->ptr + rx->hashed, len) == 0) {
+			fido_log_debug("%s: SHA256_Update", __func__);
+			return (-1);
+		}
+		rx->hashed += len;
 	}
 
-	memcpy(dgst, actual_dgst, LARGEBLOB_DIGEST_LENGTH);
 	return (0);
 }
 
 static int
-validate_largeblob_array(const fido_blob_t *b)
+largeblob_rx_validate(largeblob_rx_t *rx)
 {
-	unsigned char	dgst[LARGEBLOB_DIGEST_LENGTH];
-	size_t		offset;
+	unsigned char	dgst[SHA256_DIGEST_LENGTH];
+	int		ok = -1;
 
-	if (b->len <= sizeof(dgst))
+	if (rx->len <= LARGEBLOB_DIGEST_LENGTH ||
+	    rx->hashed != rx->len - LARGEBLOB_DIGEST_LENGTH) {
+		fido_log_debug("%s: len=%zu", __func__, rx->len);
 		return (-1);
+	}
 
-	offset = b->len - sizeof(dgst);
+	if (SHA256_Final(dgst, &rx->ctx) == 0) {
+		fido_log_debug("%s: SHA256_Final", __func__);
+		goto fail;
+	}
 
-	if (largeblob_array_digest(b->ptr, offset, dgst))
-		return (-1);
+	if (timingsafe_bcmp(dgst, rx->ptr + rx->hashed,
+	    LARGEBLOB_DIGEST_LENGTH) != 0) {
+		fido_log_debug("%s: digest mismatch", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	explicit_bzero(dgst, sizeof(dgst));
+
+	return (ok);
+}
+
+static int
+parse_largeblob_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+{
+	largeblob_rx_t	*rx = arg;
 
-	return (timingsafe_bcmp(dgst, b->ptr + offset, sizeof(dgst)));
+	if (cbor_isa_uint(key) == false ||
+	    cbor_int_get_width(key) != CBOR_INT_8) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (0); /* ignore */
+	}
+
+	switch (cbor_get_uint8(key)) {
+	case 1: /* substring of serialized large blob array */
+		return (largeblob_rx_append(rx, val));
+	default: /* ignore */
+		fido_log_debug("%s: cbor type", __func__);
+		return (0);
+	}
 }
 
 static int
@@ -258,26 +520,32 @@ fail:
 }
 
 static int
-largeblob_array_get_rx(fido_dev_t *dev, fido_blob_t **frag, int ms)
+largeblob_array_get_rx(fido_dev_t *dev, largeblob_rx_t *rx, size_t maxlen,
+    int ms)
 {
-	unsigned char	reply[FIDO_MAXMSG];
-	int		reply_len;
-	int		r;
+	unsigned char	*reply = NULL;
+	size_t		 reply_max;
+	int		 reply_len;
+	int		 r;
 
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, &reply, sizeof(reply),
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+	rx->frag = 0;
+	rx->seen = false;
+	reply_max = largeblob_reply_len(maxlen);
+
+	if ((reply = malloc(reply_max)) == NULL) {
+		fido_log_debug("%s: malloc", __func__);
+		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if (((*frag) = fido_blob_new()) == NULL) {
-		fido_log_debug("%s: fido_blob_new", __func__);
-		r = FIDO_ERR_INTERNAL;
+	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, reply, reply_max,
+	    ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		r = FIDO_ERR_RX;
 		goto fail;
 	}
 
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, *frag,
+	if ((r = cbor_parse_reply(reply, (size_t)reply_len, rx,
 	    parse_largeblob_reply)) != FIDO_OK) {
 		fido_log_debug("%s: parse_largeblob_reply", __func__);
 		goto fail;
@@ -286,6 +554,8 @@ largeblob_array_get_rx(fido_dev_t *dev, fido_blob_t **frag, int ms)
 	r = FIDO_OK;
 
 fail:
+	free(reply);
+
 	return (r);
 }
 
@@ -295,11 +565,6 @@ largeblob_array_load(const uint8_t *ptr, size_t len)
 	struct cbor_load_result cbor;
 	cbor_item_t *item;
 
-	if (len < SHA256_DIGEST_LENGTH) {
-		fido_log_debug("%s: len", __func__);
-		return NULL;
-	}
-	len -= SHA256_DIGEST_LENGTH;
 	if ((item = cbor_load(ptr, len, &cbor)) == NULL) {
 		fido_log_debug("%s: cbor_load", __func__);
 		return NULL;
@@ -313,51 +578,102 @@ largeblob_array_load(const uint8_t *ptr, size_t len)
 	return item;
 }
 
+/*
+ * If the array cached on the device handle still matches the
+ * authenticator's, a read from the offset of its trailing digest yields
+ * that digest and nothing else. Anything else, including an error from
+ * the authenticator, means the cache is stale.
+ */
+static int
+largeblob_cache_valid(fido_dev_t *dev, size_t maxlen, int ms)
+{
+	const fido_blob_t	*cache = &dev->largeblob->arr;
+	largeblob_rx_t		 rx;
+	size_t			 offset;
+	int			 ok = -1;
+
+	if (cache->len <= LARGEBLOB_DIGEST_LENGTH ||
+	    maxlen <= LARGEBLOB_DIGEST_LENGTH)
+		return (-1);
+
+	memset(&rx, 0, sizeof(rx));
+	offset = cache->len - LARGEBLOB_DIGEST_LENGTH;
+
+	if (SHA256_Init(&rx.ctx) == 0 ||
+	    largeblob_array_get_tx(dev, offset, maxlen) != FIDO_OK ||
+	    largeblob_array_get_rx(dev, &rx, maxlen, ms) != FIDO_OK) {
+		fido_log_debug("%s: largeblob_array_get_{tx,rx}, offset=%zu",
+		    __func__, offset);
+		goto fail;
+	}
+
+	if (rx.len != LARGEBLOB_DIGEST_LENGTH ||
+	    timingsafe_bcmp(rx.ptr, cache->ptr + offset, rx.len) != 0) {
+		fido_log_debug("%s: stale, len=%zu", __func__, rx.len);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	freezero(rx.ptr, rx.size);
+	explicit_bzero(&rx.ctx, sizeof(rx.ctx));
+
+	return (ok);
+}
+
 static cbor_item_t *
 largeblob_array_get_wait(fido_dev_t *dev, int ms)
 {
-	fido_blob_t	*arr = NULL;
-	fido_blob_t	*frag = NULL;
+	largeblob_rx_t	 rx;
 	cbor_item_t	*item = NULL;
-	size_t		 last;
 	size_t		 maxlen;
 
+	memset(&rx, 0, sizeof(rx));
+
 	if ((maxlen = max_fragment_length(dev)) == 0 ||
-	    (arr = fido_blob_new()) == NULL) {
-		fido_log_debug("%s: maxlen=%zu, arr=%p", __func__, maxlen,
-		    (void *)arr);
+	    SHA256_Init(&rx.ctx) == 0) {
+		fido_log_debug("%s: maxlen=%zu", __func__, maxlen);
 		goto fail;
 	}
 
-	last = maxlen;
-
-	while (last == maxlen) {
-		fido_blob_free(&frag);
-
-		if ((largeblob_array_get_tx(dev, arr->len, maxlen)) != FIDO_OK ||
-		    (largeblob_array_get_rx(dev, &frag, ms)) != FIDO_OK) {
-			fido_log_debug("%s: largeblob_array_get_{tx,rx}, offset=%zu",
-			    __func__, arr->len);
+	if (dev->largeblob != NULL && dev->largeblob->arr.len != 0) {
+		if (largeblob_cache_valid(dev, maxlen, ms) == 0) {
+			item = largeblob_array_load(dev->largeblob->arr.ptr,
+			    dev->largeblob->arr.len - LARGEBLOB_DIGEST_LENGTH);
 			goto fail;
 		}
+		fido_largeblob_cache_reset(dev->largeblob);
+	}
 
-		if (!fido_blob_is_empty(frag) &&
-		    fido_blob_append(arr, frag->ptr, frag->len) < 0) {
-			fido_log_debug("%s: fido_blob_append", __func__);
+	rx.frag = maxlen;
+
+	while (rx.frag == maxlen) {
+		if ((largeblob_array_get_tx(dev, rx.len, maxlen)) != FIDO_OK ||
+		    (largeblob_array_get_rx(dev, &rx, maxlen, ms)) != FIDO_OK) {
+			fido_log_debug("%s: largeblob_array_get_{tx,rx}, offset=%zu",
+			    __func__, rx.len);
 			goto fail;
 		}
-
-		last = frag->len;
 	}
 
-	if (validate_largeblob_array(arr) == 0)
-		item = largeblob_array_load(arr->ptr, arr->len);
-	else
+	/* parse the array in place, without the trailing digest */
+	if (largeblob_rx_validate(&rx) < 0) {
 		item = cbor_new_definite_array(0);
+		goto fail;
+	}
+
+	item = largeblob_array_load(rx.ptr, rx.hashed);
+
+	if (item != NULL && dev->largeblob != NULL) {
+		/* hand the buffer over to the cache */
+		dev->largeblob->arr.ptr = rx.ptr;
+		dev->largeblob->arr.len = rx.len;
+		rx.ptr = NULL;
+	}
 
 fail:
-	fido_blob_free(&frag);
-	fido_blob_free(&arr);
+	freezero(rx.ptr, rx.size);
+	explicit_bzero(&rx.ctx, sizeof(rx.ctx));
 
 	return (item);
 }
@@ -413,7 +729,8 @@ largeblob_decode(largeblob_t *blob, const cbor_item_t *item)
 }
 
 static cbor_item_t *
-largeblob_encode(const fido_blob_t *pt, const fido_blob_t *key)
+largeblob_encode(const fido_dev_t *dev, const fido_blob_t *pt,
+    const fido_blob_t *key)
 {
 	largeblob_t	*blob = NULL;
 	cbor_item_t	*item = NULL;
@@ -422,7 +739,7 @@ largeblob_encode(const fido_blob_t *pt, const fido_blob_t *key)
 	memset(argv, 0, sizeof(argv));
 
 	if ((blob = largeblob_new()) == NULL ||
-	    largeblob_comp_enc(blob, pt, key) < 0) {
+	    largeblob_comp_enc(dev, blob, pt, key) < 0) {
 		fido_log_debug("%s: largeblob_comp_enc", __func__);
 		goto fail;
 	}
@@ -443,14 +760,17 @@ fail:
 }
 
 static int
-largeblob_array_find(size_t *index, fido_blob_t *out,
+largeblob_array_find(const fido_dev_t *dev, size_t *index, fido_blob_t *out,
     const fido_blob_t *key, const cbor_item_t *arr)
 {
-	cbor_item_t	*map = NULL;
-	fido_blob_t	*pt = NULL;
-	largeblob_t	*blob = NULL;
-	int		 r = FIDO_ERR_NOTFOUND;
-
+	const largeblob_key_t	*k;
+	unsigned char		 hash[SHA256_DIGEST_LENGTH];
+	unsigned char		*hp = NULL;
+	cbor_item_t		*map = NULL;
+	fido_blob_t		*pt = NULL;
+	largeblob_t		*blob = NULL;
+	size_t			 n;
+	int			 r = FIDO_ERR_NOTFOUND;
 
 	if ((blob = largeblob_new()) == NULL) {
 		fido_log_debug("%s: largeblob_new", __func__);
@@ -458,10 +778,30 @@ largeblob_array_find(size_t *index, fido_blob_t *out,
 		goto fail;
 	}
 
-	for (size_t i = 0; i < cbor_array_size(arr); i++) {
+	n = cbor_array_size(arr);
+
+	if (dev->largeblob != NULL && largeblob_key_hash(key, hash) == 0)
+		hp = hash;
+
+	/* try the entry this key is known to open first */
+	if ((k = largeblob_cache_lookup(dev, hp)) != NULL && k->entry < n) {
+		map = cbor_array_handle(arr)[k->entry];
+		if (largeblob_decode(blob, map) == 0 &&
+		    (pt = largeblob_pt(dev, blob, key)) != NULL) {
+			*index = k->entry;
+			r = FIDO_OK;
+		} else
+			largeblob_reset(blob);
+	}
+
+	for (size_t i = 0; r != FIDO_OK && i < n; i++) {
+		if (largeblob_cache_opened(dev, i))
+			continue;
+
 		map = cbor_array_handle(arr)[i];
 		if (largeblob_decode(blob, map) == 0 &&
-		    (pt = largeblob_pt(blob, key)) != NULL) {
+		    (pt = largeblob_pt(dev, blob, key)) != NULL) {
+			largeblob_cache_learn(dev, hp, i);
 			*index = i;
 			r = FIDO_OK;
 			break;
@@ -477,20 +817,22 @@ largeblob_array_find(size_t *index, fido_blob_t *out,
 	}
 
 fail:
+	explicit_bzero(hash, sizeof(hash));
 	largeblob_free(&blob);
 	fido_blob_free(&pt);
 	return (r);
 }
 
 static int
-largeblob_array_insert(cbor_item_t **arr_p, const fido_blob_t *key,
-    cbor_item_t *blob)
+largeblob_array_insert(const fido_dev_t *dev, cbor_item_t **arr_p,
+    const fido_blob_t *key, cbor_item_t *blob)
 {
 	cbor_item_t	*old = *arr_p;
+	unsigned char	 hash[SHA256_DIGEST_LENGTH];
 	size_t		 index;
 	int		 r;
 
-	r = largeblob_array_find(&index, NULL, key, old);
+	r = largeblob_array_find(dev, &index, NULL, key, old);
 
 	switch (r) {
 	case FIDO_OK:
@@ -500,10 +842,15 @@ largeblob_array_insert(cbor_item_t **arr_p, const fido_blob_t *key,
 		}
 		break;
 	case FIDO_ERR_NOTFOUND:
+		index = cbor_array_size(old);
 		if (cbor_array_append(arr_p, blob) < 0) {
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+		if (dev->largeblob != NULL && largeblob_key_hash(key,
+		    hash) == 0)
+			largeblob_cache_learn(dev, hash, index);
+		explicit_bzero(hash, sizeof(hash));
 		break;
 	default:
 		goto fail;
@@ -515,19 +862,21 @@ fail:
 }
 
 static int
-largeblob_array_remove(cbor_item_t **arr_p, const fido_blob_t *key)
+largeblob_array_remove(const fido_dev_t *dev, cbor_item_t **arr_p,
+    const fido_blob_t *key)
 {
 	cbor_item_t	*arr = *arr_p;
 	size_t		 index;
 	int		 r;
 
-	r = largeblob_array_find(&index, NULL, key, arr);
+	r = largeblob_array_find(dev, &index, NULL, key, arr);
 	switch (r) {
 	case FIDO_OK:
 		if (cbor_array_drop(arr_p, index) < 0) {
 		    r = FIDO_ERR_INTERNAL;
 		    goto fail;
 		}
+		largeblob_cache_drop(dev, index);
 		break;
 	case FIDO_ERR_NOTFOUND:
 		/* key not found, so let's say it's removed */
@@ -572,7 +921,8 @@ fido_dev_largeblob_get(fido_dev_t *dev, const unsigned char *key_ptr,
 		goto fail;
 	}
 
-	if ((r = largeblob_array_find(&index, blob, key, arr)) != FIDO_OK) {
+	if ((r = largeblob_array_find(dev, &index, blob, key,
+	    arr)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_array_find", __func__);
 		goto fail;
 	}
@@ -649,13 +999,17 @@ largeblob_array_set_wait(fido_dev_t *dev, const cbor_item_t *arr,
 	fido_blob_t	*ecdh = NULL;
 	es256_pk_t	*pk = NULL;
 	unsigned char	*cbor = NULL;
+	unsigned char	*tmp;
 	size_t		 cbor_len;
 	size_t		 cbor_alloc_len;
+	size_t		 total;
 	size_t		 offset = 0;
 	size_t		 maxlen = 0;
-	SHA256_CTX	 ctx;
 	int		 r;
 
+	if (dev->largeblob != NULL)
+		fido_blob_reset(&dev->largeblob->arr);
+
 	if ((maxlen = max_fragment_length(dev)) == 0) {
 		fido_log_debug("%s: maxlen=%zu", __func__, maxlen);
 		r = FIDO_ERR_INTERNAL;
@@ -684,50 +1038,54 @@ largeblob_array_set_wait(fido_dev_t *dev, const cbor_item_t *arr,
 		}
 	}
 
-	if (SHA256_Init(&ctx) == 0) {
-		fido_log_debug("%s: SHA256_Init", __func__);
+	/* the digest is sent as part of the array, fragmented alike */
+	if (SHA256(cbor, cbor_len, dgst) != dgst) {
+		fido_log_debug("%s: SHA256", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	while (offset < cbor_len) {
-		size_t len = maxlen < cbor_len - offset ?
-		    maxlen : cbor_len - offset;
-		if (SHA256_Update(&ctx, cbor + offset, len) == 0) {
-			fido_log_debug("%s: SHA256_Update", __func__);
+	if (cbor_alloc_len - cbor_len < LARGEBLOB_DIGEST_LENGTH) {
+		if ((tmp = realloc(cbor, cbor_len +
+		    LARGEBLOB_DIGEST_LENGTH)) == NULL) {
+			fido_log_debug("%s: realloc", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+		cbor = tmp;
+	}
 
-		if ((r = largeblob_array_set_tx(dev, token,
-		    cbor + offset, len, offset,
-		    cbor_len + LARGEBLOB_DIGEST_LENGTH)) != FIDO_OK ||
+	memcpy(cbor + cbor_len, dgst, LARGEBLOB_DIGEST_LENGTH);
+	total = cbor_len + LARGEBLOB_DIGEST_LENGTH;
+
+	while (offset < total) {
+		size_t len = maxlen < total - offset ? maxlen : total - offset;
+
+		if ((r = largeblob_array_set_tx(dev, token, cbor + offset, len,
+		    offset, total)) != FIDO_OK ||
 		    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
-			fido_log_debug("%s: largeblob_array_set_tx 1",
-			    __func__);
+			fido_log_debug("%s: largeblob_array_set_tx", __func__);
 			goto fail;
 		}
 
 		offset += len;
 	}
 
-	if (SHA256_Final(dgst, &ctx) == 0) {
-		fido_log_debug("%s: SHA256_Final", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
-
-	if ((r = largeblob_array_set_tx(dev, token, dgst,
-	    LARGEBLOB_DIGEST_LENGTH, offset,
-	    cbor_len + LARGEBLOB_DIGEST_LENGTH)) != FIDO_OK ||
-	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
-		fido_log_debug("%s: largeblob_array_set_tx 2", __func__);
-		goto fail;
+	/*
+	 * What we wrote is now the authenticator's array; the caller has
+	 * already brought the cached key index up to date.
+	 */
+	if (dev->largeblob != NULL && fido_blob_set(&dev->largeblob->arr,
+	    cbor, total) < 0) {
+		fido_log_debug("%s: largeblob cache", __func__);
+		fido_largeblob_cache_reset(dev->largeblob);
 	}
 
 	r = FIDO_OK;
 
 fail:
+	if (r != FIDO_OK)
+		fido_largeblob_cache_reset(dev->largeblob);
 	fido_blob_free(&token);
 	fido_blob_free(&ecdh);
 	es256_pk_free(&pk);
@@ -760,14 +1118,14 @@ fido_dev_largeblob_put(fido_dev_t *dev, const unsigned char *key_ptr,
 		goto fail;
 	}
 
-	if ((item = largeblob_encode(blob, key)) == NULL ||
+	if ((item = largeblob_encode(dev, blob, key)) == NULL ||
 	    (arr = largeblob_array_get_wait(dev, -1)) == NULL) {
 		fido_log_debug("%s: largeblob_array_get_wait", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((r = largeblob_array_insert(&arr, key, item)) != FIDO_OK ||
+	if ((r = largeblob_array_insert(dev, &arr, key, item)) != FIDO_OK ||
 	    (r = largeblob_array_set_wait(dev, arr, pin, -1)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_array_set_wait", __func__);
 		goto fail;
@@ -812,7 +1170,7 @@ fido_dev_largeblob_remove(fido_dev_t *dev, const unsigned char *key_ptr,
 		goto fail;
 	}
 
-	if ((r = largeblob_array_remove(&arr, key)) != FIDO_OK ||
+	if ((r = largeblob_array_remove(dev, &arr, key)) != FIDO_OK ||
 	    (r = largeblob_array_set_wait(dev, arr, pin, -1)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_array_set_wait", __func__);
 		goto fail;
@@ -827,10 +1185,14 @@ fail:
 	return (r);
 }
 
+/*
+ * Collect the largeBlobKey of every resident credential. The credentials
+ * are walked under a single PIN/UV auth token, by the relying party id
+ * hash reported by the authenticator.
+ */
 static int
 list_largeblob_keys(fido_dev_t *dev, fido_blob_array_t *keys, const char *pin)
 {
-	fido_credman_rp_t	*rp = NULL;
 	fido_credman_rk_t	*rk = NULL;
 	const fido_cred_t	*cred = NULL;
 	fido_blob_t		*list_ptr = NULL;
@@ -838,62 +1200,80 @@ list_largeblob_keys(fido_dev_t *dev, fido_blob_array_t *keys, const char *pin)
 	size_t			 len;
 	int			 r;
 
-	if ((rp = fido_credman_rp_new()) == NULL) {
+	if ((rk = fido_credman_rk_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((r = fido_credman_get_dev_rp(dev, rp, pin)) != FIDO_OK)
+	/* an authenticator without resident credentials has no keys */
+	if ((r = fido_credman_get_dev_all(dev, rk, pin)) != FIDO_OK &&
+	    r != FIDO_ERR_NO_CREDENTIALS)
 		goto fail;
 
-	for (size_t i = 0; i < fido_credman_rp_count(rp); i++) {
-		if ((rk = fido_credman_rk_new()) == NULL) {
-			r = FIDO_ERR_INTERNAL;
-			goto fail;
-		}
+	for (size_t i = 0; i < fido_credman_rk_count(rk); i++)
+		if ((cred = fido_credman_rk(rk, i)) != NULL &&
+		    (ptr = fido_cred_largeblob_key_ptr(cred)) != NULL &&
+		    (len = fido_cred_largeblob_key_len(cred)) != 0) {
+			if ((list_ptr = recallocarray(keys->ptr, keys->len,
+			    keys->len + 1, sizeof(fido_blob_t))) == NULL) {
+				r = FIDO_ERR_INTERNAL;
+				goto fail;
+			}
 
-		if ((r = fido_credman_get_dev_rk(dev, fido_credman_rp_id(rp, i), rk,
-		    pin)) != FIDO_OK)
-			goto fail;
+			keys->ptr = list_ptr;
 
-		for (size_t j = 0; j < fido_credman_rk_count(rk); j++)
-			if ((cred = fido_credman_rk(rk, j)) != NULL &&
-			    (ptr = fido_cred_largeblob_key_ptr(cred)) != NULL &&
-			    (len = fido_cred_largeblob_key_len(cred)) != 0) {
-				if ((list_ptr = recallocarray(keys->ptr, keys->len, keys->len + 1,
-				    sizeof(fido_blob_t))) == NULL) {
-					r = FIDO_ERR_INTERNAL;
-					goto fail;
-				}
-
-				keys->ptr = list_ptr;
-
-				if (fido_blob_set(&keys->ptr[keys->len++], ptr, len) < 0) {
-					r = FIDO_ERR_INTERNAL;
-					goto fail;
-				}
+			if (fido_blob_set(&keys->ptr[keys->len++], ptr,
+			    len) < 0) {
+				r = FIDO_ERR_INTERNAL;
+				goto fail;
 			}
-
-		fido_credman_rk_free(&rk);
-	}
+		}
 
 	r = FIDO_OK;
 
 fail:
-	fido_credman_rp_free(&rp);
 	fido_credman_rk_free(&rk);
 
 	return (r);
 }
 
+/*
+ * Return the index into keys of the key known to open the entry, -1 if
+ * the entry is known to be opened by some other key, or -2 if unknown.
+ */
+static int
+largeblob_cache_opener(const fido_dev_t *dev, size_t entry,
+    unsigned char (*hash)[SHA256_DIGEST_LENGTH], size_t nhash)
+{
+	const struct largeblob_cache *c = dev->largeblob;
+
+	if (c == NULL || hash == NULL)
+		return (-2);
+
+	for (size_t i = 0; i < c->nkey; i++) {
+		if (c->key[i].entry != entry)
+			continue;
+		for (size_t j = 0; j < nhash && j < INT_MAX; j++)
+			if (timingsafe_bcmp(c->key[i].hash, hash[j],
+			    SHA256_DIGEST_LENGTH) == 0)
+				return ((int)j);
+		return (-1);
+	}
+
+	return (-2);
+}
+
 static int
-remove_unknown_blobs(cbor_item_t **arr, const fido_blob_array_t *keys)
+remove_unknown_blobs(const fido_dev_t *dev, cbor_item_t **arr,
+    const fido_blob_array_t *keys)
 {
 	cbor_item_t	*new = NULL;
 	cbor_item_t	*elem = NULL;
 	largeblob_t	*blob = NULL;
-	fido_blob_t	*pt = NULL;
+	unsigned char	(*hash)[SHA256_DIGEST_LENGTH] = NULL;
+	size_t		*entry = NULL;
 	size_t		 n;
+	int		 opener;
 	int		 r;
 
 	n  = cbor_array_size(*arr);
@@ -903,25 +1283,44 @@ remove_unknown_blobs(cbor_item_t **arr, const fido_blob_array_t *keys)
 		goto fail;
 	}
 
+	/* hash the keys, so that known entries need not be decrypted */
+	if (dev->largeblob != NULL && keys->len != 0) {
+		if ((hash = calloc(keys->len, sizeof(*hash))) == NULL ||
+		    (entry = calloc(keys->len, sizeof(*entry))) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		for (size_t j = 0; j < keys->len; j++) {
+			entry[j] = SIZE_MAX;
+			if (largeblob_key_hash(&keys->ptr[j], hash[j]) < 0) {
+				r = FIDO_ERR_INTERNAL;
+				goto fail;
+			}
+		}
+	}
+
 	/* For every element in the array ...*/
 	for (size_t i = 0; i < n; i++) {
-		/* ... attempt to decode it ... */
 		elem = cbor_array_handle(*arr)[i];
-		if (largeblob_decode(blob, elem) == 0) {
+		opener = largeblob_cache_opener(dev, i, hash, keys->len);
+		if (opener == -1)
+			elem = NULL; /* opened by a key no longer listed */
+		/* ... attempt to decode it ... */
+		else if (opener == -2 && largeblob_decode(blob, elem) == 0) {
 			/* ... and to decrypt it using every key. */
-			for (size_t j = 0; j < keys->len; ++j)
-				if ((pt = largeblob_pt(blob, &keys->ptr[j])) != NULL)
-					break;
+			opener = largeblob_opener(dev, blob, keys);
 
 			/* unsuccessful decryption means it's up for removal,
 			 * mark it as such by setting it to NULL. */
-			if (pt == NULL)
+			if (opener < 0)
 				elem = NULL;
 
 			largeblob_reset(blob);
-			fido_blob_free(&pt);
 		}
 
+		if (elem != NULL && opener >= 0 && entry != NULL)
+			entry[opener] = cbor_array_size(new);
+
 		/* note that non-conformant blobs are kept, as per spec */
 		if (elem != NULL && !cbor_array_push(new, elem)) {
 			fido_log_debug("%s: cbor_array_push", __func__);
@@ -930,6 +1329,14 @@ remove_unknown_blobs(cbor_item_t **arr, const fido_blob_array_t *keys)
 		}
 	}
 
+	/* rebuild the index for the trimmed array, which may be empty */
+	if (dev->largeblob != NULL) {
+		fido_largeblob_cache_reset(dev->largeblob);
+		for (size_t j = 0; j < keys->len; j++)
+			if (entry[j] != SIZE_MAX)
+				largeblob_cache_learn(dev, hash[j], entry[j]);
+	}
+
 	cbor_decref(arr);
 	*arr = new;
 
@@ -939,6 +1346,9 @@ fail:
 	if (r != FIDO_OK && new != NULL)
 		cbor_decref(&new);
 	largeblob_free(&blob);
+	if (hash != NULL)
+		freezero(hash, keys->len * sizeof(*hash));
+	free(entry);
 
 	return (r);
 }
@@ -952,6 +1362,12 @@ fido_dev_largeblob_trim(fido_dev_t *dev, const char *pin)
 
 	memset(&keys, 0, sizeof(keys));
 
+	/*
+	 * A cached enumeration may miss a credential created by another
+	 * client, whose blob would then be removed. The keys are listed by
+	 * fido_credman_get_dev_all(), which always walks the authenticator
+	 * and leaves the credential cache alone.
+	 */
 	if ((r = list_largeblob_keys(dev, &keys, pin)) != FIDO_OK) {
 		fido_log_debug("%s: list_largeblob_keys", __func__);
 		goto fail;
@@ -963,7 +1379,7 @@ fido_dev_largeblob_trim(fido_dev_t *dev, const char *pin)
 		goto fail;
 	}
 
-	if ((r = remove_unknown_blobs(&arr, &keys)) != FIDO_OK ||
+	if ((r = remove_unknown_blobs(dev, &arr, &keys)) != FIDO_OK ||
 	    (r = largeblob_array_set_wait(dev, arr, pin, -1)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_array_set_wait", __func__);
 		goto fail;
@@ -977,3 +1393,170 @@ fail:
 
 	return (r);
 }
+
+int
+fido_dev_largeblob_set_cache(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_largeblob_cache_free(&dev->largeblob);
+		return (FIDO_OK);
+	}
+
+	if (dev->largeblob == NULL && (dev->largeblob = calloc(1,
+	    sizeof(*dev->largeblob))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
+fido_largeblob_batch_t *
+fido_largeblob_batch_new(void)
+{
+	return (calloc(1, sizeof(fido_largeblob_batch_t)));
+}
+
+void
+fido_largeblob_batch_free(fido_largeblob_batch_t **bp)
+{
+	fido_largeblob_batch_t *b;
+
+	if (bp == NULL || (b = *bp) == NULL)
+		return;
+
+	for (size_t i = 0; i < b->n; i++) {
+		fido_blob_reset(&b->op[i].key);
+		fido_blob_reset(&b->op[i].data);
+	}
+	free(b->op);
+	free(b);
+
+	*bp = NULL;
+}
+
+size_t
+fido_largeblob_batch_count(const fido_largeblob_batch_t *b)
+{
+	return (b->n);
+}
+
+static int
+largeblob_batch_add(fido_largeblob_batch_t *b, const unsigned char *key_ptr,
+    size_t key_len, const fido_blob_t *data)
+{
+	fido_largeblob_op_t	*op;
+
+	if (key_ptr == NULL || key_len != 32) {
+		fido_log_debug("%s: key_ptr=%p, key_len=%zu", __func__,
+		    (const void *)key_ptr, key_len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (b->n == SIZE_MAX || (op = recallocarray(b->op, b->n, b->n + 1,
+	    sizeof(*op))) == NULL) {
+		fido_log_debug("%s: recallocarray", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	b->op = op;
+	op = &b->op[b->n];
+
+	if (fido_blob_set(&op->key, key_ptr, key_len) < 0 || (data != NULL &&
+	    fido_blob_set(&op->data, data->ptr, data->len) < 0)) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		fido_blob_reset(&op->key);
+		fido_blob_reset(&op->data);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	b->n++;
+
+	return (FIDO_OK);
+}
+
+int
+fido_largeblob_batch_put(fido_largeblob_batch_t *b, const unsigned char *key_ptr,
+    size_t key_len, const fido_blob_t *blob)
+{
+	if (blob == NULL || fido_blob_is_empty(blob)) {
+		fido_log_debug("%s: blob=%p", __func__, (const void *)blob);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	return (largeblob_batch_add(b, key_ptr, key_len, blob));
+}
+
+int
+fido_largeblob_batch_remove(fido_largeblob_batch_t *b,
+    const unsigned char *key_ptr, size_t key_len)
+{
+	return (largeblob_batch_add(b, key_ptr, key_len, NULL));
+}
+
+/*
+ * Apply every operation in the batch to a single copy of the large-blob
+ * array, and write the result back once, under a single PIN/UV token.
+ * Operations are applied in the order they were added, so a later put
+ * or remove of a key overrides an earlier one.
+ */
+int
+fido_dev_largeblob_batch(fido_dev_t *dev, const fido_largeblob_batch_t *b,
+    const char *pin)
+{
+	const fido_largeblob_op_t	*op;
+	cbor_item_t			*arr = NULL;
+	cbor_item_t			*item = NULL;
+	int				 r;
+
+	if (b == NULL || b->n == 0) {
+		fido_log_debug("%s: b=%p", __func__, (const void *)b);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((arr = largeblob_array_get_wait(dev, -1)) == NULL) {
+		fido_log_debug("%s: largeblob_array_get_wait", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	for (size_t i = 0; i < b->n; i++) {
+		op = &b->op[i];
+		if (fido_blob_is_empty(&op->data)) {
+			if ((r = largeblob_array_remove(dev, &arr,
+			    &op->key)) != FIDO_OK) {
+				fido_log_debug("%s: largeblob_array_remove",
+				    __func__);
+				goto fail;
+			}
+			continue;
+		}
+		if ((item = largeblob_encode(dev, &op->data,
+		    &op->key)) == NULL) {
+			fido_log_debug("%s: largeblob_encode", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = largeblob_array_insert(dev, &arr, &op->key,
+		    item)) != FIDO_OK) {
+			fido_log_debug("%s: largeblob_array_insert", __func__);
+			goto fail;
+		}
+		cbor_decref(&item);
+	}
+
+	if ((r = largeblob_array_set_wait(dev, arr, pin, -1)) != FIDO_OK) {
+		fido_log_debug("%s: largeblob_array_set_wait", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	/* the cached key index may describe a half-modified array */
+	if (r != FIDO_OK)
+		fido_largeblob_cache_reset(dev->largeblob);
+	if (arr != NULL)
+		cbor_decref(&arr);
+	if (item != NULL)
+		cbor_decref(&item);
+
+	return (r);
+}
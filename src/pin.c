@@ -136,6 +136,9 @@ encode_uv_permission(uint8_t cmd)
 		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_CONFIG));
 	case CTAP_CBOR_MAKECRED:
 		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_MAKECRED));
+	case FIDO_UV_TOKEN_MAKECRED_ASSERT:
+		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_MAKECRED |
+		    CTAP21_UV_TOKEN_PERM_ASSERT));
 	case CTAP_CBOR_CRED_MGMT_PRE:
 		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_CRED_MGMT));
 	case CTAP_CBOR_LARGEBLOB:
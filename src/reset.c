@@ -24,6 +24,8 @@ fido_dev_reset_wait(fido_dev_t *dev, int ms)
 {
 	int r;
 
+	fido_credman_cache_reset(dev->credman);
+
 	if ((r = fido_dev_reset_tx(dev)) != FIDO_OK ||
 	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK)
 		return (r);
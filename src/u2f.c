@@ -79,20 +79,15 @@ fail:
 }
 
 static int
-authdata_fake(const char *rp_id, uint8_t flags, uint32_t sigcount,
-    fido_blob_t *fake_cbor_ad)
+authdata_fake(const unsigned char *rp_id_hash, uint8_t flags,
+    uint32_t sigcount, fido_blob_t *fake_cbor_ad)
 {
 	fido_authdata_t	 ad;
 	cbor_item_t	*item = NULL;
 	size_t		 alloc_len;
 
 	memset(&ad, 0, sizeof(ad));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    ad.rp_id_hash) != ad.rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		return (-1);
-	}
+	memcpy(ad.rp_id_hash, rp_id_hash, sizeof(ad.rp_id_hash));
 
 	ad.flags = flags; /* XXX translate? */
 	ad.sigcount = sigcount;
@@ -170,39 +165,29 @@ fail:
 }
 
 static int
-key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
-    int *found, int ms)
+key_lookup(fido_dev_t *dev, const unsigned char *rp_id_hash,
+    const fido_blob_t *key_id, int *found, int ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
 	unsigned char	 challenge[SHA256_DIGEST_LENGTH];
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
 	unsigned char	 reply[FIDO_MAXMSG];
 	uint8_t		 key_id_len;
 	int		 r;
 
-	if (key_id->len > UINT8_MAX || rp_id == NULL) {
-		fido_log_debug("%s: key_id->len=%zu, rp_id=%p", __func__,
-		    key_id->len, (const void *)rp_id);
+	if (key_id->len > UINT8_MAX) {
+		fido_log_debug("%s: key_id->len=%zu", __func__, key_id->len);
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
 	memset(&challenge, 0xff, sizeof(challenge));
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
 
 	key_id_len = (uint8_t)key_id->len;
 
 	if ((apdu = iso7816_new(0, U2F_CMD_AUTH, U2F_AUTH_CHECK, (uint16_t)(2 *
 	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len))) == NULL ||
 	    iso7816_add(apdu, &challenge, sizeof(challenge)) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
+	    iso7816_add(apdu, rp_id_hash, SHA256_DIGEST_LENGTH) < 0 ||
 	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
 	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
 		fido_log_debug("%s: iso7816", __func__);
@@ -243,8 +228,8 @@ fail:
 }
 
 static int
-parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
-    const unsigned char *reply, size_t len)
+parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad,
+    const unsigned char *rp_id_hash, const unsigned char *reply, size_t len)
 {
 	uint8_t		flags;
 	uint32_t	sigcount;
@@ -267,7 +252,7 @@ parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
 		return (FIDO_ERR_RX);
 	}
 
-	if (authdata_fake(rp_id, flags, sigcount, ad) < 0) {
+	if (authdata_fake(rp_id_hash, flags, sigcount, ad) < 0) {
 		fido_log_debug("%s; authdata_fake", __func__);
 		return (FIDO_ERR_RX);
 	}
@@ -276,11 +261,11 @@ parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
 }
 
 static int
-do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
-    const fido_blob_t *key_id, fido_blob_t *sig, fido_blob_t *ad, int ms)
+do_auth(fido_dev_t *dev, const fido_blob_t *cdh,
+    const unsigned char *rp_id_hash, const fido_blob_t *key_id,
+    fido_blob_t *sig, fido_blob_t *ad, int ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
 	unsigned char	 reply[FIDO_MAXMSG];
 	int		 reply_len;
 	uint8_t		 key_id_len;
@@ -290,27 +275,17 @@ do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
 	ms = 0; /* XXX */
 #endif
 
-	if (cdh->len != SHA256_DIGEST_LENGTH || key_id->len > UINT8_MAX ||
-	    rp_id == NULL) {
+	if (cdh->len != SHA256_DIGEST_LENGTH || key_id->len > UINT8_MAX) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
-
 	key_id_len = (uint8_t)key_id->len;
 
 	if ((apdu = iso7816_new(0, U2F_CMD_AUTH, U2F_AUTH_SIGN, (uint16_t)(2 *
 	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len))) == NULL ||
 	    iso7816_add(apdu, cdh->ptr, cdh->len) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
+	    iso7816_add(apdu, rp_id_hash, SHA256_DIGEST_LENGTH) < 0 ||
 	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
 	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
 		fido_log_debug("%s: iso7816", __func__);
@@ -338,7 +313,7 @@ do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
 		}
 	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
 
-	if ((r = parse_auth_reply(sig, ad, rp_id, reply,
+	if ((r = parse_auth_reply(sig, ad, rp_id_hash, reply,
 	    (size_t)reply_len)) != FIDO_OK) {
 		fido_log_debug("%s: parse_auth_reply", __func__);
 		goto fail;
@@ -394,8 +369,8 @@ fail:
 }
 
 static int
-encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
-    const uint8_t *pubkey, size_t pubkey_len, fido_blob_t *out)
+encode_cred_authdata(const unsigned char *rp_id_hash, const uint8_t *kh,
+    uint8_t kh_len, const uint8_t *pubkey, size_t pubkey_len, fido_blob_t *out)
 {
 	fido_authdata_t	 	 authdata;
 	fido_attcred_raw_t	 attcred_raw;
@@ -412,21 +387,12 @@ encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
 	memset(&authdata_blob, 0, sizeof(authdata_blob));
 	memset(out, 0, sizeof(*out));
 
-	if (rp_id == NULL) {
-		fido_log_debug("%s: NULL rp_id", __func__);
-		goto fail;
-	}
-
 	if (cbor_blob_from_ec_point(pubkey, pubkey_len, &pk_blob) < 0) {
 		fido_log_debug("%s: cbor_blob_from_ec_point", __func__);
 		goto fail;
 	}
 
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    authdata.rp_id_hash) != authdata.rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		goto fail;
-	}
+	memcpy(authdata.rp_id_hash, rp_id_hash, sizeof(authdata.rp_id_hash));
 
 	authdata.flags = (CTAP_AUTHDATA_ATT_CRED | CTAP_AUTHDATA_USER_PRESENT);
 	authdata.sigcount = 0;
@@ -522,7 +488,7 @@ parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 	}
 
 	/* authdata */
-	if (encode_cred_authdata(cred->rp.id, kh, kh_len, pubkey,
+	if (encode_cred_authdata(cred->rp_id_hash, kh, kh_len, pubkey,
 	    sizeof(pubkey), &ad) < 0) {
 		fido_log_debug("%s: encode_cred_authdata", __func__);
 		goto fail;
@@ -551,7 +517,6 @@ int
 u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
 	unsigned char	 reply[FIDO_MAXMSG];
 	int		 reply_len;
 	int		 found;
@@ -568,14 +533,15 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 	}
 
 	if (cred->type != COSE_ES256 || cred->cdh.ptr == NULL ||
-	    cred->rp.id == NULL || cred->cdh.len != SHA256_DIGEST_LENGTH) {
+	    cred->rp_id_hash_set == false ||
+	    cred->cdh.len != SHA256_DIGEST_LENGTH) {
 		fido_log_debug("%s: type=%d, cdh=(%p,%zu)" , __func__,
 		    cred->type, (void *)cred->cdh.ptr, cred->cdh.len);
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
 	for (size_t i = 0; i < cred->excl.len; i++) {
-		if ((r = key_lookup(dev, cred->rp.id, &cred->excl.ptr[i],
+		if ((r = key_lookup(dev, cred->rp_id_hash, &cred->excl.ptr[i],
 		    &found, ms)) != FIDO_OK) {
 			fido_log_debug("%s: key_lookup", __func__);
 			return (r);
@@ -590,18 +556,11 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int ms)
 		}
 	}
 
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)cred->rp.id, strlen(cred->rp.id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		return (FIDO_ERR_INTERNAL);
-	}
-
 	if ((apdu = iso7816_new(0, U2F_CMD_REGISTER, 0, 2 *
 	    SHA256_DIGEST_LENGTH)) == NULL ||
 	    iso7816_add(apdu, cred->cdh.ptr, cred->cdh.len) < 0 ||
-	    iso7816_add(apdu, rp_id_hash, sizeof(rp_id_hash)) < 0) {
+	    iso7816_add(apdu, cred->rp_id_hash,
+	    sizeof(cred->rp_id_hash)) < 0) {
 		fido_log_debug("%s: iso7816", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -650,7 +609,8 @@ u2f_authenticate_single(fido_dev_t *dev, const fido_blob_t *key_id,
 	memset(&sig, 0, sizeof(sig));
 	memset(&ad, 0, sizeof(ad));
 
-	if ((r = key_lookup(dev, fa->rp_id, key_id, &found, ms)) != FIDO_OK) {
+	if ((r = key_lookup(dev, fa->rp_id_hash, key_id, &found,
+	    ms)) != FIDO_OK) {
 		fido_log_debug("%s: key_lookup", __func__);
 		goto fail;
 	}
@@ -673,7 +633,7 @@ u2f_authenticate_single(fido_dev_t *dev, const fido_blob_t *key_id,
 		goto fail;
 	}
 
-	if ((r = do_auth(dev, &fa->cdh, fa->rp_id, key_id, &sig, &ad,
+	if ((r = do_auth(dev, &fa->cdh, fa->rp_id_hash, key_id, &sig, &ad,
 	    ms)) != FIDO_OK) {
 		fido_log_debug("%s: do_auth", __func__);
 		goto fail;
@@ -707,6 +667,11 @@ u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int ms)
 		return (FIDO_ERR_UNSUPPORTED_OPTION);
 	}
 
+	if (fa->rp_id_hash_set == false) {
+		fido_log_debug("%s: rp_id_hash", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
 	if ((r = fido_assert_set_count(fa, fa->allow_list.len)) != FIDO_OK) {
 		fido_log_debug("%s: fido_assert_set_count", __func__);
 		return (r);
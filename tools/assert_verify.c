@@ -20,14 +20,19 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "extern.h"
 
+/*
+ * Read and set up an assertion. On error, exit unless FLAG_BATCH is set,
+ * in which case NULL is returned and the error is stored in *status.
+ */
 static fido_assert_t *
-prepare_assert(FILE *in_f, int flags)
+prepare_assert(FILE *in_f, int flags, int *status)
 {
 	fido_assert_t *assert = NULL;
 	struct blob cdh;
 	struct blob authdata;
 	struct blob sig;
 	char *rpid = NULL;
+	const char *what = NULL;
 	int r;
 
 	memset(&cdh, 0, sizeof(cdh));
@@ -38,8 +43,12 @@ prepare_assert(FILE *in_f, int flags)
 	r |= string_read(in_f, &rpid);
 	r |= base64_read(in_f, &authdata);
 	r |= base64_read(in_f, &sig);
-	if (r < 0)
-		errx(1, "input error");
+	if (r < 0) {
+		if ((flags & FLAG_BATCH) == 0)
+			errx(1, "input error");
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
 
 	if (flags & FLAG_DEBUG) {
 		fprintf(stderr, "client data hash:\n");
@@ -61,24 +70,43 @@ prepare_assert(FILE *in_f, int flags)
 	    (r = fido_assert_set_rp(assert, rpid)) != FIDO_OK ||
 	    (r = fido_assert_set_authdata(assert, 0, authdata.ptr,
 	    authdata.len)) != FIDO_OK ||
-	    (r = fido_assert_set_sig(assert, 0, sig.ptr, sig.len)) != FIDO_OK)
-		errx(1, "fido_assert_set: %s", fido_strerr(r));
+	    (r = fido_assert_set_sig(assert, 0, sig.ptr, sig.len)) != FIDO_OK) {
+		what = "fido_assert_set";
+		goto fail;
+	}
 
 	if (flags & FLAG_UP) {
-		if ((r = fido_assert_set_up(assert, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_assert_set_up: %s", fido_strerr(r));
+		if ((r = fido_assert_set_up(assert,
+		    FIDO_OPT_TRUE)) != FIDO_OK) {
+			what = "fido_assert_set_up";
+			goto fail;
+		}
 	}
 	if (flags & FLAG_UV) {
-		if ((r = fido_assert_set_uv(assert, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_assert_set_uv: %s", fido_strerr(r));
+		if ((r = fido_assert_set_uv(assert,
+		    FIDO_OPT_TRUE)) != FIDO_OK) {
+			what = "fido_assert_set_uv";
+			goto fail;
+		}
 	}
 	if (flags & FLAG_HMAC) {
 		if ((r = fido_assert_set_extensions(assert,
-		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
-			errx(1, "fido_assert_set_extensions: %s",
-			    fido_strerr(r));
+		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK) {
+			what = "fido_assert_set_extensions";
+			goto fail;
+		}
 	}
 
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK) {
+		if ((flags & FLAG_BATCH) == 0)
+			errx(1, "%s: %s", what, fido_strerr(r));
+		fido_assert_free(&assert);
+	}
+
+	*status = r;
+
 	free(cdh.ptr);
 	free(authdata.ptr);
 	free(sig.ptr);
@@ -133,19 +161,70 @@ load_pubkey(int type, const char *file)
 	return (pk);
 }
 
+/*
+ * Verify assertions read from in_f until EOF, BATCH_LEN at a time, against
+ * the same public key. Print one "record result" line per assertion on
+ * out_f; a record that cannot be parsed gets its error and is skipped.
+ */
+static int
+verify_batch(FILE *in_f, FILE *out_f, int type, const void *pk, int flags)
+{
+	fido_assert_t *av[BATCH_LEN];
+	const void *pkv[BATCH_LEN];
+	size_t idx[BATCH_LEN];
+	size_t rec_idx[BATCH_LEN];
+	int status[BATCH_LEN];
+	int verdict[BATCH_LEN];
+	unsigned long long rec = 0;
+	size_t n;
+	size_t m;
+	int ok = 0;
+
+	for (size_t i = 0; i < BATCH_LEN; i++) {
+		pkv[i] = pk;
+		idx[i] = 0;
+	}
+
+	do {
+		for (n = 0, m = 0; n < BATCH_LEN && more_input(in_f); n++) {
+			if ((av[m] = prepare_assert(in_f, flags,
+			    &status[n])) != NULL)
+				rec_idx[m++] = n;
+		}
+		if (m > 0)
+			(void)fido_assert_verify_batch(
+			    (const fido_assert_t *const *)av, idx, m, type,
+			    pkv, verdict);
+		for (size_t i = 0; i < m; i++) {
+			status[rec_idx[i]] = verdict[i];
+			fido_assert_free(&av[i]);
+		}
+		for (size_t i = 0; i < n; i++) {
+			if (status[i] != FIDO_OK)
+				ok = -1;
+			fprintf(out_f, "%llu %s\n", ++rec,
+			    fido_strerr(status[i]));
+		}
+	} while (n == BATCH_LEN);
+
+	return (ok);
+}
+
 int
 assert_verify(int argc, char **argv)
 {
 	fido_assert_t *assert = NULL;
 	void *pk = NULL;
 	char *in_path = NULL;
+	char *out_path = NULL;
 	FILE *in_f = NULL;
+	FILE *out_f = NULL;
 	int type = COSE_ES256;
 	int flags = 0;
 	int ch;
 	int r;
 
-	while ((ch = getopt(argc, argv, "dhi:pv")) != -1) {
+	while ((ch = getopt(argc, argv, "dhi:mo:pv")) != -1) {
 		switch (ch) {
 		case 'd':
 			flags |= FLAG_DEBUG;
@@ -156,6 +235,12 @@ assert_verify(int argc, char **argv)
 		case 'i':
 			in_path = optarg;
 			break;
+		case 'm':
+			flags |= FLAG_BATCH;
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
 		case 'p':
 			flags |= FLAG_UP;
 			break;
@@ -174,6 +259,7 @@ assert_verify(int argc, char **argv)
 		usage();
 
 	in_f = open_read(in_path);
+	out_f = open_write(out_path);
 
 	if (argc > 1 && cose_type(argv[1], &type) < 0)
 		errx(1, "unknown type %s", argv[1]);
@@ -181,13 +267,25 @@ assert_verify(int argc, char **argv)
 	fido_init((flags & FLAG_DEBUG) ? FIDO_DEBUG : 0);
 
 	pk = load_pubkey(type, argv[0]);
-	assert = prepare_assert(in_f, flags);
+
+	if (flags & FLAG_BATCH) {
+		r = verify_batch(in_f, out_f, type, pk, flags);
+		fclose(in_f);
+		fclose(out_f);
+		in_f = NULL;
+		out_f = NULL;
+		exit(r < 0 ? 1 : 0);
+	}
+
+	assert = prepare_assert(in_f, flags, &r);
 	if ((r = fido_assert_verify(assert, 0, type, pk)) != FIDO_OK)
 		errx(1, "fido_assert_verify: %s", fido_strerr(r));
 	fido_assert_free(&assert);
 
 	fclose(in_f);
+	fclose(out_f);
 	in_f = NULL;
+	out_f = NULL;
 
 	exit(0);
 }
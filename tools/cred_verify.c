@@ -15,8 +15,12 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "extern.h"
 
+/*
+ * Read and set up a credential. On error, exit unless FLAG_BATCH is set,
+ * in which case NULL is returned and the error is stored in *status.
+ */
 static fido_cred_t *
-prepare_cred(FILE *in_f, int type, int flags)
+prepare_cred(FILE *in_f, int type, int flags, int *status)
 {
 	fido_cred_t *cred = NULL;
 	struct blob cdh;
@@ -26,6 +30,7 @@ prepare_cred(FILE *in_f, int type, int flags)
 	struct blob x5c;
 	char *rpid = NULL;
 	char *fmt = NULL;
+	const char *what = NULL;
 	int r;
 
 	memset(&cdh, 0, sizeof(cdh));
@@ -40,11 +45,16 @@ prepare_cred(FILE *in_f, int type, int flags)
 	r |= base64_read(in_f, &authdata);
 	r |= base64_read(in_f, &id);
 	r |= base64_read(in_f, &sig);
-	if (r < 0)
-		errx(1, "input error");
 
 	(void)base64_read(in_f, &x5c);
 
+	if (r < 0) {
+		if ((flags & FLAG_BATCH) == 0)
+			errx(1, "input error");
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
 	if (flags & FLAG_DEBUG) {
 		fprintf(stderr, "client data hash:\n");
 		xxd(cdh.ptr, cdh.len);
@@ -70,24 +80,43 @@ prepare_cred(FILE *in_f, int type, int flags)
 	    (r = fido_cred_set_authdata(cred, authdata.ptr,
 	    authdata.len)) != FIDO_OK ||
 	    (r = fido_cred_set_sig(cred, sig.ptr, sig.len)) != FIDO_OK ||
-	    (r = fido_cred_set_fmt(cred, fmt)) != FIDO_OK)
-		errx(1, "fido_cred_set: %s", fido_strerr(r));
+	    (r = fido_cred_set_fmt(cred, fmt)) != FIDO_OK) {
+		what = "fido_cred_set";
+		goto fail;
+	}
 
 	if (x5c.ptr != NULL) {
-		if ((r = fido_cred_set_x509(cred, x5c.ptr, x5c.len)) != FIDO_OK)
-			errx(1, "fido_cred_set_x509: %s", fido_strerr(r));
+		if ((r = fido_cred_set_x509(cred, x5c.ptr,
+		    x5c.len)) != FIDO_OK) {
+			what = "fido_cred_set_x509";
+			goto fail;
+		}
 	}
 
 	if (flags & FLAG_UV) {
-		if ((r = fido_cred_set_uv(cred, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_cred_set_uv: %s", fido_strerr(r));
+		if ((r = fido_cred_set_uv(cred, FIDO_OPT_TRUE)) != FIDO_OK) {
+			what = "fido_cred_set_uv";
+			goto fail;
+		}
 	}
 	if (flags & FLAG_HMAC) {
 		if ((r = fido_cred_set_extensions(cred,
-		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
-			errx(1, "fido_cred_set_extensions: %s", fido_strerr(r));
+		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK) {
+			what = "fido_cred_set_extensions";
+			goto fail;
+		}
 	}
 
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK) {
+		if ((flags & FLAG_BATCH) == 0)
+			errx(1, "%s: %s", what, fido_strerr(r));
+		fido_cred_free(&cred);
+	}
+
+	*status = r;
+
 	free(cdh.ptr);
 	free(authdata.ptr);
 	free(id.ptr);
@@ -99,6 +128,51 @@ prepare_cred(FILE *in_f, int type, int flags)
 	return (cred);
 }
 
+static int
+verify_cred(fido_cred_t *cred, int cred_prot)
+{
+	int r;
+
+	if (cred_prot > 0) {
+		r = fido_cred_set_prot(cred, cred_prot);
+		if (r != FIDO_OK) {
+			errx(1, "fido_cred_set_prot: %s", fido_strerr(r));
+		}
+	}
+
+	if (fido_cred_x5c_ptr(cred) == NULL)
+		r = fido_cred_verify_self(cred);
+	else
+		r = fido_cred_verify(cred);
+
+	return (r);
+}
+
+/*
+ * Verify credentials read from in_f until EOF, printing one
+ * "record result" line per credential. A record that cannot be parsed
+ * gets its error and is skipped.
+ */
+static int
+verify_batch(FILE *in_f, FILE *out_f, int type, int flags, int cred_prot)
+{
+	fido_cred_t *cred = NULL;
+	unsigned long long rec = 0;
+	int ok = 0;
+	int r;
+
+	while (more_input(in_f)) {
+		if ((cred = prepare_cred(in_f, type, flags, &r)) != NULL)
+			r = verify_cred(cred, cred_prot);
+		if (r != FIDO_OK)
+			ok = -1;
+		fprintf(out_f, "%llu %s\n", ++rec, fido_strerr(r));
+		fido_cred_free(&cred);
+	}
+
+	return (ok);
+}
+
 int
 cred_verify(int argc, char **argv)
 {
@@ -113,7 +187,7 @@ cred_verify(int argc, char **argv)
 	int ch;
 	int r;
 
-	while ((ch = getopt(argc, argv, "c:dhi:o:v")) != -1) {
+	while ((ch = getopt(argc, argv, "c:dhi:mo:v")) != -1) {
 		switch (ch) {
 		case 'c':
 			if ((cred_prot = base10(optarg)) < 0)
@@ -128,6 +202,9 @@ cred_verify(int argc, char **argv)
 		case 'i':
 			in_path = optarg;
 			break;
+		case 'm':
+			flags |= FLAG_BATCH;
+			break;
 		case 'o':
 			out_path = optarg;
 			break;
@@ -152,22 +229,22 @@ cred_verify(int argc, char **argv)
 		errx(1, "unknown type %s", argv[0]);
 
 	fido_init((flags & FLAG_DEBUG) ? FIDO_DEBUG : 0);
-	cred = prepare_cred(in_f, type, flags);
 
-	if (cred_prot > 0) {
-		r = fido_cred_set_prot(cred, cred_prot);
-		if (r != FIDO_OK) {
-			errx(1, "fido_cred_set_prot: %s", fido_strerr(r));
-		}
+	if (flags & FLAG_BATCH) {
+		r = verify_batch(in_f, out_f, type, flags, cred_prot);
+		fclose(in_f);
+		fclose(out_f);
+		in_f = NULL;
+		out_f = NULL;
+		exit(r < 0 ? 1 : 0);
 	}
 
-	if (fido_cred_x5c_ptr(cred) == NULL) {
-		if ((r = fido_cred_verify_self(cred)) != FIDO_OK)
-			errx(1, "fido_cred_verify_self: %s", fido_strerr(r));
-	} else {
-		if ((r = fido_cred_verify(cred)) != FIDO_OK)
-			errx(1, "fido_cred_verify: %s", fido_strerr(r));
-	}
+	cred = prepare_cred(in_f, type, flags, &r);
+
+	if ((r = verify_cred(cred, cred_prot)) != FIDO_OK)
+		errx(1, "%s: %s", fido_cred_x5c_ptr(cred) == NULL ?
+		    "fido_cred_verify_self" : "fido_cred_verify",
+		    fido_strerr(r));
 
 	print_cred(out_f, type, cred);
 	fido_cred_free(&cred);
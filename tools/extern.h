@@ -28,6 +28,9 @@ struct blob {
 #define FLAG_HMAC	0x20
 #define FLAG_UP		0x40
 #define FLAG_LARGEBLOB	0x80
+#define FLAG_BATCH	0x100
+
+#define BATCH_LEN	64	/* records verified per batch */
 
 EC_KEY *read_ec_pubkey(const char *);
 fido_dev_t *open_dev(const char *);
@@ -62,6 +65,7 @@ int credman_list_rk(char *, const char *);
 int credman_list_rp(char *);
 int credman_print_rk(fido_dev_t *, const char *, char *, char *);
 int get_devopt(fido_dev_t *, const char *, int *);
+int more_input(FILE *);
 int pin_change(char *);
 int pin_set(char *);
 int string_read(FILE *, char **);
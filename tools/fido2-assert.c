@@ -29,7 +29,7 @@ usage(void)
 {
 	fprintf(stderr,
 "usage: fido2-assert -G [-bdhpruv] [-t option] [-i input_file] [-o output_file] device\n"
-"       fido2-assert -V [-dhpv] [-i input_file] key_file [type]\n"
+"       fido2-assert -V [-dhmpv] [-i input_file] [-o output_file] key_file [type]\n"
 	);
 
 	exit(1);
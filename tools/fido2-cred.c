@@ -27,7 +27,7 @@ usage(void)
 {
 	fprintf(stderr,
 "usage: fido2-cred -M [-bdhqruv] [-c cred_protect] [-i input_file] [-o output_file] device [type]\n"
-"       fido2-cred -V [-dhv] [-c cred_protect] [-i input_file] [-o output_file] [type]\n"
+"       fido2-cred -V [-dhmv] [-c cred_protect] [-i input_file] [-o output_file] [type]\n"
 	);
 
 	exit(1);
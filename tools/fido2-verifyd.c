@@ -0,0 +1,999 @@
+/*
+ * Copyright (c) 2021 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ */
+
+/*
+ * fido2-verifyd: verify assertions and credentials on behalf of local
+ * clients connected to a UNIX socket. See fido2-verifyd(1) for the
+ * protocol.
+ *
+ * Example usage:
+ *
+ * $ fido2-verifyd /tmp/verifyd.sock &
+ * $ (echo assert es256 p; base64 < raw_pubkey; cat assert_record) | \
+ *     nc -U /tmp/verifyd.sock
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <fido.h>
+#include <fido/es256.h>
+#include <fido/rs256.h>
+#include <fido/eddsa.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "../openbsd-compat/openbsd-compat.h"
+#include "extern.h"
+
+#define MAXWORKERS	64
+#define MAXCONN		1024	/* open connections */
+#define MAXREQUEST	65536	/* largest request buffered, in bytes */
+#define IDLE_TIMEOUT	30	/* seconds before an idle client is dropped */
+#define SEND_TIMEOUT	5	/* seconds a worker may block on a response */
+#define KEYSLOTS	1024	/* key hash buckets; must be a power of 2 */
+#define MAXKEYS		768	/* cached keys */
+#define NBUCKETS	32	/* latency histogram, log2(us) */
+
+/*
+ * A cached public key. Keys are cached only after they have verified a
+ * request, and are evicted in clock order once MAXKEYS are cached. A key
+ * held by a worker is not evicted.
+ */
+struct key {
+	int		 type;
+	unsigned char	*raw;
+	size_t		 len;
+	void		*pk;
+	size_t		 hash;
+	unsigned int	 refs;		/* workers using the key */
+	bool		 used;		/* used since the clock hand passed */
+	struct key	*next;		/* same bucket */
+};
+
+static struct {
+	pthread_mutex_t	 mtx;
+	struct key	*bucket[KEYSLOTS];
+	struct key	 entry[MAXKEYS];
+	size_t		 n;
+	size_t		 hand;		/* clock hand */
+	unsigned long long evicted;
+} keys = { PTHREAD_MUTEX_INITIALIZER, { NULL }, { { 0, NULL, 0, NULL, 0, 0,
+    false, NULL } }, 0, 0, 0 };
+
+/*
+ * A client connection. At any time, a connection is either idle and
+ * polled by the main thread, waiting in the queue for a worker, or
+ * being served by exactly one worker.
+ */
+struct conn {
+	int		 fd;
+	bool		 eof;
+	char		*buf;		/* input not yet served */
+	size_t		 len;
+	time_t		 deadline;	/* when an idle connection is dropped */
+	struct conn	*next;
+};
+
+/* connections with input, waiting for a worker */
+static struct {
+	pthread_mutex_t	 mtx;
+	pthread_cond_t	 cv;
+	struct conn	*c[MAXCONN];
+	size_t		 head;
+	size_t		 len;
+} queue = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, { NULL },
+    0, 0 };
+
+/* connections handed back to the main thread by the workers */
+static struct {
+	pthread_mutex_t	 mtx;
+	struct conn	*idle;
+	size_t		 n;		/* open connections */
+	int		 wake[2];	/* wakes up the main thread */
+} conns = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, { -1, -1 } };
+
+static struct {
+	pthread_mutex_t		 mtx;
+	unsigned long long	 requests;
+	unsigned long long	 failed;
+	unsigned long long	 latency[NBUCKETS];
+} stats = { PTHREAD_MUTEX_INITIALIZER, 0, 0, { 0 } };
+
+static volatile sig_atomic_t got_signal;
+static int debug;
+static int nworkers = 4;
+static mode_t sock_mode = 0600;
+
+static void
+verifyd_usage(void)
+{
+	fprintf(stderr,
+"usage: fido2-verifyd [-d] [-j workers] [-m mode] socket_path\n"
+	);
+
+	exit(1);
+}
+
+static void
+pk_free(int type, void **pk)
+{
+	switch (type) {
+	case COSE_ES256:
+		es256_pk_prepared_free((es256_pk_prepared_t **)pk);
+		break;
+	case COSE_RS256:
+		rs256_pk_free((rs256_pk_t **)pk);
+		break;
+	case COSE_EDDSA:
+		eddsa_pk_free((eddsa_pk_t **)pk);
+		break;
+	}
+}
+
+/*
+ * Parse a public key. ES256 keys are returned as es256_pk_prepared_t,
+ * since a cached key is likely to be used again.
+ */
+static void *
+pk_new(int type, const struct blob *raw)
+{
+	es256_pk_t *es256_pk = NULL;
+	es256_pk_prepared_t *es256_prep = NULL;
+	rs256_pk_t *rs256_pk = NULL;
+	eddsa_pk_t *eddsa_pk = NULL;
+
+	switch (type) {
+	case COSE_ES256:
+		if ((es256_pk = es256_pk_new()) != NULL &&
+		    es256_pk_from_ptr(es256_pk, raw->ptr, raw->len) == FIDO_OK)
+			es256_prep = es256_pk_prepare(es256_pk);
+		es256_pk_free(&es256_pk);
+		return (es256_prep);
+	case COSE_RS256:
+		if ((rs256_pk = rs256_pk_new()) == NULL ||
+		    rs256_pk_from_ptr(rs256_pk, raw->ptr, raw->len) != FIDO_OK)
+			rs256_pk_free(&rs256_pk);
+		return (rs256_pk);
+	case COSE_EDDSA:
+		if ((eddsa_pk = eddsa_pk_new()) == NULL ||
+		    eddsa_pk_from_ptr(eddsa_pk, raw->ptr, raw->len) != FIDO_OK)
+			eddsa_pk_free(&eddsa_pk);
+		return (eddsa_pk);
+	}
+
+	return (NULL);
+}
+
+static size_t
+key_hash(int type, const struct blob *raw)
+{
+	uint32_t h = 2166136261U; /* FNV-1a */
+
+	h = (h ^ (uint32_t)type) * 16777619U;
+	for (size_t i = 0; i < raw->len; i++)
+		h = (h ^ raw->ptr[i]) * 16777619U;
+
+	return ((size_t)h & (KEYSLOTS - 1));
+}
+
+static struct key *
+key_find(int type, const struct blob *raw)
+{
+	struct key *k;
+
+	for (k = keys.bucket[key_hash(type, raw)]; k != NULL; k = k->next)
+		if (k->type == type && k->len == raw->len &&
+		    memcmp(k->raw, raw->ptr, raw->len) == 0)
+			return (k);
+
+	return (NULL);
+}
+
+/*
+ * Pick an entry for a new key, evicting the first unused key under the
+ * clock hand if the cache is full. Returns NULL if every cached key is
+ * held by a worker. Called with keys.mtx held.
+ */
+static struct key *
+key_victim(void)
+{
+	struct key *k, **kp;
+
+	if (keys.n < MAXKEYS)
+		return (&keys.entry[keys.n++]);
+
+	for (size_t i = 0; i < 2 * MAXKEYS; i++) {
+		k = &keys.entry[keys.hand];
+		keys.hand = (keys.hand + 1) % MAXKEYS;
+		if (k->refs != 0)
+			continue;
+		if (k->used) {
+			k->used = false;
+			continue;
+		}
+		for (kp = &keys.bucket[k->hash]; *kp != k; kp = &(*kp)->next)
+			continue;
+		*kp = k->next;
+		pk_free(k->type, &k->pk);
+		free(k->raw);
+		memset(k, 0, sizeof(*k));
+		keys.evicted++;
+		return (k);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Look up a public key in the cache, or parse it on a miss. On a hit,
+ * *kp is set to the cache entry, which the caller holds until key_put().
+ * On a miss, *kp is NULL and the caller owns the returned key.
+ */
+static void *
+key_get(int type, const struct blob *raw, struct key **kp)
+{
+	struct key *k;
+
+	pthread_mutex_lock(&keys.mtx);
+	if ((k = key_find(type, raw)) != NULL) {
+		k->refs++;
+		k->used = true;
+	}
+	pthread_mutex_unlock(&keys.mtx);
+
+	if ((*kp = k) != NULL)
+		return (k->pk);
+
+	return (pk_new(type, raw));
+}
+
+/*
+ * Release a key obtained with key_get(). A key the caller owns is cached
+ * if it verified the request, and freed otherwise.
+ */
+static void
+key_put(int type, const struct blob *raw, struct key *k, void *pk,
+    bool verified)
+{
+	unsigned char *copy = NULL;
+
+	if (k == NULL && pk != NULL && verified &&
+	    (copy = malloc(raw->len)) != NULL)
+		memcpy(copy, raw->ptr, raw->len);
+
+	pthread_mutex_lock(&keys.mtx);
+	if (k != NULL) {
+		k->refs--;
+		pk = NULL;
+	} else if (copy != NULL && key_find(type, raw) == NULL &&
+	    (k = key_victim()) != NULL) {
+		k->type = type;
+		k->raw = copy;
+		k->len = raw->len;
+		k->pk = pk;
+		k->hash = key_hash(type, raw);
+		k->used = true;
+		k->next = keys.bucket[k->hash];
+		keys.bucket[k->hash] = k;
+		copy = NULL;
+		pk = NULL;
+	}
+	pthread_mutex_unlock(&keys.mtx);
+
+	free(copy);
+	pk_free(type, &pk);
+}
+
+static int
+parse_opts(const char *opts, int *flags)
+{
+	*flags = 0;
+
+	for (; opts != NULL && *opts != '\0'; opts++)
+		switch (*opts) {
+		case 'h':
+			*flags |= FLAG_HMAC;
+			break;
+		case 'p':
+			*flags |= FLAG_UP;
+			break;
+		case 'v':
+			*flags |= FLAG_UV;
+			break;
+		default:
+			return (-1);
+		}
+
+	return (0);
+}
+
+/*
+ * Read an assertion request and verify it, storing the result in *status.
+ * Returns -1 if the request could not be read.
+ */
+static int
+serve_assert(FILE *in_f, int type, int flags, int *status)
+{
+	fido_assert_t *assert = NULL;
+	struct blob key, cdh, authdata, sig;
+	char *rpid = NULL;
+	struct key *k = NULL;
+	void *pk = NULL;
+	int ok = -1;
+	int r = FIDO_ERR_INTERNAL;
+
+	memset(&key, 0, sizeof(key));
+	memset(&cdh, 0, sizeof(cdh));
+	memset(&authdata, 0, sizeof(authdata));
+	memset(&sig, 0, sizeof(sig));
+
+	if (base64_read(in_f, &key) < 0 || base64_read(in_f, &cdh) < 0 ||
+	    string_read(in_f, &rpid) < 0 ||
+	    base64_read(in_f, &authdata) < 0 || base64_read(in_f, &sig) < 0)
+		goto out;
+
+	ok = 0;
+
+	if ((pk = key_get(type, &key, &k)) == NULL) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if ((assert = fido_assert_new()) == NULL) {
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	if ((r = fido_assert_set_count(assert, 1)) != FIDO_OK ||
+	    (r = fido_assert_set_clientdata_hash(assert, cdh.ptr,
+	    cdh.len)) != FIDO_OK ||
+	    (r = fido_assert_set_rp(assert, rpid)) != FIDO_OK ||
+	    (r = fido_assert_set_authdata(assert, 0, authdata.ptr,
+	    authdata.len)) != FIDO_OK ||
+	    (r = fido_assert_set_sig(assert, 0, sig.ptr, sig.len)) != FIDO_OK ||
+	    ((flags & FLAG_UP) && (r = fido_assert_set_up(assert,
+	    FIDO_OPT_TRUE)) != FIDO_OK) ||
+	    ((flags & FLAG_UV) && (r = fido_assert_set_uv(assert,
+	    FIDO_OPT_TRUE)) != FIDO_OK) ||
+	    ((flags & FLAG_HMAC) && (r = fido_assert_set_extensions(assert,
+	    FIDO_EXT_HMAC_SECRET)) != FIDO_OK))
+		goto out;
+
+	if (type == COSE_ES256)
+		r = fido_assert_verify_prepared(assert, 0, pk);
+	else
+		r = fido_assert_verify(assert, 0, type, pk);
+out:
+	*status = r;
+	key_put(type, &key, k, pk, r == FIDO_OK);
+	fido_assert_free(&assert);
+	free(key.ptr);
+	free(cdh.ptr);
+	free(authdata.ptr);
+	free(sig.ptr);
+	free(rpid);
+
+	return (ok);
+}
+
+/*
+ * Read a credential request and verify it, storing the result in *status.
+ * Returns -1 if the request could not be read.
+ */
+static int
+serve_cred(FILE *in_f, int type, int flags, int *status)
+{
+	fido_cred_t *cred = NULL;
+	struct blob cdh, authdata, id, sig, x5c;
+	char *rpid = NULL;
+	char *fmt = NULL;
+	char *x5c_b64 = NULL;
+	int ok = -1;
+	int r = FIDO_ERR_INTERNAL;
+
+	memset(&cdh, 0, sizeof(cdh));
+	memset(&authdata, 0, sizeof(authdata));
+	memset(&id, 0, sizeof(id));
+	memset(&sig, 0, sizeof(sig));
+	memset(&x5c, 0, sizeof(x5c));
+
+	if (base64_read(in_f, &cdh) < 0 || string_read(in_f, &rpid) < 0 ||
+	    string_read(in_f, &fmt) < 0 ||
+	    base64_read(in_f, &authdata) < 0 || base64_read(in_f, &id) < 0 ||
+	    base64_read(in_f, &sig) < 0)
+		goto out;
+
+	/* the certificate line is mandatory, but may be empty */
+	if (string_read(in_f, &x5c_b64) < 0 || (*x5c_b64 != '\0' &&
+	    base64_decode(x5c_b64, (void **)&x5c.ptr, &x5c.len) < 0))
+		goto out;
+
+	ok = 0;
+
+	if ((cred = fido_cred_new()) == NULL) {
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	if ((r = fido_cred_set_type(cred, type)) != FIDO_OK ||
+	    (r = fido_cred_set_clientdata_hash(cred, cdh.ptr,
+	    cdh.len)) != FIDO_OK ||
+	    (r = fido_cred_set_rp(cred, rpid, NULL)) != FIDO_OK ||
+	    (r = fido_cred_set_authdata(cred, authdata.ptr,
+	    authdata.len)) != FIDO_OK ||
+	    (r = fido_cred_set_sig(cred, sig.ptr, sig.len)) != FIDO_OK ||
+	    (r = fido_cred_set_fmt(cred, fmt)) != FIDO_OK ||
+	    (x5c.ptr != NULL && (r = fido_cred_set_x509(cred, x5c.ptr,
+	    x5c.len)) != FIDO_OK) ||
+	    ((flags & FLAG_UV) && (r = fido_cred_set_uv(cred,
+	    FIDO_OPT_TRUE)) != FIDO_OK) ||
+	    ((flags & FLAG_HMAC) && (r = fido_cred_set_extensions(cred,
+	    FIDO_EXT_HMAC_SECRET)) != FIDO_OK))
+		goto out;
+
+	if (x5c.ptr == NULL)
+		r = fido_cred_verify_self(cred);
+	else
+		r = fido_cred_verify(cred);
+out:
+	*status = r;
+	fido_cred_free(&cred);
+	free(cdh.ptr);
+	free(authdata.ptr);
+	free(id.ptr);
+	free(sig.ptr);
+	free(x5c.ptr);
+	free(x5c_b64);
+	free(rpid);
+	free(fmt);
+
+	return (ok);
+}
+
+static void
+print_stats(FILE *out_f)
+{
+	unsigned long long latency[NBUCKETS];
+	unsigned long long requests, failed;
+	size_t nconn, depth;
+
+	pthread_mutex_lock(&stats.mtx);
+	requests = stats.requests;
+	failed = stats.failed;
+	memcpy(latency, stats.latency, sizeof(latency));
+	pthread_mutex_unlock(&stats.mtx);
+
+	pthread_mutex_lock(&conns.mtx);
+	nconn = conns.n;
+	pthread_mutex_unlock(&conns.mtx);
+
+	pthread_mutex_lock(&queue.mtx);
+	depth = queue.len;
+	pthread_mutex_unlock(&queue.mtx);
+
+	fprintf(out_f, "requests %llu\n", requests);
+	fprintf(out_f, "failed %llu\n", failed);
+	fprintf(out_f, "workers %d\n", nworkers);
+	fprintf(out_f, "connections %zu\n", nconn);
+	fprintf(out_f, "queue %zu\n", depth);
+	pthread_mutex_lock(&keys.mtx);
+	fprintf(out_f, "keys %zu\n", keys.n);
+	fprintf(out_f, "evicted %llu\n", keys.evicted);
+	pthread_mutex_unlock(&keys.mtx);
+	for (size_t i = 0; i < NBUCKETS; i++)
+		if (latency[i] != 0)
+			fprintf(out_f, "latency_us %llu %llu\n", 1ULL << i,
+			    latency[i]);
+	fprintf(out_f, "\n");
+}
+
+/*
+ * Account for a request. If t0 is NULL, or the clock cannot be read,
+ * the request is counted but left out of the latency histogram.
+ */
+static void
+account(const struct timespec *t0, int r)
+{
+	struct timespec t1;
+	unsigned long long us;
+	size_t bucket = 0;
+	bool timed = false;
+
+	if (t0 != NULL && clock_gettime(CLOCK_MONOTONIC, &t1) == 0) {
+		us = (unsigned long long)(t1.tv_sec - t0->tv_sec) * 1000000ULL +
+		    (unsigned long long)(t1.tv_nsec / 1000) -
+		    (unsigned long long)(t0->tv_nsec / 1000);
+		while (bucket < NBUCKETS - 1 && (1ULL << bucket) < us)
+			bucket++;
+		timed = true;
+	}
+
+	pthread_mutex_lock(&stats.mtx);
+	stats.requests++;
+	if (r != FIDO_OK)
+		stats.failed++;
+	if (timed)
+		stats.latency[bucket]++;
+	pthread_mutex_unlock(&stats.mtx);
+}
+
+static time_t
+now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return (-1);
+
+	return (ts.tv_sec);
+}
+
+static struct conn *
+conn_new(int fd)
+{
+	struct conn *c;
+	struct timeval tv;
+
+	pthread_mutex_lock(&conns.mtx);
+	if (conns.n == MAXCONN) {
+		pthread_mutex_unlock(&conns.mtx);
+		if (debug)
+			warnx("too many connections");
+		return (NULL);
+	}
+	conns.n++;
+	pthread_mutex_unlock(&conns.mtx);
+
+	/* don't let a client that stops reading pin a worker */
+	memset(&tv, 0, sizeof(tv));
+	tv.tv_sec = SEND_TIMEOUT;
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+		warn("setsockopt");
+		goto fail;
+	}
+	if ((c = calloc(1, sizeof(*c))) == NULL) {
+		warn("calloc");
+		goto fail;
+	}
+	c->fd = fd;
+
+	return (c);
+fail:
+	pthread_mutex_lock(&conns.mtx);
+	conns.n--;
+	pthread_mutex_unlock(&conns.mtx);
+
+	return (NULL);
+}
+
+static void
+conn_close(struct conn *c)
+{
+	close(c->fd);
+	free(c->buf);
+	free(c);
+
+	pthread_mutex_lock(&conns.mtx);
+	conns.n--;
+	pthread_mutex_unlock(&conns.mtx);
+}
+
+/*
+ * Buffer the input available on a connection without blocking, up to
+ * MAXREQUEST bytes. Returns -1 on error.
+ */
+static int
+conn_read(struct conn *c)
+{
+	char tmp[4096];
+	char *buf;
+	size_t want;
+	ssize_t n;
+
+	while (!c->eof && c->len < MAXREQUEST) {
+		if ((want = MAXREQUEST - c->len) > sizeof(tmp))
+			want = sizeof(tmp);
+		if ((n = recv(c->fd, tmp, want, MSG_DONTWAIT)) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return (0);
+			return (-1);
+		}
+		if (n == 0) {
+			c->eof = true;
+			break;
+		}
+		if ((buf = realloc(c->buf, c->len + (size_t)n)) == NULL)
+			return (-1);
+		memcpy(buf + c->len, tmp, (size_t)n);
+		c->buf = buf;
+		c->len += (size_t)n;
+	}
+
+	return (0);
+}
+
+/*
+ * Return the length of the first complete request buffered on a
+ * connection, or 0 if more input is needed. Requests are framed by
+ * counting lines; a request line naming an unknown operation is complete
+ * on its own and rejected by serve().
+ */
+static size_t
+request_len(const struct conn *c)
+{
+	const char *p, *nl, *end;
+	size_t oplen;
+	int nlines = 0;
+
+	if (c->len == 0 || (nl = memchr(c->buf, '\n', c->len)) == NULL)
+		return (0);
+
+	end = c->buf + c->len;
+	for (p = c->buf; p < nl && *p != ' '; p++)
+		continue;
+	oplen = (size_t)(p - c->buf);
+	if (oplen == 6 && memcmp(c->buf, "assert", oplen) == 0)
+		nlines = 5;
+	else if (oplen == 4 && memcmp(c->buf, "cred", oplen) == 0)
+		nlines = 7;
+
+	for (p = nl + 1; nlines > 0; nlines--, p = nl + 1)
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+			return (0);
+
+	return ((size_t)(p - c->buf));
+}
+
+/*
+ * Serve the first len bytes buffered on a connection, which hold exactly
+ * one request. Returns -1 if the connection should be closed.
+ */
+static int
+serve(struct conn *c, size_t len)
+{
+	struct timespec t0, *tp;
+	FILE *in_f = NULL;
+	FILE *out_f = NULL;
+	char *line = NULL;
+	char *op, *alg, *opts, *last;
+	int fd, type, flags, r;
+	int ok = -1;
+
+	if ((in_f = fmemopen(c->buf, len, "r")) == NULL) {
+		warn("fmemopen");
+		goto out;
+	}
+	if ((fd = dup(c->fd)) < 0) {
+		warn("dup");
+		goto out;
+	}
+	if ((out_f = fdopen(fd, "w")) == NULL) {
+		warn("fdopen");
+		close(fd);
+		goto out;
+	}
+	if (string_read(in_f, &line) < 0)
+		goto out;
+
+	op = strtok_r(line, " ", &last);
+	alg = strtok_r(NULL, " ", &last);
+	opts = strtok_r(NULL, " ", &last);
+
+	if (op != NULL && strcmp(op, "stats") == 0) {
+		print_stats(out_f);
+		ok = 0;
+	} else if (op == NULL || alg == NULL ||
+	    cose_type(alg, &type) < 0 || parse_opts(opts, &flags) < 0) {
+		if (debug)
+			warnx("bad request");
+		fprintf(out_f, "error\n");
+	} else {
+		tp = clock_gettime(CLOCK_MONOTONIC, &t0) == 0 ? &t0 : NULL;
+		if (strcmp(op, "assert") == 0)
+			ok = serve_assert(in_f, type, flags, &r);
+		else if (strcmp(op, "cred") == 0)
+			ok = serve_cred(in_f, type, flags, &r);
+		if (ok < 0) {
+			if (debug)
+				warnx("bad %s request", op);
+			fprintf(out_f, "error\n");
+		} else {
+			account(tp, r);
+			fprintf(out_f, "%s\n", fido_strerr(r));
+		}
+	}
+
+	if (fflush(out_f) != 0)
+		ok = -1;
+out:
+	free(line);
+	if (out_f != NULL)
+		fclose(out_f);
+	if (in_f != NULL)
+		fclose(in_f);
+
+	memmove(c->buf, c->buf + len, c->len - len);
+	c->len -= len;
+
+	return (ok);
+}
+
+/*
+ * Every open connection is in at most one place at a time, and there are
+ * at most MAXCONN of them, so the queue cannot overflow.
+ */
+static void
+enqueue(struct conn *c)
+{
+	pthread_mutex_lock(&queue.mtx);
+	queue.c[(queue.head + queue.len) % MAXCONN] = c;
+	queue.len++;
+	pthread_cond_signal(&queue.cv);
+	pthread_mutex_unlock(&queue.mtx);
+}
+
+/*
+ * Hand a connection back to the main thread to wait for more input.
+ */
+static void
+release(struct conn *c)
+{
+	pthread_mutex_lock(&conns.mtx);
+	c->next = conns.idle;
+	conns.idle = c;
+	pthread_mutex_unlock(&conns.mtx);
+
+	/* a full pipe means a wakeup is already pending */
+	if (write(conns.wake[1], "", 1) < 0 && errno != EAGAIN)
+		warn("write");
+}
+
+/*
+ * Serve one request per turn, so that a client cannot keep a worker to
+ * itself: pipelined requests go to the back of the queue, and a client
+ * with no complete request is handed back to the main thread.
+ */
+static void *
+worker(void *arg)
+{
+	struct conn *c;
+	size_t len;
+
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&queue.mtx);
+		while (queue.len == 0)
+			pthread_cond_wait(&queue.cv, &queue.mtx);
+		c = queue.c[queue.head];
+		queue.head = (queue.head + 1) % MAXCONN;
+		queue.len--;
+		pthread_mutex_unlock(&queue.mtx);
+
+		if (conn_read(c) < 0) {
+			conn_close(c);
+			continue;
+		}
+		if ((len = request_len(c)) == 0) {
+			if (c->eof || c->len == MAXREQUEST) {
+				if (debug && c->len != 0)
+					warnx("truncated request");
+				conn_close(c);
+			} else
+				release(c);
+			continue;
+		}
+		if (serve(c, len) < 0)
+			conn_close(c);
+		else if (c->eof || request_len(c) != 0)
+			enqueue(c);
+		else
+			release(c);
+	}
+
+	/* NOTREACHED */
+	return (NULL);
+}
+
+static void
+sighandler(int signo)
+{
+	got_signal = signo;
+}
+
+static int
+listen_unix(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+	mode_t mask;
+	int fd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlcpy(addr.sun_path, path, sizeof(addr.sun_path)) >=
+	    sizeof(addr.sun_path))
+		errx(1, "%s: path too long", path);
+
+	/* remove a stale socket, but nothing else */
+	if (lstat(path, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode))
+			errx(1, "%s: not a socket", path);
+		if (unlink(path) < 0)
+			err(1, "unlink %s", path);
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	/* create the socket with sock_mode, not a mode left to the umask */
+	mask = umask(~sock_mode & 0777);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		err(1, "bind %s", path);
+	umask(mask);
+	if (listen(fd, SOMAXCONN) < 0)
+		err(1, "listen");
+
+	return (fd);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sa;
+	struct pollfd pfd[MAXCONN + 2];
+	struct conn *idle[MAXCONN];
+	struct conn *c, *next;
+	pthread_t tid;
+	const char *path;
+	size_t nidle = 0, n;
+	time_t t;
+	char byte, *ep;
+	long mode;
+	int ch, fd, s;
+
+	while ((ch = getopt(argc, argv, "dj:m:")) != -1) {
+		switch (ch) {
+		case 'd':
+			debug = 1;
+			break;
+		case 'j':
+			if ((nworkers = base10(optarg)) < 1 ||
+			    nworkers > MAXWORKERS)
+				errx(1, "-j: invalid argument '%s'", optarg);
+			break;
+		case 'm':
+			mode = strtol(optarg, &ep, 8);
+			if (*optarg == '\0' || *ep != '\0' || mode < 0 ||
+			    mode > 0777)
+				errx(1, "-m: invalid argument '%s'", optarg);
+			sock_mode = (mode_t)mode;
+			break;
+		default:
+			verifyd_usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		verifyd_usage();
+
+	path = argv[0];
+
+	fido_init(debug ? FIDO_DEBUG : 0);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) < 0)
+		err(1, "sigaction");
+	sa.sa_handler = sighandler;
+	if (sigaction(SIGINT, &sa, NULL) < 0 ||
+	    sigaction(SIGTERM, &sa, NULL) < 0)
+		err(1, "sigaction");
+
+	if (pipe(conns.wake) < 0)
+		err(1, "pipe");
+	if (fcntl(conns.wake[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(conns.wake[1], F_SETFL, O_NONBLOCK) < 0)
+		err(1, "fcntl");
+
+	s = listen_unix(path);
+
+	for (int i = 0; i < nworkers; i++)
+		if ((errno = pthread_create(&tid, NULL, worker, NULL)) != 0 ||
+		    (errno = pthread_detach(tid)) != 0)
+			err(1, "pthread_create");
+
+	/*
+	 * The main thread polls idle connections and hands those with
+	 * input to the workers. Connections idle for longer than
+	 * IDLE_TIMEOUT seconds are dropped.
+	 */
+	while (!got_signal) {
+		pfd[0].fd = s;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = conns.wake[0];
+		pfd[1].events = POLLIN;
+		for (size_t i = 0; i < nidle; i++) {
+			pfd[i + 2].fd = idle[i]->fd;
+			pfd[i + 2].events = POLLIN;
+		}
+
+		if (poll(pfd, (nfds_t)nidle + 2, 1000) < 0) {
+			if (errno != EINTR)
+				warn("poll");
+			continue;
+		}
+
+		t = now();
+
+		for (size_t i = n = 0; i < nidle; i++) {
+			c = idle[i];
+			if (pfd[i + 2].revents != 0)
+				enqueue(c);
+			else if (t != -1 && t >= c->deadline) {
+				if (debug)
+					warnx("idle timeout");
+				conn_close(c);
+			} else
+				idle[n++] = c;
+		}
+		nidle = n;
+
+		if (pfd[1].revents & POLLIN)
+			while (read(conns.wake[0], &byte, 1) > 0)
+				continue;
+
+		pthread_mutex_lock(&conns.mtx);
+		c = conns.idle;
+		conns.idle = NULL;
+		pthread_mutex_unlock(&conns.mtx);
+
+		for (; c != NULL; c = next) {
+			next = c->next;
+			c->deadline = t + IDLE_TIMEOUT;
+			idle[nidle++] = c;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			if ((fd = accept(s, NULL, NULL)) < 0) {
+				if (errno != EINTR && errno != ECONNABORTED)
+					warn("accept");
+			} else if ((c = conn_new(fd)) == NULL) {
+				close(fd);
+			} else {
+				c->deadline = t + IDLE_TIMEOUT;
+				idle[nidle++] = c;
+			}
+		}
+	}
+
+	close(s);
+	if (unlink(path) < 0)
+		warn("unlink %s", path);
+
+	exit(0);
+}
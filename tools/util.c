@@ -138,6 +138,19 @@ string_read(FILE *f, char **out)
 	return (0);
 }
 
+int
+more_input(FILE *f)
+{
+	int c;
+
+	if ((c = getc(f)) == EOF)
+		return (0);
+	if (ungetc(c, f) == EOF)
+		errx(1, "ungetc");
+
+	return (1);
+}
+
 fido_dev_t *
 open_dev(const char *path)
 {